@@ -19,13 +19,14 @@
  */
 
 #include "akonadimodel.h"
+#include "alarmmetrics.h"
 #include "alarmtime.h"
 #include "autoqpointer.h"
 #include "calendarmigrator.h"
 #include "mainwindow.h"
 #include "messagebox.h"
 #include "preferences.h"
-#include "synchtimer.h"
+#include "startuptrace.h"
 #include "kalarmsettings.h"
 #include "kalarmdirsettings.h"
 
@@ -48,6 +49,7 @@
 #include <AkonadiCore/itemmodifyjob.h>
 #include <AkonadiCore/itemdeletejob.h>
 #include <AkonadiCore/itemfetchscope.h>
+#include <AkonadiCore/transactionsequence.h>
 #include <AkonadiWidgets/agenttypedialog.h>
 
 #include <KLocalizedString>
@@ -59,12 +61,24 @@
 #include <QTimer>
 #include "kalarm_debug.h"
 
+#include <limits>
+
 using namespace Akonadi;
 using namespace KAlarmCal;
 
 static const Collection::Rights writableRights = Collection::CanChangeItem | Collection::CanCreateItem | Collection::CanDeleteItem;
 
-//static bool checkItem_true(const Item&) { return true; }
+// Maximum number of item jobs in one transaction. Transactions are kept small
+// because if any job fails, the whole transaction must be retried job by job.
+static const int BATCH_MAX_JOBS = 100;
+
+// Return the start-up trace span name for populating a collection.
+static QString populateTraceName(Collection::Id id)
+{
+    return QStringLiteral("populate collection %1").arg(id);
+}
+
+static bool checkItem_true(const Item&) { return true; }
 
 /*=============================================================================
 = Class: AkonadiModel
@@ -95,6 +109,10 @@ AkonadiModel* AkonadiModel::instance()
 AkonadiModel::AkonadiModel(ChangeRecorder* monitor, QObject* parent)
     : EntityTreeModel(monitor, parent),
       mMonitor(monitor),
+      mBatch(nullptr),
+      mBatchCount(0),
+      mRetryBatchId(0),
+      mItemModifyFlushQueued(false),
       mResourcesChecked(false),
       mMigrating(false)
 {
@@ -131,13 +149,15 @@ AkonadiModel::AkonadiModel(ChangeRecorder* monitor, QObject* parent)
     connect(monitor, SIGNAL(collectionChanged(Akonadi::Collection,QSet<QByteArray>)), SLOT(slotCollectionChanged(Akonadi::Collection,QSet<QByteArray>)));
     connect(monitor, &Monitor::collectionRemoved, this, &AkonadiModel::slotCollectionRemoved);
     initCalendarMigrator();
-    MinuteTimer::connect(this, SLOT(slotUpdateTimeTo()));
     Preferences::connect(SIGNAL(archivedColourChanged(QColor)), this, SLOT(slotUpdateArchivedColour(QColor)));
     Preferences::connect(SIGNAL(disabledColourChanged(QColor)), this, SLOT(slotUpdateDisabledColour(QColor)));
     Preferences::connect(SIGNAL(holidaysChanged(KHolidays::HolidayRegion)), this, SLOT(slotUpdateHolidays()));
     Preferences::connect(SIGNAL(workTimeChanged(QTime,QTime,QBitArray)), this, SLOT(slotUpdateWorkingHours()));
+    Preferences::connect(SIGNAL(timeZoneChanged(KTimeZone)), this, SLOT(slotUpdateTimeZone()));
+    Preferences::connect(SIGNAL(startOfDayChanged(QTime)), this, SLOT(slotUpdateStartOfDay()));
 
     connect(this, &AkonadiModel::rowsInserted, this, &AkonadiModel::slotRowsInserted);
+    connect(this, &AkonadiModel::collectionPopulated, this, &AkonadiModel::slotCollectionPopulated);
     connect(this, &AkonadiModel::rowsAboutToBeRemoved, this, &AkonadiModel::slotRowsAboutToBeRemoved);
     connect(monitor, &Monitor::itemChanged, this, &AkonadiModel::slotMonitoredItemChanged);
 
@@ -162,6 +182,7 @@ AkonadiModel::~AkonadiModel()
 */
 void AkonadiModel::checkResources(ServerManager::State state)
 {
+    StartupTrace::Span trace(QStringLiteral("AkonadiModel::checkResources"));
     switch (state)
     {
         case ServerManager::Running:
@@ -313,7 +334,8 @@ QVariant AkonadiModel::data(const QModelIndex& index, int role) const
             const int column = index.column();
             if (role == Qt::WhatsThisRole)
                 return whatsThisText(column);
-            const KAEvent event(this->event(item));
+            ItemCache& cache = itemCache(item, index);
+            const KAEvent& event = cache.event;
             if (!event.isValid())
                 return QVariant();
             if (role == AlarmActionsRole)
@@ -330,19 +352,9 @@ QVariant AkonadiModel::data(const QModelIndex& index, int role) const
                             calendarColour = true;
                             break;
                         case Qt::DisplayRole:
-                            if (event.expired())
-                                return AlarmTime::alarmTimeText(event.startDateTime());
-                            return AlarmTime::alarmTimeText(event.nextTrigger(KAEvent::DISPLAY_TRIGGER));
+                            return cachedValue(cache, CACHE_TIME_TEXT);
                         case SortRole:
-                        {
-                            DateTime due;
-                            if (event.expired())
-                                due = event.startDateTime();
-                            else
-                                due = event.nextTrigger(KAEvent::DISPLAY_TRIGGER);
-                            return due.isValid() ? due.effectiveKDateTime().toUtc().dateTime()
-                                                 : QDateTime(QDate(9999,12,31), QTime(0,0,0));
-                        }
+                            return cachedValue(cache, CACHE_TIME_SORT);
                         default:
                             break;
                     }
@@ -354,18 +366,19 @@ QVariant AkonadiModel::data(const QModelIndex& index, int role) const
                             calendarColour = true;
                             break;
                         case Qt::DisplayRole:
+                            // Not cached, since it depends on the current time
                             if (event.expired())
                                 return QString();
                             return AlarmTime::timeToAlarmText(event.nextTrigger(KAEvent::DISPLAY_TRIGGER));
                         case SortRole:
                         {
                             if (event.expired())
-                                return -1;
+                                return Q_INT64_C(-1);
                             const DateTime due = event.nextTrigger(KAEvent::DISPLAY_TRIGGER);
                             const KDateTime now = KDateTime::currentUtcDateTime();
                             if (due.isDateOnly())
-                                return now.date().daysTo(due.date()) * 1440;
-                            return (now.secsTo(due.effectiveKDateTime()) + 59) / 60;
+                                return static_cast<qint64>(now.date().daysTo(due.date())) * 1440;
+                            return static_cast<qint64>((now.secsTo(due.effectiveKDateTime()) + 59) / 60);
                         }
                     }
                     break;
@@ -376,11 +389,11 @@ QVariant AkonadiModel::data(const QModelIndex& index, int role) const
                             calendarColour = true;
                             break;
                         case Qt::DisplayRole:
-                            return repeatText(event);
+                            return cachedValue(cache, CACHE_REPEAT_TEXT);
                         case Qt::TextAlignmentRole:
                             return Qt::AlignHCenter;
                         case SortRole:
-                            return repeatOrder(event);
+                            return cachedValue(cache, CACHE_REPEAT_ORDER);
                     }
                     break;
                 case ColourColumn:
@@ -416,11 +429,8 @@ QVariant AkonadiModel::data(const QModelIndex& index, int role) const
                                 return QLatin1String("!");
                             break;
                         case SortRole:
-                        {
-                            const unsigned i = (event.actionTypes() == KAEvent::ACT_DISPLAY)
-                                               ? event.bgColour().rgb() : 0;
-                            return QStringLiteral("%1").arg(i, 6, 10, QLatin1Char('0'));
-                        }
+                            return static_cast<qint64>((event.actionTypes() == KAEvent::ACT_DISPLAY)
+                                                       ? event.bgColour().rgb() : 0);
                         default:
                             break;
                     }
@@ -449,7 +459,7 @@ QVariant AkonadiModel::data(const QModelIndex& index, int role) const
                         case ValueRole:
                             return static_cast<int>(event.actionSubType());
                         case SortRole:
-                            return QStringLiteral("%1").arg(event.actionSubType(), 2, 10, QLatin1Char('0'));
+                            return static_cast<qint64>(event.actionSubType());
                     }
                     break;
                 case TextColumn:
@@ -460,9 +470,9 @@ QVariant AkonadiModel::data(const QModelIndex& index, int role) const
                             break;
                         case Qt::DisplayRole:
                         case SortRole:
-                            return AlarmText::summary(event, 1);
+                            return cachedValue(cache, CACHE_SUMMARY);
                         case Qt::ToolTipRole:
-                            return AlarmText::summary(event, 10);
+                            return cachedValue(cache, CACHE_SUMMARY_TIP);
                         default:
                             break;
                     }
@@ -476,7 +486,7 @@ QVariant AkonadiModel::data(const QModelIndex& index, int role) const
                         case Qt::DisplayRole:
                             return event.templateName();
                         case SortRole:
-                            return event.templateName().toUpper();
+                            return cachedValue(cache, CACHE_TEMPLATE_SORT);
                     }
                     break;
                 default:
@@ -605,7 +615,7 @@ bool AkonadiModel::setData(const QModelIndex& index, const QVariant& value, int
     }
     else
     {
-        Item item = index.data(ItemRole).value<Item>();
+        Item item = queuedItem(index.data(ItemRole).value<Item>());
         if (item.isValid())
         {
             bool updateItem = false;
@@ -754,17 +764,6 @@ void AkonadiModel::signalDataChanged(bool (*checkFunc)(const Item&), int startCo
         Q_EMIT dataChanged(index(start, startColumn, parent), index(end, endColumn, parent));
 }
 
-/******************************************************************************
-* Signal every minute that the time-to-alarm values have changed.
-*/
-static bool checkItem_isActive(const Item& item)
-{ return item.mimeType() == KAlarmCal::MIME_ACTIVE; }
-
-void AkonadiModel::slotUpdateTimeTo()
-{
-    signalDataChanged(&checkItem_isActive, TimeToColumn, TimeToColumn, QModelIndex());
-}
-
 
 /******************************************************************************
 * Called when the colour used to display archived alarms has changed.
@@ -815,6 +814,7 @@ static bool checkItem_excludesHolidays(const Item& item)
 void AkonadiModel::slotUpdateHolidays()
 {
     qCDebug(KALARM_LOG);
+    mItemCache.clear();   // alarm times may have changed
     Q_ASSERT(TimeToColumn == TimeColumn + 1);  // signal should be emitted only for TimeTo and Time columns
     signalDataChanged(&checkItem_excludesHolidays, TimeColumn, TimeToColumn, QModelIndex());
 }
@@ -836,10 +836,44 @@ static bool checkItem_workTimeOnly(const Item& item)
 void AkonadiModel::slotUpdateWorkingHours()
 {
     qCDebug(KALARM_LOG);
+    mItemCache.clear();   // alarm times may have changed
     Q_ASSERT(TimeToColumn == TimeColumn + 1);  // signal should be emitted only for TimeTo and Time columns
     signalDataChanged(&checkItem_workTimeOnly, TimeColumn, TimeToColumn, QModelIndex());
 }
 
+/******************************************************************************
+* Called when the time zone has changed.
+*/
+void AkonadiModel::slotUpdateTimeZone()
+{
+    qCDebug(KALARM_LOG);
+    mItemCache.clear();   // alarm times are displayed in the new time zone
+    Q_ASSERT(TimeToColumn == TimeColumn + 1);  // signal should be emitted only for TimeTo and Time columns
+    signalDataChanged(&checkItem_true, TimeColumn, TimeToColumn, QModelIndex());
+}
+
+/******************************************************************************
+* Called when the start-of-day time has changed.
+*/
+static bool checkItem_isDateOnly(const Item& item)
+{
+    if (item.hasPayload<KAEvent>())
+    {
+        const KAEvent event = item.payload<KAEvent>();
+        if (event.isValid()  &&  event.startDateTime().isDateOnly())
+            return true;
+    }
+    return false;
+}
+
+void AkonadiModel::slotUpdateStartOfDay()
+{
+    qCDebug(KALARM_LOG);
+    mItemCache.clear();   // date-only alarm times may have changed
+    Q_ASSERT(TimeToColumn == TimeColumn + 1);  // signal should be emitted only for TimeTo and Time columns
+    signalDataChanged(&checkItem_isDateOnly, TimeColumn, TimeToColumn, QModelIndex());
+}
+
 /******************************************************************************
 * Called when the command error status of an alarm has changed, to save the new
 * status and update the visual command error indication.
@@ -989,9 +1023,25 @@ QString AkonadiModel::repeatText(const KAEvent& event) const
 }
 
 /******************************************************************************
-* Return a string for sorting the repetition column.
+* Return a key for sorting the time column.
+*/
+qint64 AkonadiModel::timeSortKey(const KAEvent& event)
+{
+    DateTime due;
+    if (event.expired())
+        due = event.startDateTime();
+    else
+        due = event.nextTrigger(KAEvent::DISPLAY_TRIGGER);
+    // Sort on seconds since the epoch, with no time after all others
+    return due.isValid() ? due.effectiveKDateTime().toUtc().dateTime().toMSecsSinceEpoch() / 1000
+                         : std::numeric_limits<qint64>::max();
+}
+
+/******************************************************************************
+* Return a key for sorting the repetition column. The repetition type is held
+* in the upper 32 bits, and the interval in the lower 32 bits.
 */
-QString AkonadiModel::repeatOrder(const KAEvent& event) const
+qint64 AkonadiModel::repeatOrder(const KAEvent& event)
 {
     int repeatOrder = 0;
     int repeatInterval = 0;
@@ -1024,7 +1074,7 @@ QString AkonadiModel::repeatOrder(const KAEvent& event) const
                 break;
         }
     }
-    return QStringLiteral("%1%2").arg(static_cast<char>('0' + repeatOrder)).arg(repeatInterval, 8, 10, QLatin1Char('0'));
+    return (static_cast<qint64>(repeatOrder) << 32) | static_cast<quint32>(repeatInterval);
 }
 
 /******************************************************************************
@@ -1076,6 +1126,66 @@ QString AkonadiModel::whatsThisText(int column) const
     }
 }
 
+/******************************************************************************
+* Return the cached data for an item, discarding any values which were computed
+* for a previous revision of the item.
+*/
+AkonadiModel::ItemCache& AkonadiModel::itemCache(const Item& item, const QModelIndex& index) const
+{
+    QHash<Item::Id, ItemCache>::Iterator it = mItemCache.find(item.id());
+    if (it == mItemCache.end())
+        it = mItemCache.insert(item.id(), ItemCache());
+    else if (it.value().revision == item.revision())
+        return it.value();
+    ItemCache& cache = it.value();
+    cache.event    = event(item, index, nullptr);
+    cache.revision = item.revision();
+    cache.fields   = 0;
+    return cache;
+}
+
+/******************************************************************************
+* Return a display value for an item, computing it if it is not already cached.
+*/
+const QVariant& AkonadiModel::cachedValue(ItemCache& cache, CacheField field) const
+{
+    QVariant& value = cache.values[field];
+    if (cache.fields & (1u << field))
+        return value;
+    const KAEvent& event = cache.event;
+    switch (field)
+    {
+        case CACHE_TIME_TEXT:
+            if (event.expired())
+                value = AlarmTime::alarmTimeText(event.startDateTime());
+            else
+                value = AlarmTime::alarmTimeText(event.nextTrigger(KAEvent::DISPLAY_TRIGGER));
+            break;
+        case CACHE_TIME_SORT:
+            value = timeSortKey(event);
+            break;
+        case CACHE_REPEAT_TEXT:
+            value = repeatText(event);
+            break;
+        case CACHE_REPEAT_ORDER:
+            value = repeatOrder(event);
+            break;
+        case CACHE_SUMMARY:
+            value = AlarmText::summary(event, 1);
+            break;
+        case CACHE_SUMMARY_TIP:
+            value = AlarmText::summary(event, 10);
+            break;
+        case CACHE_TEMPLATE_SORT:
+            value = event.templateName().toUpper();
+            break;
+        default:
+            break;
+    }
+    cache.fields |= (1u << field);
+    return value;
+}
+
 /******************************************************************************
 * Remove a collection from Akonadi. The calendar file is not removed.
 */
@@ -1199,23 +1309,19 @@ QModelIndex AkonadiModel::eventIndex(const KAEvent& event)
 */
 Item::Id AkonadiModel::findItemId(const KAEvent& event)
 {
-    Collection::Id colId = event.collectionId();
-    QModelIndex start = (colId < 0) ? index(0, 0) : collectionIndex(Collection(colId));
-    Qt::MatchFlags flags = (colId < 0) ? Qt::MatchExactly | Qt::MatchRecursive | Qt::MatchCaseSensitive | Qt::MatchWrap
-                                       : Qt::MatchExactly | Qt::MatchRecursive | Qt::MatchCaseSensitive;
-    const QModelIndexList indexes = match(start, RemoteIdRole, event.id(), -1, flags);
-    foreach (const QModelIndex& ix, indexes)
+    const Collection::Id colId = event.collectionId();
+    if (colId >= 0)
     {
-        if (ix.isValid())
-        {
-            Item::Id id = ix.data(ItemIdRole).toLongLong();
-            if (id >= 0)
-            {
-                if (colId < 0
-                ||  ix.data(ParentCollectionRole).value<Collection>().id() == colId)
-                    return id;
-            }
-        }
+        QHash<Collection::Id, QHash<QString, Item::Id> >::Iterator cit = mRemoteIdIndex.find(colId);
+        if (cit == mRemoteIdIndex.end())
+            return -1;
+        return indexedItemId(cit.value(), event.id());
+    }
+    for (QHash<Collection::Id, QHash<QString, Item::Id> >::Iterator cit = mRemoteIdIndex.begin();  cit != mRemoteIdIndex.end();  ++cit)
+    {
+        const Item::Id id = indexedItemId(cit.value(), event.id());
+        if (id >= 0)
+            return id;
     }
     return -1;
 }
@@ -1335,8 +1441,10 @@ AkonadiModel::Result AkonadiModel::addEvent(KAEvent* event, CalEvent::Type type,
 bool AkonadiModel::addEvents(const KAEvent::List& events, Collection& collection)
 {
     bool ok = true;
+    startBatch();
     for (int i = 0, count = events.count();  i < count;  ++i)
         ok = ok && addEvent(*events[i], collection);
+    endBatch();
     return ok;
 }
 
@@ -1360,9 +1468,8 @@ bool AkonadiModel::addEvent(KAEvent& event, Collection& collection)
     }
     event.setItemId(item.id());
 qCDebug(KALARM_LOG)<<"-> item id="<<item.id();
-    ItemCreateJob* job = new ItemCreateJob(item, collection);
-    connect(job, &ItemCreateJob::result, this, &AkonadiModel::itemJobDone);
-    mPendingItemJobs[job] = item.id();
+    ItemCreateJob* job = new ItemCreateJob(item, collection, batchTransaction());
+    setItemJob(job, item, collection);
     job->start();
 qCDebug(KALARM_LOG)<<"...exiting";
     return true;
@@ -1388,7 +1495,7 @@ qCDebug(KALARM_LOG)<<"item id="<<itemId;
     if (!ix.isValid())
         return false;
     const Collection collection = ix.data(ParentCollectionRole).value<Collection>();
-    Item item = ix.data(ItemRole).value<Item>();
+    Item item = queuedItem(ix.data(ItemRole).value<Item>());
 qCDebug(KALARM_LOG)<<"item id="<<item.id()<<", revision="<<item.revision();
     if (!newEvent.setItemPayload(item, collection.contentMimeTypes()))
     {
@@ -1418,14 +1525,101 @@ bool AkonadiModel::deleteEvent(Akonadi::Item::Id itemId)
         qCDebug(KALARM_LOG) << "Collection being deleted";
         return true;    // the event's collection is being deleted
     }
+    mItemModifyPending.remove(itemId);   // no point in modifying it first
+    mItemModifyBatched.remove(itemId);
     const Item item = ix.data(ItemRole).value<Item>();
-    ItemDeleteJob* job = new ItemDeleteJob(item);
-    connect(job, &ItemDeleteJob::result, this, &AkonadiModel::itemJobDone);
-    mPendingItemJobs[job] = itemId;
+    ItemDeleteJob* job = new ItemDeleteJob(item, batchTransaction());
+    setItemJob(job, item);
     job->start();
     return true;
 }
 
+/******************************************************************************
+* Start a group of item jobs to be executed in transactions.
+*/
+void AkonadiModel::startBatch()
+{
+    if (!mBatchCount++)
+        mBatch = createTransaction();
+}
+
+/******************************************************************************
+* End a group of item jobs, and commit the transaction containing them.
+*/
+void AkonadiModel::endBatch()
+{
+    if (mBatchCount <= 0)
+        return;
+    if (mBatchCount == 1)
+        flushItemModifyJobs();   // include held item modifications in the transaction
+    if (--mBatchCount)
+        return;
+    TransactionSequence* batch = mBatch;
+    mBatch = nullptr;
+    qCDebug(KALARM_LOG) << "Committing" << mPendingBatchJobs[batch].jobs.count() << "item jobs";
+    batch->commit();
+}
+
+/******************************************************************************
+* Create a transaction for a group of item jobs.
+*/
+TransactionSequence* AkonadiModel::createTransaction()
+{
+    TransactionSequence* transaction = new TransactionSequence(this);
+    // Don't commit as soon as the jobs created so far have completed,
+    // in case more jobs are still to be added.
+    transaction->setAutomaticCommittingEnabled(false);
+    connect(transaction, &TransactionSequence::result, this, &AkonadiModel::batchJobDone);
+    mPendingBatchJobs[transaction] = BatchData();
+    return transaction;
+}
+
+/******************************************************************************
+* Return the transaction which a new item job should be added to, or null if
+* no group of item jobs is in progress. If the current transaction is full, it
+* is committed and a new one is started.
+*/
+TransactionSequence* AkonadiModel::batchTransaction()
+{
+    if (mBatch  &&  mPendingBatchJobs[mBatch].jobs.count() >= BATCH_MAX_JOBS)
+    {
+        qCDebug(KALARM_LOG) << "Committing" << BATCH_MAX_JOBS << "item jobs";
+        mBatch->commit();
+        mBatch = createTransaction();
+    }
+    return mBatch;
+}
+
+/******************************************************************************
+* Record a new item job, and connect it to the slot to handle its completion.
+* If the job is a subjob of a transaction, its details are recorded so that it
+* can be retried if the transaction fails.
+*/
+void AkonadiModel::setItemJob(KJob* job, const Item& item, const Collection& collection)
+{
+    mPendingItemJobs[job] = item.id();
+    TransactionSequence* transaction = qobject_cast<TransactionSequence*>(job->parent());
+    if (transaction)
+    {
+        mPendingBatchJobs[transaction].jobs += BatchJob(itemOperation(job), item, collection);
+        connect(job, &KJob::result, this, &AkonadiModel::batchItemJobDone);
+    }
+    else
+        connect(job, &KJob::result, this, &AkonadiModel::itemJobDone);
+}
+
+/******************************************************************************
+* Return the type of operation performed by an item job.
+*/
+AkonadiModel::ItemOperation AkonadiModel::itemOperation(const KJob* job)
+{
+    if (qobject_cast<const ItemCreateJob*>(job))
+        return ITEM_CREATE;
+    if (qobject_cast<const ItemDeleteJob*>(job))
+        return ITEM_DELETE;
+    return ITEM_MODIFY;
+}
+
 /******************************************************************************
 * Queue an ItemModifyJob for execution. Ensure that only one job is
 * simultaneously active for any one Item.
@@ -1433,10 +1627,15 @@ bool AkonadiModel::deleteEvent(Akonadi::Item::Id itemId)
 * This is necessary because we can't call two ItemModifyJobs for the same Item
 * at the same time; otherwise Akonadi will detect a conflict and require manual
 * intervention to resolve it.
+*
+* The job is not executed immediately, so that successive changes to the same
+* Item (e.g. a command error status change followed by rescheduling) result in
+* only one job.
 */
 void AkonadiModel::queueItemModifyJob(const Item& item)
 {
     qCDebug(KALARM_LOG) << item.id();
+    AlarmMetrics::instance()->countItemModifyRequest();
     QMap<Item::Id, Item>::Iterator it = mItemModifyJobQueue.find(item.id());
     if (it != mItemModifyJobQueue.end())
     {
@@ -1446,8 +1645,60 @@ void AkonadiModel::queueItemModifyJob(const Item& item)
     }
     else
     {
-        // There is no job already queued for this item
-        if (mItemsBeingCreated.contains(item.id()))
+        // Hold the modification until control returns to the event loop, so
+        // that any further changes made to the item in the meantime are
+        // combined into the same job. If the modification is part of a group
+        // of item jobs, it will be included in the group's transaction.
+        mItemModifyPending[item.id()] = item;
+        if (mBatchCount)
+            mItemModifyBatched += item.id();
+        if (!mItemModifyFlushQueued)
+        {
+            mItemModifyFlushQueued = true;
+            QTimer::singleShot(0, this, &AkonadiModel::flushItemModifyJobs);
+        }
+    }
+}
+
+/******************************************************************************
+* Return the latest state of an item, including any modifications which are
+* queued but have not yet been sent to Akonadi.
+*/
+Item AkonadiModel::queuedItem(const Item& item) const
+{
+    QMap<Item::Id, Item>::ConstIterator it = mItemModifyPending.constFind(item.id());
+    if (it != mItemModifyPending.constEnd())
+        return it.value();
+    it = mItemModifyJobQueue.constFind(item.id());
+    if (it != mItemModifyJobQueue.constEnd()  &&  it.value().isValid())
+        return it.value();
+    return item;
+}
+
+/******************************************************************************
+* Execute the item modifications which have accumulated since control last
+* returned to the event loop. Modifications which were made as part of a group
+* of item jobs are added to the group's transaction; others are executed in
+* separate jobs, so that a failure of one does not affect any other.
+*/
+void AkonadiModel::flushItemModifyJobs()
+{
+    mItemModifyFlushQueued = false;
+    if (mItemModifyPending.isEmpty())
+        return;
+    QMap<Item::Id, Item> pending;
+    pending.swap(mItemModifyPending);
+    QSet<Item::Id> batched;
+    batched.swap(mItemModifyBatched);
+    for (QMap<Item::Id, Item>::ConstIterator it = pending.constBegin();  it != pending.constEnd();  ++it)
+    {
+        const Item& item = it.value();
+        if (mItemModifyJobQueue.contains(item.id()))
+        {
+            // A job has been started for the item since it was held
+            mItemModifyJobQueue[item.id()] = item;
+        }
+        else if (mItemsBeingCreated.contains(item.id()))
         {
             qCDebug(KALARM_LOG) << "Waiting for item initialisation";
             mItemModifyJobQueue[item.id()] = item;   // wait for item initialisation to complete
@@ -1459,10 +1710,10 @@ void AkonadiModel::queueItemModifyJob(const Item& item)
             if (current.isValid())
                 newItem.setRevision(current.revision());
             mItemModifyJobQueue[item.id()] = Item();   // mark the queued item as now executing
-            ItemModifyJob* job = new ItemModifyJob(newItem);
+            ItemModifyJob* job = new ItemModifyJob(newItem, (batched.contains(item.id()) ? batchTransaction() : nullptr));
             job->disableRevisionCheck();
-            connect(job, &ItemModifyJob::result, this, &AkonadiModel::itemJobDone);
-            mPendingItemJobs[job] = item.id();
+            setItemJob(job, newItem);
+            AlarmMetrics::instance()->countItemModifyJob();
             qCDebug(KALARM_LOG) << "Executing Modify job for item" << item.id() << ", revision=" << newItem.revision();
         }
     }
@@ -1485,6 +1736,13 @@ void AkonadiModel::itemJobDone(KJob* j)
         itemId = it.value();
         mPendingItemJobs.erase(it);
     }
+    const QMap<KJob*, int>::iterator rit = mRetryJobs.find(j);
+    int retryBatchId = 0;
+    if (rit != mRetryJobs.end())
+    {
+        retryBatchId = rit.value();
+        mRetryJobs.erase(rit);
+    }
     const QByteArray jobClass = j->metaObject()->className();
     qCDebug(KALARM_LOG) << jobClass;
     if (j->error())
@@ -1507,9 +1765,11 @@ void AkonadiModel::itemJobDone(KJob* j)
             const Item current = itemById(itemId);    // fetch the up-to-date item
             checkQueuedItemModifyJob(current);
         }
+        // Errors in retried jobs are reported together, once all have completed.
         // Don't show error details by default, since it's from Akonadi and likely
         // to be too technical for general users.
-        KAMessageBox::detailedError(MainWindow::mainMainWindow(), errMsg, j->errorString());
+        if (!retryBatchId)
+            KAMessageBox::detailedError(MainWindow::mainMainWindow(), errMsg, j->errorString());
     }
     else
     {
@@ -1523,6 +1783,8 @@ void AkonadiModel::itemJobDone(KJob* j)
         }
         Q_EMIT itemDone(itemId);
     }
+    if (retryBatchId)
+        retryJobDone(retryBatchId, j);
 
 /*    if (itemId >= 0  &&  jobClass == "Akonadi::ItemModifyJob")
     {
@@ -1535,6 +1797,145 @@ void AkonadiModel::itemJobDone(KJob* j)
     }*/
 }
 
+/******************************************************************************
+* Called when an item job which is part of a transaction has completed.
+* Errors are not reported here, since the job will be retried if the
+* transaction fails.
+*/
+void AkonadiModel::batchItemJobDone(KJob* j)
+{
+    const QMap<KJob*, Item::Id>::iterator it = mPendingItemJobs.find(j);
+    Item::Id itemId = -1;
+    if (it != mPendingItemJobs.end())
+    {
+        itemId = it.value();
+        mPendingItemJobs.erase(it);
+    }
+    const QMap<KJob*, BatchData>::iterator bit = mPendingBatchJobs.find(qobject_cast<KJob*>(j->parent()));
+    if (bit == mPendingBatchJobs.end())
+        return;
+    BatchData& data = bit.value();
+    if (j->error())
+        qCWarning(KALARM_LOG) << j->metaObject()->className() << itemId << ":" << j->errorString();
+    else if (qobject_cast<ItemCreateJob*>(j))
+    {
+        // Prevent modification of the item until it is fully initialised.
+        const Item::Id id = static_cast<ItemCreateJob*>(j)->item().id();
+        mItemsBeingCreated << id;
+        data.created += id;
+    }
+}
+
+/******************************************************************************
+* Called when a transaction containing a group of item jobs has completed.
+* If any job failed, the whole transaction has been rolled back. In that case,
+* each of its jobs is retried on its own, so that only the jobs which fail in
+* their own right are lost.
+*/
+void AkonadiModel::batchJobDone(KJob* j)
+{
+    const QMap<KJob*, BatchData>::iterator it = mPendingBatchJobs.find(j);
+    if (it == mPendingBatchJobs.end())
+        return;
+    const BatchData data = it.value();
+    mPendingBatchJobs.erase(it);
+    qCDebug(KALARM_LOG) << data.jobs.count() << "item jobs, status:" << !j->error();
+    if (!j->error())
+    {
+        for (int i = 0, end = data.jobs.count();  i < end;  ++i)
+            Q_EMIT itemDone(data.jobs[i].item.id());
+        return;
+    }
+
+    qCWarning(KALARM_LOG) << "Transaction failed, retrying" << data.jobs.count() << "item jobs individually:" << j->errorString();
+    // Items created within the transaction no longer exist.
+    for (int i = 0, end = data.created.count();  i < end;  ++i)
+        mItemsBeingCreated.removeAll(data.created[i]);
+    const int retryBatchId = ++mRetryBatchId;
+    BatchData& retry = mRetryBatches[retryBatchId];
+    for (int i = 0, end = data.jobs.count();  i < end;  ++i)
+    {
+        const BatchJob& bjob = data.jobs[i];
+        KJob* job = nullptr;
+        switch (bjob.operation)
+        {
+            case ITEM_CREATE:
+                job = new ItemCreateJob(bjob.item, bjob.collection);
+                break;
+            case ITEM_DELETE:
+                job = new ItemDeleteJob(bjob.item);
+                break;
+            case ITEM_MODIFY:
+            {
+                const Item current = itemById(bjob.item.id());    // fetch the up-to-date item
+                const QMap<Item::Id, Item>::ConstIterator qit = mItemModifyJobQueue.constFind(bjob.item.id());
+                if (qit != mItemModifyJobQueue.constEnd()  &&  qit.value().isValid())
+                {
+                    // A later modification has been queued for the item, which
+                    // supersedes this one, so execute that instead.
+                    checkQueuedItemModifyJob(current);
+                    continue;
+                }
+                Item item = bjob.item;
+                if (current.isValid())
+                    item.setRevision(current.revision());
+                ItemModifyJob* mjob = new ItemModifyJob(item);
+                mjob->disableRevisionCheck();
+                AlarmMetrics::instance()->countItemModifyJob();
+                job = mjob;
+                break;
+            }
+            default:
+                continue;
+        }
+        setItemJob(job, bjob.item, bjob.collection);
+        mRetryJobs[job] = retryBatchId;
+        ++retry.retries;
+        job->start();
+    }
+    if (!retry.retries)
+        mRetryBatches.remove(retryBatchId);
+}
+
+/******************************************************************************
+* Called when an item job which is retrying a job from a failed transaction has
+* completed. Once all the transaction's jobs have been retried, any errors are
+* reported together, with one message for each type of operation.
+*/
+void AkonadiModel::retryJobDone(int retryBatchId, KJob* j)
+{
+    const QMap<int, BatchData>::iterator it = mRetryBatches.find(retryBatchId);
+    if (it == mRetryBatches.end())
+        return;
+    BatchData& data = it.value();
+    if (j->error())
+    {
+        if (data.errorText.isEmpty())
+            data.errorText = j->errorString();
+        ++data.errors[itemOperation(j)];
+    }
+    if (--data.retries > 0)
+        return;
+
+    QStringList errmsgs;
+    if (data.errors[ITEM_CREATE])
+        errmsgs += i18ncp("@info", "Failed to create alarm.", "Failed to create %1 alarms.", data.errors[ITEM_CREATE]);
+    if (data.errors[ITEM_MODIFY])
+        errmsgs += i18ncp("@info", "Failed to update alarm.", "Failed to update %1 alarms.", data.errors[ITEM_MODIFY]);
+    if (data.errors[ITEM_DELETE])
+        errmsgs += i18ncp("@info", "Failed to delete alarm.", "Failed to delete %1 alarms.", data.errors[ITEM_DELETE]);
+    const QString errorText = data.errorText;
+    mRetryBatches.erase(it);
+    if (!errmsgs.isEmpty())
+    {
+        const QString errMsg = errmsgs.join(QLatin1Char('\n'));
+        qCCritical(KALARM_LOG) << errMsg << ":" << errorText;
+        // Don't show error details by default, since it's from Akonadi and likely
+        // to be too technical for general users.
+        KAMessageBox::detailedError(MainWindow::mainMainWindow(), errMsg, errorText);
+    }
+}
+
 /******************************************************************************
 * Check whether there are any ItemModifyJobs waiting for a specified item, and
 * if so execute the first one provided its creation has completed. This
@@ -1572,8 +1973,8 @@ qCDebug(KALARM_LOG)<<"No more jobs queued";
         mItemModifyJobQueue[item.id()] = Item();   // mark the queued item as now executing
         ItemModifyJob* job = new ItemModifyJob(qitem);
         job->disableRevisionCheck();
-        connect(job, &ItemModifyJob::result, this, &AkonadiModel::itemJobDone);
-        mPendingItemJobs[job] = qitem.id();
+        setItemJob(job, qitem);
+        AlarmMetrics::instance()->countItemModifyJob();
         qCDebug(KALARM_LOG) << "Executing queued Modify job for item" << qitem.id() << ", revision=" << qitem.revision();
     }
 }
@@ -1584,6 +1985,7 @@ qCDebug(KALARM_LOG)<<"No more jobs queued";
 void AkonadiModel::slotRowsInserted(const QModelIndex& parent, int start, int end)
 {
     qCDebug(KALARM_LOG) << start << "-" << end << "(parent =" << parent << ")";
+    indexItems(parent, start, end);
     for (int row = start;  row <= end;  ++row)
     {
         const QModelIndex ix = index(row, 0, parent);
@@ -1593,6 +1995,7 @@ void AkonadiModel::slotRowsInserted(const QModelIndex& parent, int start, int en
             // A collection has been inserted.
             // Ignore it if it isn't owned by a valid resource.
             qCDebug(KALARM_LOG) << "Collection" << collection.id() << collection.name();
+            StartupTrace::begin(populateTraceName(collection.id()));
             if (AgentManager::self()->instance(collection.resource()).isValid())
             {
                 QSet<QByteArray> attrs;
@@ -1638,6 +2041,7 @@ void AkonadiModel::slotRowsAboutToBeRemoved(const QModelIndex& parent, int start
             qCDebug(KALARM_LOG) << "Collection:" << event.collection.id() << ", Event ID:" << event.event.id();
         Q_EMIT eventsToBeRemoved(events);
     }
+    unindexItems(parent, start, end);
 }
 
 /******************************************************************************
@@ -1657,6 +2061,93 @@ AkonadiModel::EventList AkonadiModel::eventList(const QModelIndex& parent, int s
     return events;
 }
 
+/******************************************************************************
+* Add the items in a range of rows, and in any collections among them, to the
+* item indexes.
+*/
+void AkonadiModel::indexItems(const QModelIndex& parent, int start, int end)
+{
+    for (int row = start;  row <= end;  ++row)
+    {
+        const QModelIndex ix = index(row, 0, parent);
+        const Item item = ix.data(ItemRole).value<Item>();
+        if (item.isValid())
+        {
+            mItemIndexes[item.id()] = QPersistentModelIndex(ix);
+            indexRemoteId(item, ix.data(ParentCollectionRole).value<Collection>().id());
+        }
+        else
+        {
+            const int count = rowCount(ix);
+            if (count > 0)
+                indexItems(ix, 0, count - 1);
+        }
+    }
+}
+
+/******************************************************************************
+* Remove the items in a range of rows, and in any collections among them, from
+* the item indexes.
+*/
+void AkonadiModel::unindexItems(const QModelIndex& parent, int start, int end)
+{
+    for (int row = start;  row <= end;  ++row)
+    {
+        const QModelIndex ix = index(row, 0, parent);
+        const Item item = ix.data(ItemRole).value<Item>();
+        if (item.isValid())
+        {
+            mItemIndexes.remove(item.id());
+            mItemCache.remove(item.id());
+            const Collection::Id colId = ix.data(ParentCollectionRole).value<Collection>().id();
+            QHash<Collection::Id, QHash<QString, Item::Id> >::Iterator cit = mRemoteIdIndex.find(colId);
+            if (cit != mRemoteIdIndex.end())
+            {
+                QHash<QString, Item::Id>::Iterator it = cit.value().find(item.remoteId());
+                if (it != cit.value().end()  &&  it.value() == item.id())
+                    cit.value().erase(it);
+            }
+        }
+        else
+        {
+            const int count = rowCount(ix);
+            if (count > 0)
+                unindexItems(ix, 0, count - 1);
+            const Collection collection = ix.data(CollectionRole).value<Collection>();
+            if (collection.isValid())
+                mRemoteIdIndex.remove(collection.id());
+        }
+    }
+}
+
+/******************************************************************************
+* Record the remote ID of an item.
+* If the item's remote ID has changed, the entry for its old remote ID is left
+* in place, to be discarded by indexedItemId() if it is ever looked up.
+*/
+void AkonadiModel::indexRemoteId(const Item& item, Collection::Id colId)
+{
+    if (!item.remoteId().isEmpty())
+        mRemoteIdIndex[colId][item.remoteId()] = item.id();
+}
+
+/******************************************************************************
+* Look up a remote ID in a collection's remote ID index, and check that the item
+* still has that remote ID. If it doesn't, its index entry is removed.
+* Reply = item ID, or -1 if not found.
+*/
+Item::Id AkonadiModel::indexedItemId(QHash<QString, Item::Id>& ids, const QString& remoteId) const
+{
+    QHash<QString, Item::Id>::Iterator it = ids.find(remoteId);
+    if (it == ids.end())
+        return -1;
+    const QModelIndex ix = itemIndex(it.value());
+    if (ix.isValid()  &&  ix.data(RemoteIdRole).toString() == remoteId)
+        return it.value();
+    ids.erase(it);
+    return -1;
+}
+
 /******************************************************************************
 * Called when a monitored collection's properties or content have changed.
 * Optionally emits a signal if properties of interest have changed.
@@ -1717,6 +2208,7 @@ void AkonadiModel::setCollectionChanged(const Collection& collection, const QSet
         {
             qCDebug(KALARM_LOG) << "Migration completed";
             mMigrating = false;
+            StartupTrace::end(QStringLiteral("CalendarMigrator::migrateOrCreate"));
             Q_EMIT migrationCompleted();
         }
     }
@@ -1759,10 +2251,19 @@ void AkonadiModel::slotMigrationCompleted()
     {
         qCDebug(KALARM_LOG) << "Migration completed";
         mMigrating = false;
+        StartupTrace::end(QStringLiteral("CalendarMigrator::migrateOrCreate"));
         Q_EMIT migrationCompleted();
     }
 }
 
+/******************************************************************************
+* Called when a collection has been populated.
+*/
+void AkonadiModel::slotCollectionPopulated(Collection::Id id)
+{
+    StartupTrace::end(populateTraceName(id));
+}
+
 /******************************************************************************
 * Called when an item in the monitored collections has changed.
 */
@@ -1771,6 +2272,7 @@ void AkonadiModel::slotMonitoredItemChanged(const Akonadi::Item& item, const QSe
     qCDebug(KALARM_LOG) << "item id=" << item.id() << ", revision=" << item.revision();
     mItemsBeingCreated.removeAll(item.id());   // the new item has now been initialised
     checkQueuedItemModifyJob(item);    // execute the next job queued for the item
+    mItemCache.remove(item.id());      // discard display values for the old revision
 
     KAEvent evnt = event(item);
     if (!evnt.isValid())
@@ -1783,6 +2285,7 @@ void AkonadiModel::slotMonitoredItemChanged(const Akonadi::Item& item, const QSe
             // Wait to ensure that the base EntityTreeModel has processed the
             // itemChanged() signal first, before we Q_EMIT eventChanged().
             Collection c = data(index, ParentCollectionRole).value<Collection>();
+            indexRemoteId(item, c.id());    // in case the item's remote ID has changed
             evnt.setCollectionId(c.id());
             mPendingEventChanges.enqueue(Event(evnt, c));
             QTimer::singleShot(0, this, &AkonadiModel::slotEmitEventChanged);
@@ -1822,10 +2325,10 @@ bool AkonadiModel::refresh(Akonadi::Collection& collection) const
 */
 bool AkonadiModel::refresh(Akonadi::Item& item) const
 {
-    const QModelIndexList ixs = modelIndexesForItem(this, item);
-    if (ixs.isEmpty()  ||  !ixs[0].isValid())
+    const QModelIndex ix = itemIndex(item);
+    if (!ix.isValid())
         return false;
-    item = ixs[0].data(ItemRole).value<Item>();
+    item = ix.data(ItemRole).value<Item>();
     return true;
 }
 
@@ -1856,9 +2359,18 @@ Collection AkonadiModel::collectionById(Collection::Id id) const
 */
 QModelIndex AkonadiModel::itemIndex(const Item& item) const
 {
+    QHash<Item::Id, QPersistentModelIndex>::ConstIterator it = mItemIndexes.constFind(item.id());
+    if (it != mItemIndexes.constEnd()  &&  it.value().isValid())
+        return it.value();
+    // The item isn't indexed, so search the model for it
     const QModelIndexList ixs = modelIndexesForItem(this, item);
     if (ixs.isEmpty()  ||  !ixs[0].isValid())
+    {
+        if (it != mItemIndexes.constEnd())
+            mItemIndexes.remove(item.id());
         return QModelIndex();
+    }
+    mItemIndexes[item.id()] = QPersistentModelIndex(ixs[0]);
     return ixs[0];
 }
 
@@ -1867,10 +2379,10 @@ QModelIndex AkonadiModel::itemIndex(const Item& item) const
 */
 Item AkonadiModel::itemById(Item::Id id) const
 {
-    const QModelIndexList ixs = modelIndexesForItem(this, Item(id));
-    if (ixs.isEmpty()  ||  !ixs[0].isValid())
+    const QModelIndex ix = itemIndex(id);
+    if (!ix.isValid())
         return Item();
-    return ixs[0].data(ItemRole).value<Item>();
+    return ix.data(ItemRole).value<Item>();
 }
 
 /******************************************************************************
@@ -31,12 +31,16 @@
 
 #include <QSize>
 #include <QColor>
+#include <QHash>
 #include <QMap>
+#include <QPersistentModelIndex>
 #include <QQueue>
+#include <QVector>
 
 namespace Akonadi
 {
 class ChangeRecorder;
+class TransactionSequence;
 }
 
 class QPixmap;
@@ -69,7 +73,7 @@ class AkonadiModel : public Akonadi::EntityTreeModel
             AlarmActionsRole,          // KAEvent::Actions
             AlarmSubActionRole,        // KAEvent::Action
             ValueRole,                 // numeric value
-            SortRole,                  // the value to use for sorting
+            SortRole,                  // the value to use for sorting (qint64 for numeric columns)
             CommandErrorRole           // last command execution error for alarm (per user)
         };
 
@@ -173,6 +177,18 @@ class AkonadiModel : public Akonadi::EntityTreeModel
         bool  deleteEvent(const KAEvent& event);
         bool  deleteEvent(Akonadi::Item::Id itemId);
 
+        /** Start a group of item creations, updates and deletions which are to
+         *  be executed in Akonadi transactions of up to 100 jobs each, instead
+         *  of each being committed separately. Calls may be nested; the last
+         *  transaction is committed by the final endBatch() call. If a
+         *  transaction fails, each of its jobs is retried on its own, so that
+         *  one failing item does not cause changes to other items to be lost.
+         *  Errors in retried jobs are reported once for each transaction.
+         */
+        void  startBatch();
+        /** End a group of item operations started by startBatch(). */
+        void  endBatch();
+
         /** Check whether a collection is stored in the current KAlarm calendar format. */
         static bool isCompatible(const Akonadi::Collection&);
 
@@ -203,6 +219,13 @@ class AkonadiModel : public Akonadi::EntityTreeModel
 
         static CalEvent::Types types(const Akonadi::Collection&);
 
+        /** Return the SortRole value for the time column: seconds since the
+         *  epoch of the event's next trigger, or the maximum value if none. */
+        static qint64 timeSortKey(const KAEvent&);
+        /** Return the SortRole value for the repetition column: the repetition
+         *  type in the upper 32 bits, and the interval in the lower 32 bits. */
+        static qint64 repeatOrder(const KAEvent&);
+
         static QSize iconSize()  { return mIconSize; }
 
     Q_SIGNALS:
@@ -260,17 +283,22 @@ class AkonadiModel : public Akonadi::EntityTreeModel
                        { setCollectionChanged(c, attrNames, false); }
         void slotCollectionRemoved(const Akonadi::Collection&);
         void slotCollectionBeingCreated(const QString& path, Akonadi::Collection::Id, bool finished);
-        void slotUpdateTimeTo();
+        void slotCollectionPopulated(Akonadi::Collection::Id);
         void slotUpdateArchivedColour(const QColor&);
         void slotUpdateDisabledColour(const QColor&);
         void slotUpdateHolidays();
         void slotUpdateWorkingHours();
+        void slotUpdateTimeZone();
+        void slotUpdateStartOfDay();
         void slotRowsInserted(const QModelIndex& parent, int start, int end);
         void slotRowsAboutToBeRemoved(const QModelIndex& parent, int start, int end);
         void slotMonitoredItemChanged(const Akonadi::Item&, const QSet<QByteArray>&);
         void slotEmitEventChanged();
         void modifyCollectionJobDone(KJob*);
         void itemJobDone(KJob*);
+        void batchItemJobDone(KJob*);
+        void batchJobDone(KJob*);
+        void flushItemModifyJobs();
 
     private:
         struct CalData   // data per collection
@@ -287,6 +315,39 @@ class AkonadiModel : public Akonadi::EntityTreeModel
             Akonadi::Collection::Id id;
             QString                 displayName;
         };
+        enum ItemOperation { ITEM_CREATE, ITEM_MODIFY, ITEM_DELETE, ITEM_OPERATION_COUNT };
+        struct BatchJob      // an item job within a transaction, held so that it can be retried
+        {
+            BatchJob() : operation(ITEM_MODIFY) {}
+            BatchJob(ItemOperation o, const Akonadi::Item& i, const Akonadi::Collection& c)
+                : item(i), collection(c), operation(o) {}
+            Akonadi::Item       item;         // the item, as passed to the job
+            Akonadi::Collection collection;   // collection to create the item in
+            ItemOperation       operation;
+        };
+        struct BatchData     // item data for a transaction containing a group of item jobs,
+        {                    // or for the retries of the jobs in a failed transaction
+            BatchData() : retries(0)  { errors[ITEM_CREATE] = errors[ITEM_MODIFY] = errors[ITEM_DELETE] = 0; }
+            QVector<BatchJob>          jobs;       // jobs in the transaction, in order
+            QVector<Akonadi::Item::Id> created;    // items successfully created within the transaction
+            QString                    errorText;  // error text for the first failed retry
+            int                        errors[ITEM_OPERATION_COUNT];  // number of failed retries of each type
+            int                        retries;    // number of retries not yet completed
+        };
+        enum CacheField      // display values cached for each item by data()
+        {
+            CACHE_TIME_TEXT, CACHE_TIME_SORT, CACHE_REPEAT_TEXT, CACHE_REPEAT_ORDER,
+            CACHE_SUMMARY, CACHE_SUMMARY_TIP, CACHE_TEMPLATE_SORT,
+            CACHE_FIELD_COUNT
+        };
+        struct ItemCache     // event and display values computed from an item, for data()
+        {
+            ItemCache() : revision(-1), fields(0) {}
+            KAEvent  event;                       // the item's event, with its collection ID set
+            QVariant values[CACHE_FIELD_COUNT];   // display values which have been computed
+            int      revision;                    // item revision which the cached data applies to
+            unsigned fields;                      // bit mask of CacheFields held in values[]
+        };
         struct CollTypeData  // data for configuration dialog for collection creation job
         {
             CollTypeData() : parent(nullptr), alarmType(CalEvent::EMPTY) {}
@@ -302,15 +363,26 @@ class AkonadiModel : public Akonadi::EntityTreeModel
         void      setCollectionChanged(const Akonadi::Collection&, const QSet<QByteArray>&, bool rowInserted);
         void      queueItemModifyJob(const Akonadi::Item&);
         void      checkQueuedItemModifyJob(const Akonadi::Item&);
+        void      setItemJob(KJob*, const Akonadi::Item&, const Akonadi::Collection& = Akonadi::Collection());
+        Akonadi::TransactionSequence* createTransaction();
+        Akonadi::TransactionSequence* batchTransaction();
+        void      retryJobDone(int retryBatchId, KJob*);
+        static ItemOperation itemOperation(const KJob*);
+        Akonadi::Item queuedItem(const Akonadi::Item&) const;
 #if 0
         void     getChildEvents(const QModelIndex& parent, CalEvent::Type, KAEvent::List&) const;
 #endif
         QColor    backgroundColor_p(const Akonadi::Collection&) const;
         QString   repeatText(const KAEvent&) const;
-        QString   repeatOrder(const KAEvent&) const;
         QPixmap*  eventIcon(const KAEvent&) const;
         QString   whatsThisText(int column) const;
+        ItemCache& itemCache(const Akonadi::Item&, const QModelIndex&) const;
+        const QVariant& cachedValue(ItemCache&, CacheField) const;
         EventList eventList(const QModelIndex& parent, int start, int end);
+        void      indexItems(const QModelIndex& parent, int start, int end);
+        void      unindexItems(const QModelIndex& parent, int start, int end);
+        void      indexRemoteId(const Akonadi::Item&, Akonadi::Collection::Id);
+        Akonadi::Item::Id indexedItemId(QHash<QString, Akonadi::Item::Id>&, const QString& remoteId) const;
 
         static AkonadiModel*  mInstance;
         static QPixmap* mTextIcon;
@@ -328,13 +400,25 @@ class AkonadiModel : public Akonadi::EntityTreeModel
         QMap<KJob*, CollJobData> mPendingCollectionJobs;  // pending collection creation/deletion jobs, with collection ID & name
         QMap<KJob*, CollTypeData> mPendingColCreateJobs;  // default alarm type for pending collection creation jobs
         QMap<KJob*, Akonadi::Item::Id> mPendingItemJobs;  // pending item creation/deletion jobs, with event ID
+        QMap<KJob*, BatchData> mPendingBatchJobs;  // pending item transactions
+        QMap<int, BatchData> mRetryBatches;     // retries of jobs from failed transactions, by retry batch ID
+        QMap<KJob*, int> mRetryJobs;            // pending retried item jobs, with retry batch ID
+        Akonadi::TransactionSequence* mBatch;     // transaction for current group of item jobs, or null
+        int             mBatchCount;            // nesting level of startBatch() calls
+        int             mRetryBatchId;          // last retry batch ID allocated
         QMap<Akonadi::Item::Id, Akonadi::Item> mItemModifyJobQueue;  // pending item modification jobs, invalid item = queue empty but job active
+        QMap<Akonadi::Item::Id, Akonadi::Item> mItemModifyPending;   // item modifications held until the next event loop pass
+        QSet<Akonadi::Item::Id> mItemModifyBatched;  // held item modifications made within a group of item jobs
+        bool            mItemModifyFlushQueued; // flushItemModifyJobs() is scheduled
         QList<QString>     mCollectionsBeingCreated;  // path names of new collections being created by migrator
         QList<Akonadi::Collection::Id> mCollectionIdsBeingCreated;  // ids of new collections being created by migrator
         QList<Akonadi::Item::Id> mItemsBeingCreated;  // new items not fully initialised yet
         QList<Akonadi::Collection::Id> mCollectionsDeleting;  // collections currently being removed
         QList<Akonadi::Collection::Id> mCollectionsDeleted;   // collections recently removed
         QQueue<Event>   mPendingEventChanges;   // changed events with changedEvent() signal pending
+        QHash<Akonadi::Collection::Id, QHash<QString, Akonadi::Item::Id> > mRemoteIdIndex;  // item IDs by collection and remote ID
+        mutable QHash<Akonadi::Item::Id, QPersistentModelIndex> mItemIndexes;  // model index of each item
+        mutable QHash<Akonadi::Item::Id, ItemCache> mItemCache;  // event and display values of each item, for data()
         bool            mResourcesChecked;      // whether resource existence has been checked yet
         bool            mMigrating;             // currently migrating calendars
 };
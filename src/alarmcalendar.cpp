@@ -38,7 +38,10 @@
 #include <KJobWidgets>
 #include <kfileitem.h>
 #include <KSharedConfig>
+#include <QDataStream>
+#include <QSaveFile>
 #include <QTemporaryFile>
+#include <QTimer>
 #include <QStandardPaths>
 #include "kalarm_debug.h"
 
@@ -51,6 +54,21 @@ static KACalendar::Compat fix(const KCalCore::FileStorage::Ptr&);
 static const QString displayCalendarName = QStringLiteral("displaying.ics");
 static const Collection::Id DISPLAY_COL_ID = -1;   // collection ID used for displaying calendar
 
+// Event category held in each CollectionEvents list
+static const CalEvent::Type listTypes[] = { CalEvent::ACTIVE, CalEvent::ARCHIVED, CalEvent::TEMPLATE, CalEvent::DISPLAYING, CalEvent::EMPTY };
+
+// Snapshot of active alarms, used to schedule alarms at start-up before
+// Akonadi has provided the calendar contents.
+static const QString snapshotName = QStringLiteral("activealarms.snapshot");
+static const quint32 SNAPSHOT_MAGIC   = 0x4B414C53;   // "KALS"
+static const quint32 SNAPSHOT_VERSION = 1;
+static const int     SNAPSHOT_WRITE_DELAY = 5000;    // milliseconds to wait before writing the snapshot
+
+// Delays before retrying a failed write of a calendar file. The delay doubles
+// after each consecutive failure, up to the maximum.
+static const int     SAVE_RETRY_MIN_DELAY = 10000;          // milliseconds
+static const int     SAVE_RETRY_MAX_DELAY = 10 * 60 * 1000; // milliseconds
+
 AlarmCalendar* AlarmCalendar::mResourcesCalendar = nullptr;
 AlarmCalendar* AlarmCalendar::mDisplayCalendar = nullptr;
 
@@ -117,13 +135,7 @@ KAEvent* AlarmCalendar::getEvent(const EventId& eventId)
 * Constructor for the resources calendar.
 */
 AlarmCalendar::AlarmCalendar()
-    :
-      mCalType(RESOURCES),
-      mEventType(CalEvent::EMPTY),
-      mOpen(false),
-      mUpdateCount(0),
-      mUpdateSave(false),
-      mHaveDisabledAlarms(false)
+    : AlarmCalendar(DETACHED)
 {
     AkonadiModel* model = AkonadiModel::instance();
     connect(model, &AkonadiModel::eventsAdded, this, &AlarmCalendar::slotEventsAdded);
@@ -131,6 +143,40 @@ AlarmCalendar::AlarmCalendar()
     connect(model, &AkonadiModel::eventChanged, this, &AlarmCalendar::slotEventChanged);
     connect(model, &AkonadiModel::collectionStatusChanged, this, &AlarmCalendar::slotCollectionStatusChanged);
     Preferences::connect(SIGNAL(askResourceChanged(bool)), this, SLOT(setAskResource(bool)));
+    Preferences::connect(SIGNAL(timeZoneChanged(KTimeZone)), this, SLOT(slotTriggerTimesChanged()));
+    Preferences::connect(SIGNAL(workTimeChanged(QTime,QTime,QBitArray)), this, SLOT(slotTriggerTimesChanged()));
+    Preferences::connect(SIGNAL(holidaysChanged(KHolidays::HolidayRegion)), this, SLOT(slotTriggerTimesChanged()));
+    connect(model, &AkonadiModel::collectionPopulated, this, &AlarmCalendar::slotCollectionPopulated);
+    connect(model, &AkonadiModel::collectionTreeFetched, this, &AlarmCalendar::slotCollectionTreeFetched);
+    connect(model, &AkonadiModel::itemDone, this, &AlarmCalendar::slotItemDone);
+
+    mSnapshotTimer = new QTimer(this);
+    mSnapshotTimer->setSingleShot(true);
+    mSnapshotTimer->setInterval(SNAPSHOT_WRITE_DELAY);
+    connect(mSnapshotTimer, &QTimer::timeout, this, &AlarmCalendar::writeSnapshot);
+    loadSnapshot();
+}
+
+/******************************************************************************
+* Constructor for a resources calendar which is not connected to AkonadiModel,
+* and which has no active alarm snapshot.
+*/
+AlarmCalendar::AlarmCalendar(Detached)
+    :
+      mCalType(RESOURCES),
+      mEventType(CalEvent::EMPTY),
+      mOpen(false),
+      mUpdateCount(0),
+      mUpdateSave(false),
+      mSaveCount(0),
+      mSaveRetryDelay(0),
+      mSaveTimer(nullptr),
+      mHaveDisabledAlarms(false),
+      mTriggerCacheHits(0),
+      mTriggerCacheMisses(0),
+      mDisabledCount(0),
+      mSnapshotTimer(nullptr)
+{
 }
 
 /******************************************************************************
@@ -142,7 +188,14 @@ AlarmCalendar::AlarmCalendar(const QString& path, CalEvent::Type type)
       mOpen(false),
       mUpdateCount(0),
       mUpdateSave(false),
-      mHaveDisabledAlarms(false)
+      mSaveCount(0),
+      mSaveRetryDelay(0),
+      mSaveTimer(nullptr),
+      mHaveDisabledAlarms(false),
+      mTriggerCacheHits(0),
+      mTriggerCacheMisses(0),
+      mDisabledCount(0),
+      mSnapshotTimer(nullptr)
 {
     switch (type)
     {
@@ -160,11 +213,18 @@ AlarmCalendar::AlarmCalendar(const QString& path, CalEvent::Type type)
     icalPath.replace(QStringLiteral("\\.vcs$"), QStringLiteral(".ics"));
     mICalUrl = QUrl::fromUserInput(icalPath, QString(), QUrl::AssumeLocalFile);
     mCalType = (path == icalPath) ? LOCAL_ICAL : LOCAL_VCAL;    // is the calendar in ICal or VCal format?
+
+    mSaveTimer = new QTimer(this);
+    mSaveTimer->setSingleShot(true);
+    connect(mSaveTimer, &QTimer::timeout, this, &AlarmCalendar::slotSaveTimer);
 }
 
 AlarmCalendar::~AlarmCalendar()
 {
+    if (mSnapshotTimer  &&  mSnapshotTimer->isActive())
+        writeSnapshot();
     close();
+    qDeleteAll(mSnapshotEvents);
 }
 
 /******************************************************************************
@@ -339,8 +399,7 @@ bool AlarmCalendar::saveCal(const QString& newFile)
         if (!mCalendarStorage->save())
         {
             qCCritical(KALARM_LOG) << "Saving" << saveFilename << "failed.";
-            KAMessageBox::error(MainWindow::mainMainWindow(),
-                                xi18nc("@info", "Failed to save calendar to <filename>%1</filename>", mICalUrl.toDisplayString()));
+            saveFailed(newFile, xi18nc("@info", "Failed to save calendar to <filename>%1</filename>", mICalUrl.toDisplayString()));
             return false;
         }
 
@@ -353,8 +412,7 @@ bool AlarmCalendar::saveCal(const QString& newFile)
             if (!putJob->exec())
             {
                 qCCritical(KALARM_LOG) << saveFilename << "upload failed.";
-                KAMessageBox::error(MainWindow::mainMainWindow(),
-                                    xi18nc("@info", "Cannot upload calendar to <filename>%1</filename>", mICalUrl.toDisplayString()));
+                saveFailed(newFile, xi18nc("@info", "Cannot upload calendar to <filename>%1</filename>", mICalUrl.toDisplayString()));
                 return false;
             }
         }
@@ -369,9 +427,37 @@ bool AlarmCalendar::saveCal(const QString& newFile)
     }
 
     mUpdateSave = false;
+    mSaveCount = 0;
+    mSaveRetryDelay = 0;
+    if (mSaveTimer)
+        mSaveTimer->stop();
     return true;
 }
 
+/******************************************************************************
+* Called when writing the calendar file has failed.
+* If the file being written was the calendar's own file, the write is retried
+* after a delay which increases with each consecutive failure, and only the
+* first of a run of failures is reported to the user.
+*/
+void AlarmCalendar::saveFailed(const QString& newFile, const QString& errmsg)
+{
+    if (!newFile.isNull()  ||  !mSaveTimer)
+    {
+        KAMessageBox::error(MainWindow::mainMainWindow(), errmsg);
+        return;
+    }
+    const bool report = !mSaveRetryDelay;
+    mSaveRetryDelay = report ? SAVE_RETRY_MIN_DELAY : qMin(2 * mSaveRetryDelay, SAVE_RETRY_MAX_DELAY);
+    mSaveCount = 0;
+    mSaveTimer->start(mSaveRetryDelay);
+    qCDebug(KALARM_LOG) << "Retrying in" << mSaveRetryDelay / 1000 << "seconds";
+    // Set the retry delay before showing the error message, since the message
+    // box's event loop may attempt to save again.
+    if (report)
+        KAMessageBox::error(MainWindow::mainMainWindow(), errmsg);
+}
+
 /******************************************************************************
 * Delete any temporary file at program exit.
 */
@@ -379,6 +465,12 @@ void AlarmCalendar::close()
 {
     if (mCalType != RESOURCES)
     {
+        // Write any changes which are waiting to be saved, without waiting
+        // to retry a failed save
+        if (mSaveTimer)
+            mSaveTimer->stop();
+        flush();
+
         if (!mLocalFile.isEmpty())
         {
             if (mLocalFile.startsWith(QDir::tempPath())) { // removes it only if it IS a temporary file
@@ -399,6 +491,8 @@ void AlarmCalendar::close()
     // Resource map should be empty, but just in case...
     while (!mResourceMap.isEmpty())
         removeKAEvents(mResourceMap.begin().key(), true, CalEvent::ACTIVE | CalEvent::ARCHIVED | CalEvent::TEMPLATE | CalEvent::DISPLAYING);
+    while (!mArchivedStubs.isEmpty())
+        removeArchivedStubs(mArchivedStubs.begin().key());
 }
 
 
@@ -417,22 +511,30 @@ void AlarmCalendar::updateDisplayKAEvents()
         return;
     qCDebug(KALARM_LOG);
     const Collection::Id key = DISPLAY_COL_ID;
-    KAEvent::List& events = mResourceMap[key];
-    int i, end;
-    for (i = 0, end = events.count();  i < end;  ++i)
+    ResourceMap::Iterator rit = mResourceMap.find(key);
+    if (rit != mResourceMap.end())
     {
-        KAEvent* event = events[i];
-        mEventMap.remove(EventId(key, event->id()));
-        delete event;
+        for (int l = 0;  l < LIST_COUNT;  ++l)
+        {
+            KAEvent::List& events = rit.value().lists[l];
+            while (!events.isEmpty())
+            {
+                KAEvent* event = events.last();
+                mEventMap.remove(EventId(key, event->id()));
+                removeUidIndex(EventId(key, event->id()));
+                mTriggerCache.remove(EventId(key, event->id()));
+                removeEvent(key, event);
+                delete event;
+            }
+        }
+        mResourceMap.erase(rit);
     }
-    events.clear();
-    mEarliestAlarm[key] = nullptr;
     Calendar::Ptr cal = mCalendarStorage->calendar();
     if (!cal)
         return;
 
     Event::List kcalevents = cal->rawEvents();
-    for (i = 0, end = kcalevents.count();  i < end;  ++i)
+    for (int i = 0, end = kcalevents.count();  i < end;  ++i)
     {
         Event::Ptr kcalevent = kcalevents[i];
         if (kcalevent->alarms().isEmpty())
@@ -446,8 +548,9 @@ void AlarmCalendar::updateDisplayKAEvents()
             continue;    // ignore events without usable alarms
         }
         event->setCollectionId(key);
-        events += event;
+        insertEvent(key, event);
         mEventMap[EventId(key, kcalevent->uid())] = event;
+        addUidIndex(EventId(key, kcalevent->uid()));
     }
 
 }
@@ -464,44 +567,159 @@ void AlarmCalendar::removeKAEvents(Collection::Id key, bool closing, CalEvent::T
     ResourceMap::Iterator rit = mResourceMap.find(key);
     if (rit != mResourceMap.end())
     {
-        bool empty = true;
-        KAEvent::List& events = rit.value();
-        for (int i = 0, end = events.count();  i < end;  ++i)
+        for (int l = 0;  l < LIST_COUNT;  ++l)
         {
-            KAEvent* event = events[i];
-            bool remove = (event->collectionId() != key);
-            if (remove)
+            // Events without a category are only removed when closing
+            const CalEvent::Type type = listTypes[l];
+            if (type == CalEvent::EMPTY ? !closing : !(types & type))
+                continue;
+            KAEvent::List& events = rit.value().lists[l];
+            while (!events.isEmpty())
             {
-                if (key != DISPLAY_COL_ID)
+                KAEvent* event = events.last();
+                if (event->collectionId() != key  &&  key != DISPLAY_COL_ID)
                     qCCritical(KALARM_LOG) << "Event" << event->id() << ", collection" << event->collectionId() << "Indexed under collection" << key;
-            }
-            else
-                remove = event->category() & types;
-            if (remove)
-            {
                 mEventMap.remove(EventId(key, event->id()));
+                removeUidIndex(EventId(key, event->id()));
+                mTriggerCache.remove(EventId(key, event->id()));
+                removeEvent(key, event);
                 delete event;
                 removed = true;
             }
-            else
-                empty = false;
         }
-        if (empty)
+        if (rit.value().isEmpty())
             mResourceMap.erase(rit);
     }
+    if ((types & CalEvent::ACTIVE)  &&  removeSnapshotEvents(key))
+        removed = true;
+    if (types & CalEvent::ARCHIVED)
+        removeArchivedStubs(key);
     if (removed)
     {
-        mEarliestAlarm.remove(key);
+        mEarliestAlarms.removeCollection(key);
         // Emit signal only if we're not in the process of closing the calendar
         if (!closing  &&  mOpen)
         {
             Q_EMIT earliestAlarmChanged();
             if (mHaveDisabledAlarms)
                 checkForDisabledAlarms();
+            snapshotChanged();
         }
     }
 }
 
+/******************************************************************************
+* Return the index of the CollectionEvents list which holds a category of event.
+*/
+int AlarmCalendar::listIndex(CalEvent::Type type)
+{
+    switch (type)
+    {
+        case CalEvent::ACTIVE:      return ACTIVE_LIST;
+        case CalEvent::ARCHIVED:    return ARCHIVED_LIST;
+        case CalEvent::TEMPLATE:    return TEMPLATE_LIST;
+        case CalEvent::DISPLAYING:  return DISPLAYING_LIST;
+        default:                    return OTHER_LIST;
+    }
+}
+
+bool AlarmCalendar::CollectionEvents::isEmpty() const
+{
+    for (int l = 0;  l < LIST_COUNT;  ++l)
+        if (!lists[l].isEmpty())
+            return false;
+    return true;
+}
+
+/******************************************************************************
+* Append a collection's events of the specified types to a list.
+*/
+void AlarmCalendar::appendEvents(const CollectionEvents& events, CalEvent::Types types, KAEvent::List& list)
+{
+    for (int l = 0;  l < LIST_COUNT;  ++l)
+    {
+        if (types == CalEvent::EMPTY  ||  (types & listTypes[l]))
+            list += events.lists[l];
+    }
+}
+
+/******************************************************************************
+* Add an event to its collection's list for the event's category, and record
+* its position and state.
+*/
+void AlarmCalendar::insertEvent(Collection::Id key, KAEvent* event)
+{
+    const int l = listIndex(event->category());
+    KAEvent::List& events = mResourceMap[key].lists[l];
+    EventSlot& slot = mEventSlots[event];
+    slot.list  = l;
+    slot.index = events.count();
+    events += event;
+    updateEventState(event);
+}
+
+/******************************************************************************
+* Remove an event from its collection's category list. The last event in the
+* list is moved into its place, so that the order of the list is not retained.
+* The event is not deleted.
+*/
+void AlarmCalendar::removeEvent(Collection::Id key, KAEvent* event)
+{
+    QHash<const KAEvent*, EventSlot>::Iterator sit = mEventSlots.find(event);
+    if (sit == mEventSlots.end())
+        return;
+    const EventSlot slot = sit.value();
+    mEventSlots.erase(sit);
+    ResourceMap::Iterator rit = mResourceMap.find(key);
+    if (rit != mResourceMap.end())
+    {
+        KAEvent::List& events = rit.value().lists[slot.list];
+        if (slot.index < events.count()  &&  events[slot.index] == event)
+        {
+            KAEvent* last = events.last();
+            events[slot.index] = last;
+            events.removeLast();
+            if (last != event)
+                mEventSlots[last].index = slot.index;
+        }
+    }
+    if (slot.disabled)
+        --mDisabledCount;
+    if (slot.atLogin)
+        mAtLoginEvents.remove(event);
+    mUpcomingAlarms.remove(EventId(key, event->id()));
+}
+
+/******************************************************************************
+* Update the disabled alarm count, the at-login alarm set and the upcoming alarm
+* index after an event held in mResourceMap has been changed. The event's
+* category must not have changed.
+*/
+void AlarmCalendar::updateEventState(KAEvent* event)
+{
+    QHash<const KAEvent*, EventSlot>::Iterator sit = mEventSlots.find(event);
+    if (sit == mEventSlots.end())
+        return;
+    EventSlot& slot = sit.value();
+    const bool active   = (event->category() == CalEvent::ACTIVE);
+    const bool disabled = active  &&  !event->enabled();
+    if (disabled != slot.disabled)
+    {
+        slot.disabled = disabled;
+        mDisabledCount += disabled ? 1 : -1;
+    }
+    const bool atLogin = active  &&  event->repeatAtLogin();
+    if (atLogin != slot.atLogin)
+    {
+        slot.atLogin = atLogin;
+        if (atLogin)
+            mAtLoginEvents += event;
+        else
+            mAtLoginEvents.remove(event);
+    }
+    updateUpcomingAlarm(event);
+}
+
 /******************************************************************************
 * Called when the enabled or read-only status of a collection has changed.
 * If the collection is now disabled, remove its events from the calendar.
@@ -540,6 +758,9 @@ void AlarmCalendar::slotEventChanged(const AkonadiModel::Event& event)
         return;
     }
 
+    // Akonadi's copy of the event supersedes any copy loaded from the snapshot
+    removeSnapshotEvent(event.eventId());
+
     bool added = true;
     bool updated = false;
     KAEventMap::Iterator it = mEventMap.find(event.eventId());
@@ -555,11 +776,27 @@ void AlarmCalendar::slotEventChanged(const AkonadiModel::Event& event)
             updated = true;
         }
         else
+        {
+            mEventMap.erase(it);
+            removeUidIndex(event.eventId());
+            mEarliestAlarms.remove(event.eventId());
+            mTriggerCache.remove(event.eventId());
+            removeEvent(storedEvent->collectionId(), storedEvent);
             delete storedEvent;
+        }
         added = false;
     }
-    if (!updated)
+    if (event.event.category() == CalEvent::ARCHIVED)
+    {
+        // Archived events are only constructed when they are accessed
+        setArchivedStub(event.collection.id(), event.event);
+    }
+    else if (!updated)
+    {
+        if (removeArchivedStub(event.eventId()))
+            added = false;
         addNewEvent(event.collection, new KAEvent(event.event));
+    }
 
     bool enabled = event.event.enabled();
     checkForDisabledAlarms(!enabled, enabled);
@@ -578,7 +815,7 @@ void AlarmCalendar::slotEventsToBeRemoved(const AkonadiModel::EventList& events)
     {
         if (!events[i].isConsistent())
             qCCritical(KALARM_LOG) << "Inconsistent AkonadiModel::Event: event:" << events[i].event.collectionId() << ", collection" << events[i].collection.id();
-        else if (mEventMap.contains(events[i].eventId()))
+        else if (mEventMap.contains(events[i].eventId())  ||  archivedStub(events[i].eventId()))
             deleteEventInternal(events[i].event, events[i].collection, false);
     }
 }
@@ -817,10 +1054,13 @@ bool AlarmCalendar::exportAlarms(const KAEvent::List& events, QWidget* parent)
 /******************************************************************************
 * Flag the start of a group of calendar update calls.
 * The purpose is to avoid multiple calendar saves during a group of operations.
+* For Akonadi, the item changes are grouped into a single transaction.
 */
 void AlarmCalendar::startUpdate()
 {
     ++mUpdateCount;
+    if (mCalType == RESOURCES)
+        AkonadiModel::instance()->startBatch();
 }
 
 /******************************************************************************
@@ -830,10 +1070,14 @@ void AlarmCalendar::startUpdate()
 bool AlarmCalendar::endUpdate()
 {
     if (mUpdateCount > 0)
+    {
         --mUpdateCount;
+        if (mCalType == RESOURCES)
+            AkonadiModel::instance()->endBatch();
+    }
     if (!mUpdateCount)
     {
-        if (mUpdateSave)
+        if (mUpdateSave  &&  !mSaveRetryDelay)
             return saveCal();
     }
     return true;
@@ -841,34 +1085,145 @@ bool AlarmCalendar::endUpdate()
 
 /******************************************************************************
 * Save the calendar, or flag it for saving if in a group of calendar update calls.
+* Outside a group of update calls, the save is deferred for a short time so that
+* a burst of changes (e.g. alarms being created by a script via D-Bus) results
+* in only a single write of the calendar file. The save is done immediately if
+* enough changes have accumulated, or when flush() is called. After a failed
+* write, no further writes are attempted until it is time to retry.
+* Reply = false if the calendar was written and the save failed. If the save is
+*         deferred, true is returned, and a failure of the deferred write is
+*         reported by the deferredSaveFailed() signal.
 * Note that this method has no effect for Akonadi calendars.
 */
 bool AlarmCalendar::save()
 {
-    if (mUpdateCount)
-    {
-        mUpdateSave = true;
+    if (mCalType == RESOURCES)
         return true;
-    }
-    else
+    mUpdateSave = true;
+    if (mUpdateCount  ||  mSaveRetryDelay)
+        return true;
+    const int delay = Preferences::calendarSaveDelay();
+    if (delay <= 0  ||  ++mSaveCount >= Preferences::calendarSaveBatch())
         return saveCal();
+    if (!mSaveTimer->isActive())
+        mSaveTimer->start(delay);   // don't restart it, so that saves can't be put off indefinitely
+    return true;
+}
+
+/******************************************************************************
+* Write any deferred changes to the calendar file now.
+* If the save fails, the changes remain pending, to be written when the save is
+* retried. While waiting to retry, nothing is written.
+* Reply = false if the save failed, or a retry is pending.
+*/
+bool AlarmCalendar::flush()
+{
+    if (mSaveRetryDelay  &&  mSaveTimer->isActive())
+        return false;   // wait until it's time to retry the failed save
+    if (mSaveTimer)
+        mSaveTimer->stop();
+    if (mUpdateCount  ||  !mUpdateSave)
+        return true;
+    if (saveCal())
+        return true;
+    qCCritical(KALARM_LOG) << "Deferred save of" << mUrl.toDisplayString() << "failed";
+    Q_EMIT deferredSaveFailed(this);
+    return false;
+}
+
+/******************************************************************************
+* Called when the deferred save timer expires.
+*/
+void AlarmCalendar::slotSaveTimer()
+{
+    flush();
 }
 
 /******************************************************************************
 * This method must only be called from the main KAlarm queue processing loop,
 * to prevent asynchronous calendar operations interfering with one another.
 *
-* Purge a list of archived events from the calendar.
+* Purge archived events created before a cutoff date from a collection. All
+* archived events in the collection are purged if 'cutoff' is invalid.
+* No more than 'maxCount' events are purged, oldest first, so that a large
+* purge can be spread over several calls. Each call continues from where the
+* previous call with the same cutoff date stopped. The purgeChunkDone() signal
+* is emitted once the deletions started by the call have completed.
+* Reply = true if more events remain to be purged.
 */
-void AlarmCalendar::purgeEvents(const KAEvent::List& events)
+bool AlarmCalendar::purgeArchivedEvents(Collection::Id collectionId, const QDate& cutoff, int maxCount)
 {
-    for (int i = 0, end = events.count();  i < end;  ++i)
+    QMap<Collection::Id, PurgeQueue>::Iterator qit = mPurgeQueues.find(collectionId);
+    if (qit == mPurgeQueues.end()  ||  qit.value().cutoff != cutoff)
+    {
+        // Start a new purge. Find all the events to purge in one pass, so
+        // that later calls don't need to search past those already purged.
+        // Events archived after this are left for the next purge.
+        QMap<Collection::Id, ArchivedDateMap>::ConstIterator dit = mArchivedDates.constFind(collectionId);
+        if (dit == mArchivedDates.constEnd())
+        {
+            mPurgeQueues.remove(collectionId);
+            return false;
+        }
+        PurgeQueue queue;
+        queue.cutoff = cutoff;
+        const ArchivedDateMap& dates = dit.value();
+        const ArchivedDateMap::ConstIterator end = cutoff.isValid() ? dates.lowerBound(cutoff) : dates.constEnd();
+        for (ArchivedDateMap::ConstIterator it = dates.constBegin();  it != end;  ++it)
+        {
+            const ArchivedStub* stub = archivedStub(EventId(collectionId, it.value()));
+            if (stub)
+                queue.itemIds += stub->itemId;
+        }
+        qit = mPurgeQueues.insert(collectionId, queue);
+    }
+
+    // Take the next events to purge, omitting any whose deletion is already pending.
+    PurgeQueue& queue = qit.value();
+    QList<Item::Id> itemIds;
+    for ( ;  queue.next < queue.itemIds.count()  &&  itemIds.count() < maxCount;  ++queue.next)
     {
-        deleteEventInternal(*events[i]);
+        const Item::Id id = queue.itemIds[queue.next];
+        if (!mPurgePending.contains(id))
+            itemIds += id;
     }
-    if (mHaveDisabledAlarms)
-        checkForDisabledAlarms();
-    saveCal();
+    const bool more = (queue.next < queue.itemIds.count());
+    if (!more)
+        mPurgeQueues.erase(qit);
+    if (itemIds.isEmpty())
+        return false;
+    qCDebug(KALARM_LOG) << "Purging" << itemIds.count() << "archived events";
+
+    // The stubs are removed by slotEventsToBeRemoved() once Akonadi deletes
+    // the events, so that they remain if the deletion fails.
+    AkonadiModel* model = AkonadiModel::instance();
+    startUpdate();
+    for (int i = 0, count = itemIds.count();  i < count;  ++i)
+    {
+        mPurgePending.insert(itemIds[i]);
+        mPurgeChunk.insert(itemIds[i]);
+        if (!model->deleteEvent(itemIds[i]))
+        {
+            mPurgePending.remove(itemIds[i]);
+            mPurgeChunk.remove(itemIds[i]);
+        }
+    }
+    endUpdate();
+    return more;
+}
+
+/******************************************************************************
+* Called when an Akonadi item job has completed.
+* If deletion of a purged archived event failed, allow it to be purged again.
+* Once all deletions started by purgeArchivedEvents() have completed, notify
+* that the next events can be purged.
+*/
+void AlarmCalendar::slotItemDone(Item::Id itemId, bool status)
+{
+    if (!status)
+        mPurgePending.remove(itemId);
+    if (mPurgeChunk.remove(itemId)  &&  mPurgeChunk.isEmpty())
+        Q_EMIT purgeChunkDone();
 }
 
 /******************************************************************************
@@ -968,12 +1323,10 @@ bool AlarmCalendar::addEvent(KAEvent& evnt, QWidget* promptParent, bool useEvent
         {
             // Adding to mCalendar failed, so undo AlarmCalendar::addEvent()
             mEventMap.remove(EventId(key, event->id()));
-            KAEvent::List& events = mResourceMap[key];
-            int i = events.indexOf(event);
-            if (i >= 0)
-                events.remove(i);
-            if (mEarliestAlarm[key] == event)
-                findEarliestAlarm(key);
+            removeUidIndex(EventId(key, event->id()));
+            removeEvent(key, event);
+            if (mEarliestAlarms.remove(EventId(key, event->id())))
+                Q_EMIT earliestAlarmChanged();
         }
         delete event;
         return false;
@@ -995,28 +1348,21 @@ void AlarmCalendar::addNewEvent(const Collection& collection, KAEvent* event, bo
 {
     Collection::Id key = collection.isValid() ? collection.id() : -1;
     event->setCollectionId(key);
+    mTriggerCache.remove(EventId(key, event->id()));
     if (!replace)
     {
-        mResourceMap[key] += event;
+        insertEvent(key, event);
         mEventMap[EventId(key, event->id())] = event;
+        addUidIndex(EventId(key, event->id()));
     }
+    else
+        updateEventState(event);
     if (collection.isValid()  &&  (AkonadiModel::types(collection) & CalEvent::ACTIVE)
     &&  event->category() == CalEvent::ACTIVE)
     {
         // Update the earliest alarm to trigger
-        KAEvent* earliest = mEarliestAlarm.value(key, (KAEvent*)nullptr);
-        if (replace  &&  earliest == event)
-            findEarliestAlarm(key);
-        else
-        {
-            KDateTime dt = event->nextTrigger(KAEvent::ALL_TRIGGER).effectiveKDateTime();
-            if (dt.isValid()
-            &&  (!earliest  ||  dt < earliest->nextTrigger(KAEvent::ALL_TRIGGER)))
-            {
-                mEarliestAlarm[key] = event;
-                Q_EMIT earliestAlarmChanged();
-            }
-        }
+        updateEarliestAlarm(event);
+        snapshotChanged();
     }
 }
 
@@ -1096,6 +1442,13 @@ KAEvent* AlarmCalendar::updateEvent(const KAEvent* evnt)
         if (AkonadiModel::instance()->updateEvent(newEvnt))
         {
             *kaevnt = newEvnt;
+            mTriggerCache.remove(EventId(*kaevnt));
+            updateEventState(kaevnt);
+            if (mEarliestAlarms.contains(EventId(*kaevnt)))
+            {
+                updateEarliestAlarm(kaevnt);
+                snapshotChanged();
+            }
             return kaevnt;
         }
     }
@@ -1183,31 +1536,24 @@ CalEvent::Type AlarmCalendar::deleteEventInternal(const QString& eventID, const
     if (mCalendarStorage)
         kcalEvent = mCalendarStorage->calendar()->event(id);
     Collection::Id key = collection.isValid() ? collection.id() : -1;
-    KAEventMap::Iterator it = mEventMap.find(EventId(key, id));
+    const EventId eventId(key, id);
+    bool earliestChanged = mEarliestAlarms.remove(eventId);
+    mTriggerCache.remove(eventId);
+    KAEventMap::Iterator it = mEventMap.find(eventId);
     if (it != mEventMap.end())
     {
         KAEvent* ev = it.value();
         mEventMap.erase(it);
-        KAEvent::List& events = mResourceMap[key];
-        int i = events.indexOf(ev);
-        if (i >= 0)
-            events.remove(i);
+        removeUidIndex(eventId);
+        removeEvent(key, ev);
         delete ev;
-        if (mEarliestAlarm[key] == ev)
-            findEarliestAlarm(collection);
     }
     else
-    {
-        for (EarliestMap::Iterator eit = mEarliestAlarm.begin();  eit != mEarliestAlarm.end();  ++eit)
-        {
-            KAEvent* ev = eit.value();
-            if (ev  &&  ev->id() == id)
-            {
-                findEarliestAlarm(eit.key());
-                break;
-            }
-        }
-    }
+        removeArchivedStub(eventId);
+    if (earliestChanged)
+        Q_EMIT earliestAlarmChanged();
+    if (paramEvent.category() == CalEvent::ACTIVE)
+        snapshotChanged();
     CalEvent::Type status = CalEvent::EMPTY;
     if (kcalEvent)
     {
@@ -1250,9 +1596,12 @@ KAEvent* AlarmCalendar::event(const EventId& uniqueID, bool checkDuplicates)
         return list[0];
     }
     KAEventMap::ConstIterator it = mEventMap.constFind(uniqueID);
-    if (it == mEventMap.constEnd())
+    if (it != mEventMap.constEnd())
+        return it.value();
+    ArchivedStub* stub = archivedStub(uniqueID);
+    if (!stub)
         return nullptr;
-    return it.value();
+    return archivedEvent(*stub, uniqueID.collectionId());
 }
 
 /******************************************************************************
@@ -1292,12 +1641,20 @@ KAEvent::List AlarmCalendar::events(const QString& uniqueId) const
     KAEvent::List list;
     if (mCalType == RESOURCES  &&  isValid())
     {
-        for (ResourceMap::ConstIterator rit = mResourceMap.constBegin();  rit != mResourceMap.constEnd();  ++rit)
+        for (QMultiHash<QString, Collection::Id>::ConstIterator cit = mUidIndex.constFind(uniqueId);
+             cit != mUidIndex.constEnd()  &&  cit.key() == uniqueId;  ++cit)
         {
-            const Collection::Id id = rit.key();
-            KAEventMap::ConstIterator it = mEventMap.constFind(EventId(id, uniqueId));
+            const EventId id(cit.value(), uniqueId);
+            KAEventMap::ConstIterator it = mEventMap.constFind(id);
             if (it != mEventMap.constEnd())
                 list += it.value();
+            else
+            {
+                ArchivedStub* stub = archivedStub(id);
+                KAEvent* event = stub ? archivedEvent(*stub, id.collectionId()) : nullptr;
+                if (event)
+                    list += event;
+            }
         }
     }
     return list;
@@ -1312,32 +1669,24 @@ KAEvent::List AlarmCalendar::events(const Collection& collection, CalEvent::Type
     KAEvent::List list;
     if (mCalType != RESOURCES  &&  (!mCalendarStorage || collection.isValid()))
         return list;
+    const bool archived = (type == CalEvent::EMPTY  ||  (type & CalEvent::ARCHIVED));
     if (collection.isValid())
     {
         Collection::Id key = collection.isValid() ? collection.id() : -1;
         ResourceMap::ConstIterator rit = mResourceMap.constFind(key);
-        if (rit == mResourceMap.constEnd())
-            return list;
-        const KAEvent::List events = rit.value();
-        if (type == CalEvent::EMPTY)
-            return events;
-        for (int i = 0, end = events.count();  i < end;  ++i)
-            if (type & events[i]->category())
-                list += events[i];
+        if (rit != mResourceMap.constEnd())
+            appendEvents(rit.value(), type, list);
+        if (archived)
+            archivedEvents(key, list);
     }
     else
     {
         for (ResourceMap::ConstIterator rit = mResourceMap.constBegin();  rit != mResourceMap.constEnd();  ++rit)
+            appendEvents(rit.value(), type, list);
+        if (archived)
         {
-            const KAEvent::List events = rit.value();
-            if (type == CalEvent::EMPTY)
-                list += events;
-            else
-            {
-                for (int i = 0, end = events.count();  i < end;  ++i)
-                    if (type & events[i]->category())
-                        list += events[i];
-            }
+            for (QMap<Collection::Id, ArchivedStubMap>::Iterator ait = mArchivedStubs.begin();  ait != mArchivedStubs.end();  ++ait)
+                archivedEvents(ait.key(), list);
         }
     }
     return list;
@@ -1433,16 +1782,7 @@ void AlarmCalendar::checkForDisabledAlarms()
 {
     if (mCalType != RESOURCES)
         return;
-    bool disabled = false;
-    KAEvent::List eventlist = events(CalEvent::ACTIVE);
-    for (int i = 0, end = eventlist.count();  i < end;  ++i)
-    {
-        if (!eventlist[i]->enabled())
-        {
-            disabled = true;
-            break;
-        }
-    }
+    const bool disabled = (mDisabledCount > 0);
     if (disabled != mHaveDisabledAlarms)
     {
         mHaveDisabledAlarms = disabled;
@@ -1459,27 +1799,31 @@ KAEvent::List AlarmCalendar::atLoginAlarms() const
     if (mCalType != RESOURCES)
         return atlogins;
     AkonadiModel* model = AkonadiModel::instance();
-    if (!mCalendarStorage  ||  mCalType != RESOURCES)
-        return atlogins;
-    for (ResourceMap::ConstIterator rit = mResourceMap.constBegin();  rit != mResourceMap.constEnd();  ++rit)
+    for (QSet<KAEvent*>::ConstIterator it = mAtLoginEvents.constBegin();  it != mAtLoginEvents.constEnd();  ++it)
     {
-        const Collection::Id id = rit.key();
-        if (id < 0
-        ||  !(AkonadiModel::types(model->collectionById(id)) & CalEvent::ACTIVE))
-            continue;
-        const KAEvent::List& events = rit.value();
-        for (int i = 0, end = events.count();  i < end;  ++i)
-        {
-            KAEvent* event = events[i];
-            if (event->category() == CalEvent::ACTIVE  &&  event->repeatAtLogin())
-                atlogins += event;
-        }
+        KAEvent* event = *it;
+        const Collection::Id id = event->collectionId();
+        if (id >= 0
+        &&  (AkonadiModel::types(model->collectionById(id)) & CalEvent::ACTIVE))
+            atlogins += event;
     }
     return atlogins;
 }
 
 /******************************************************************************
-* Find and note the active alarm with the earliest trigger time for a calendar.
+* Return all active at-login alarms, regardless of their collections' alarm
+* types.
+*/
+KAEvent::List AlarmCalendar::atLoginEvents() const
+{
+    KAEvent::List atlogins;
+    for (QSet<KAEvent*>::ConstIterator it = mAtLoginEvents.constBegin();  it != mAtLoginEvents.constEnd();  ++it)
+        atlogins += *it;
+    return atlogins;
+}
+
+/******************************************************************************
+* Update the trigger time index for all active alarms in a calendar.
 */
 void AlarmCalendar::findEarliestAlarm(const Collection& collection)
 {
@@ -1488,38 +1832,112 @@ void AlarmCalendar::findEarliestAlarm(const Collection& collection)
     if (!collection.isValid()
     ||  !(AkonadiModel::types(collection) & CalEvent::ACTIVE))
         return;
-    findEarliestAlarm(collection.id());
-}
-
-void AlarmCalendar::findEarliestAlarm(Collection::Id key)
-{
-    EarliestMap::Iterator eit = mEarliestAlarm.find(key);
-    if (eit != mEarliestAlarm.end())
-        eit.value() = nullptr;
-    if (mCalType != RESOURCES
-    ||  key < 0)
-        return;
-    ResourceMap::ConstIterator rit = mResourceMap.constFind(key);
+    ResourceMap::ConstIterator rit = mResourceMap.constFind(collection.id());
     if (rit == mResourceMap.constEnd())
         return;
-    const KAEvent::List& events = rit.value();
-    KAEvent* earliest = nullptr;
-    KDateTime earliestTime;
+    bool changed = false;
+    const KAEvent::List& events = rit.value().lists[ACTIVE_LIST];
     for (int i = 0, end = events.count();  i < end;  ++i)
     {
         KAEvent* event = events[i];
-        if (event->category() != CalEvent::ACTIVE
-        ||  mPendingAlarms.contains(event->id()))
-            continue;
-        KDateTime dt = event->nextTrigger(KAEvent::ALL_TRIGGER).effectiveKDateTime();
-        if (dt.isValid()  &&  (!earliest || dt < earliestTime))
-        {
-            earliestTime = dt;
-            earliest = event;
-        }
+        KDateTime dt;
+        if (!mPendingAlarms.contains(event->id()))
+            dt = nextTrigger(*event, KAEvent::ALL_TRIGGER).effectiveKDateTime();
+        if (mEarliestAlarms.update(event, dt))
+            changed = true;
+        updateUpcomingAlarm(event);
+    }
+    if (changed)
+        Q_EMIT earliestAlarmChanged();
+}
+
+/******************************************************************************
+* Update the trigger time index for all active alarms in all calendars.
+* Called when something has changed which may alter every alarm's next
+* trigger time, e.g. the time zone or start-of-day time.
+*/
+void AlarmCalendar::findEarliestAlarms()
+{
+    if (mCalType != RESOURCES)
+        return;
+    AkonadiModel* model = AkonadiModel::instance();
+    for (ResourceMap::ConstIterator rit = mResourceMap.constBegin();  rit != mResourceMap.constEnd();  ++rit)
+    {
+        if (rit.key() >= 0)
+            findEarliestAlarm(model->collectionById(rit.key()));
     }
-    mEarliestAlarm[key] = earliest;
-    Q_EMIT earliestAlarmChanged();
+}
+
+/******************************************************************************
+* Called when a preference has changed which can alter the next trigger time of
+* any alarm. Discard all cached trigger times, and rebuild the trigger time
+* index.
+*/
+void AlarmCalendar::slotTriggerTimesChanged()
+{
+    mTriggerCache.clear();
+    findEarliestAlarms();
+    snapshotChanged();
+}
+
+/******************************************************************************
+* Return the next trigger time of an event, using a cached value if possible.
+* If the event is held by this calendar, the trigger time of the calendar's
+* instance is returned; so 'event' must not have been changed from it.
+* Only ALL_TRIGGER and DISPLAY_TRIGGER values are cached.
+*/
+DateTime AlarmCalendar::nextTrigger(const KAEvent& event, KAEvent::TriggerType type) const
+{
+    if (type != KAEvent::ALL_TRIGGER  &&  type != KAEvent::DISPLAY_TRIGGER)
+        return event.nextTrigger(type);
+    const EventId id(event);
+    KAEventMap::ConstIterator it = mEventMap.constFind(id);
+    if (it == mEventMap.constEnd())
+        return event.nextTrigger(type);   // not held by this calendar, so don't cache it
+
+    TriggerCache& cache = mTriggerCache[id];
+    bool& valid = (type == KAEvent::ALL_TRIGGER) ? cache.allValid : cache.displayValid;
+    DateTime& dt = (type == KAEvent::ALL_TRIGGER) ? cache.all : cache.display;
+    if (valid)
+    {
+        ++mTriggerCacheHits;
+        return dt;
+    }
+    ++mTriggerCacheMisses;
+    dt = it.value()->nextTrigger(type);
+    valid = true;
+    return dt;
+}
+
+/******************************************************************************
+* Update the position of an active alarm in the trigger time index, following
+* a change to the alarm or to its pending status.
+* The alarm must be held by this calendar, in a collection containing active
+* alarms.
+*/
+void AlarmCalendar::updateEarliestAlarm(KAEvent* event)
+{
+    mTriggerCache.remove(EventId(*event));
+    KDateTime dt;
+    if (!mPendingAlarms.contains(event->id()))
+        dt = nextTrigger(*event, KAEvent::ALL_TRIGGER).effectiveKDateTime();
+    if (mEarliestAlarms.update(event, dt))
+        Q_EMIT earliestAlarmChanged();
+}
+
+/******************************************************************************
+* Update the position of an alarm in the upcoming alarm index. Only enabled,
+* unexpired active alarms in Akonadi collections are held in the index,
+* including any which are pending.
+*/
+void AlarmCalendar::updateUpcomingAlarm(KAEvent* event)
+{
+    if (mCalType != RESOURCES  ||  event->collectionId() < 0)
+        return;
+    KDateTime dt;
+    if (event->category() == CalEvent::ACTIVE  &&  event->enabled()  &&  !event->expired())
+        dt = nextTrigger(*event, KAEvent::DISPLAY_TRIGGER).effectiveKDateTime();
+    mUpcomingAlarms.update(event, dt);
 }
 
 /******************************************************************************
@@ -1528,21 +1946,16 @@ void AlarmCalendar::findEarliestAlarm(Collection::Id key)
 */
 KAEvent* AlarmCalendar::earliestAlarm() const
 {
-    KAEvent* earliest = nullptr;
-    KDateTime earliestTime;
-    for (EarliestMap::ConstIterator eit = mEarliestAlarm.constBegin();  eit != mEarliestAlarm.constEnd();  ++eit)
-    {
-        KAEvent* event = eit.value();
-        if (!event)
-            continue;
-        KDateTime dt = event->nextTrigger(KAEvent::ALL_TRIGGER).effectiveKDateTime();
-        if (dt.isValid()  &&  (!earliest || dt < earliestTime))
-        {
-            earliestTime = dt;
-            earliest = event;
-        }
-    }
-    return earliest;
+    return mEarliestAlarms.top();
+}
+
+/******************************************************************************
+* Return all active alarms whose next trigger time is at or before 'dt'.
+* Alarms which are pending are excluded.
+*/
+KAEvent::List AlarmCalendar::dueAlarms(const KDateTime& dt) const
+{
+    return mEarliestAlarms.due(dt);
 }
 
 /******************************************************************************
@@ -1558,16 +1971,464 @@ void AlarmCalendar::setAlarmPending(KAEvent* event, bool pending)
     {
         if (wasPending)
             return;
-        mPendingAlarms.append(id);
+        mPendingAlarms.insert(id);
     }
     else
     {
         if (!wasPending)
             return;
-        mPendingAlarms.removeAll(id);
+        mPendingAlarms.remove(id);
+    }
+    // Now update the earliest alarm to trigger for its calendar.
+    // 'event' may be a copy, so update the instance held by the calendar.
+    const Collection collection = AkonadiModel::instance()->collection(*event);
+    if (mCalType != RESOURCES
+    ||  !collection.isValid()
+    ||  !(AkonadiModel::types(collection) & CalEvent::ACTIVE))
+        return;
+    KAEvent* stored = mEventMap.value(EventId(collection.id(), id), nullptr);
+    if (stored  &&  stored->category() == CalEvent::ACTIVE)
+        updateEarliestAlarm(stored);
+}
+
+/******************************************************************************
+* Return an active alarm which has been loaded from the snapshot, and which has
+* not yet been received from Akonadi.
+* Reply = 0 if not found.
+*/
+KAEvent* AlarmCalendar::snapshotEvent(const EventId& id) const
+{
+    return mSnapshotEvents.value(id, nullptr);
+}
+
+/******************************************************************************
+* Note that an alarm loaded from the snapshot has been processed, and remove it
+* from the trigger time index. If it was executed, the trigger time is noted
+* so that it will not be executed again once Akonadi provides the event.
+*/
+void AlarmCalendar::setSnapshotEventHandled(const EventId& id, const KDateTime& executed)
+{
+    if (executed.isValid())
+        mSnapshotExecuted[id] = TriggerHeap::triggerKey(executed);
+    if (removeSnapshotEvent(id))
+        Q_EMIT earliestAlarmChanged();
+}
+
+/******************************************************************************
+* Check whether an alarm due at a specified time has already been executed from
+* the snapshot. The record of its execution is then discarded.
+*/
+bool AlarmCalendar::snapshotAlarmExecuted(const EventId& id, const KDateTime& trigger)
+{
+    QHash<EventId, qint64>::Iterator it = mSnapshotExecuted.find(id);
+    if (it == mSnapshotExecuted.end())
+        return false;
+    const bool executed = (TriggerHeap::triggerKey(trigger) <= it.value());
+    mSnapshotExecuted.erase(it);
+    return executed;
+}
+
+/******************************************************************************
+* Remove an alarm loaded from the snapshot.
+* Reply = true if the alarm was found.
+*/
+bool AlarmCalendar::removeSnapshotEvent(const EventId& id)
+{
+    KAEvent* event = mSnapshotEvents.take(id);
+    if (!event)
+        return false;
+    // Only remove the index entry if it refers to the snapshot's instance,
+    // not to an instance received from Akonadi.
+    if (!mEventMap.contains(id))
+        mEarliestAlarms.remove(id);
+    delete event;
+    return true;
+}
+
+/******************************************************************************
+* Remove all alarms loaded from the snapshot for a collection. This is done once
+* Akonadi has provided all the collection's events, or the collection has been
+* removed or disabled. Records of executed alarms are also discarded, except
+* for alarms which are still due and have yet to be handled.
+* Reply = true if any alarms were removed.
+*/
+bool AlarmCalendar::removeSnapshotEvents(Collection::Id collectionId)
+{
+    for (QHash<EventId, qint64>::Iterator it = mSnapshotExecuted.begin();  it != mSnapshotExecuted.end();  )
+    {
+        if (it.key().collectionId() == collectionId)
+        {
+            const KAEvent* event = mEventMap.value(it.key(), nullptr);
+            const KDateTime next = event ? nextTrigger(*event, KAEvent::ALL_TRIGGER).effectiveKDateTime() : KDateTime();
+            if (!next.isValid()  ||  TriggerHeap::triggerKey(next) > it.value())
+            {
+                // The event has gone, or it has been rescheduled past the
+                // executed trigger time.
+                it = mSnapshotExecuted.erase(it);
+                continue;
+            }
+        }
+        ++it;
+    }
+    QList<EventId> ids;
+    for (QHash<EventId, KAEvent*>::ConstIterator it = mSnapshotEvents.constBegin();  it != mSnapshotEvents.constEnd();  ++it)
+    {
+        if (it.key().collectionId() == collectionId)
+            ids += it.key();
+    }
+    for (int i = 0, end = ids.count();  i < end;  ++i)
+        removeSnapshotEvent(ids[i]);
+    return !ids.isEmpty();
+}
+
+/******************************************************************************
+* Called when a collection has been populated by Akonadi.
+* Any alarms in the snapshot which Akonadi has not provided must have been
+* deleted, so remove them.
+*/
+void AlarmCalendar::slotCollectionPopulated(Collection::Id collectionId)
+{
+    if (removeSnapshotEvents(collectionId))
+    {
+        Q_EMIT earliestAlarmChanged();
+        snapshotChanged();
+    }
+}
+
+/******************************************************************************
+* Called when the collection tree has been fetched from Akonadi.
+* Remove any alarms in the snapshot whose collections no longer exist, or are
+* no longer enabled for active alarms.
+*/
+void AlarmCalendar::slotCollectionTreeFetched()
+{
+    QSet<Collection::Id> collectionIds;
+    for (QHash<EventId, KAEvent*>::ConstIterator it = mSnapshotEvents.constBegin();  it != mSnapshotEvents.constEnd();  ++it)
+        collectionIds += it.key().collectionId();
+    for (QHash<EventId, qint64>::ConstIterator it = mSnapshotExecuted.constBegin();  it != mSnapshotExecuted.constEnd();  ++it)
+        collectionIds += it.key().collectionId();
+    AkonadiModel* model = AkonadiModel::instance();
+    bool removed = false;
+    for (QSet<Collection::Id>::ConstIterator it = collectionIds.constBegin();  it != collectionIds.constEnd();  ++it)
+    {
+        if (!CollectionControlModel::isEnabled(model->collectionById(*it), CalEvent::ACTIVE))
+        {
+            if (removeSnapshotEvents(*it))
+                removed = true;
+        }
+    }
+    if (removed)
+    {
+        Q_EMIT earliestAlarmChanged();
+        snapshotChanged();
+    }
+}
+
+/******************************************************************************
+* Return the path of the active alarm snapshot file.
+*/
+static QString snapshotPath()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::DataLocation) + QLatin1Char('/') + snapshotName;
+}
+
+/******************************************************************************
+* Load the snapshot of active alarms, and index them by trigger time so that
+* they can be scheduled before Akonadi provides the calendar contents.
+* The snapshot file contains an index of the alarms (collection ID, event ID
+* and next trigger time), followed by the alarms in iCalendar format.
+*/
+void AlarmCalendar::loadSnapshot()
+{
+    QFile file(snapshotPath());
+    if (!file.open(QIODevice::ReadOnly))
+        return;
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_5_6);
+    quint32 magic, version;
+    in >> magic >> version;
+    if (in.status() != QDataStream::Ok  ||  magic != SNAPSHOT_MAGIC  ||  version != SNAPSHOT_VERSION)
+    {
+        qCWarning(KALARM_LOG) << "Ignoring invalid alarm snapshot";
+        return;
+    }
+    qint32 count;
+    in >> count;
+    QVector<qint64>  collectionIds;
+    QStringList      eventIds;
+    QVector<qint64>  triggers;
+    for (int i = 0;  i < count  &&  in.status() == QDataStream::Ok;  ++i)
+    {
+        qint64 collectionId, trigger;
+        QString eventId;
+        in >> collectionId >> eventId >> trigger;
+        collectionIds += collectionId;
+        eventIds      += eventId;
+        triggers      += trigger;
+    }
+    QByteArray icalData;
+    in >> icalData;
+    if (in.status() != QDataStream::Ok)
+    {
+        qCWarning(KALARM_LOG) << "Error reading alarm snapshot";
+        return;
+    }
+    MemoryCalendar::Ptr calendar(new MemoryCalendar(Preferences::timeZone(true)));
+    if (!ICalFormat().fromString(calendar, QString::fromUtf8(icalData)))
+    {
+        qCWarning(KALARM_LOG) << "Error parsing alarm snapshot";
+        return;
+    }
+    // Only arm alarms in collections which are still in KAlarm's list. The
+    // collections' enabled status is checked again once Akonadi has provided
+    // the collection tree.
+    const QList<Collection::Id> enabledIds = CollectionControlModel::collectionIds();
+    for (int i = 0;  i < count;  ++i)
+    {
+        if (!enabledIds.contains(collectionIds[i]))
+            continue;
+        const Event::Ptr kcalEvent = calendar->event(eventIds[i]);
+        if (!kcalEvent)
+            continue;
+        const EventId id(collectionIds[i], eventIds[i]);
+        if (mSnapshotEvents.contains(id))
+            continue;
+        KAEvent* event = new KAEvent(kcalEvent);
+        if (!event->isValid()  ||  event->category() != CalEvent::ACTIVE)
+        {
+            delete event;
+            continue;
+        }
+        event->setCollectionId(id.collectionId());
+        mSnapshotEvents[id] = event;
+        mEarliestAlarms.update(event, KDateTime(QDateTime::fromMSecsSinceEpoch(triggers[i], Qt::UTC), KDateTime::UTC));
+    }
+    calendar->close();
+    qCDebug(KALARM_LOG) << mSnapshotEvents.count() << "alarms loaded from snapshot";
+}
+
+/******************************************************************************
+* Note that the set of active alarms has changed, and schedule writing the
+* snapshot.
+*/
+void AlarmCalendar::snapshotChanged()
+{
+    if (mSnapshotTimer  &&  !mSnapshotTimer->isActive())
+        mSnapshotTimer->start();
+}
+
+/******************************************************************************
+* Write the snapshot of enabled active alarms, including any loaded from the
+* previous snapshot which Akonadi has not yet provided.
+*/
+void AlarmCalendar::writeSnapshot()
+{
+    mSnapshotTimer->stop();
+    QVector<const KAEvent*> events;
+    QVector<qint64> triggers;
+    AkonadiModel* model = AkonadiModel::instance();
+    for (ResourceMap::ConstIterator rit = mResourceMap.constBegin();  rit != mResourceMap.constEnd();  ++rit)
+    {
+        if (rit.key() < 0
+        ||  !(AkonadiModel::types(model->collectionById(rit.key())) & CalEvent::ACTIVE))
+            continue;
+        const KAEvent::List& colEvents = rit.value().lists[ACTIVE_LIST];
+        for (int i = 0, end = colEvents.count();  i < end;  ++i)
+        {
+            const KAEvent* event = colEvents[i];
+            if (!event->enabled())
+                continue;
+            const KDateTime dt = nextTrigger(*event, KAEvent::ALL_TRIGGER).effectiveKDateTime();
+            if (dt.isValid())
+            {
+                events += event;
+                triggers += TriggerHeap::triggerKey(dt);
+            }
+        }
+    }
+    for (QHash<EventId, KAEvent*>::ConstIterator it = mSnapshotEvents.constBegin();  it != mSnapshotEvents.constEnd();  ++it)
+    {
+        const KDateTime dt = it.value()->nextTrigger(KAEvent::ALL_TRIGGER).effectiveKDateTime();
+        if (dt.isValid())
+        {
+            events += it.value();
+            triggers += TriggerHeap::triggerKey(dt);
+        }
+    }
+
+    // Convert the alarms to iCalendar format. If the same event ID occurs in
+    // more than one collection, only the first is stored.
+    MemoryCalendar::Ptr calendar(new MemoryCalendar(Preferences::timeZone(true)));
+    KACalendar::setKAlarmVersion(calendar);
+    for (int i = 0, end = events.count();  i < end;  ++i)
+    {
+        if (calendar->event(events[i]->id()))
+            continue;
+        Event::Ptr kcalEvent(new Event);
+        events[i]->updateKCalEvent(kcalEvent, KAEvent::UID_SET);
+        calendar->addEvent(kcalEvent);
+    }
+
+    QSaveFile file(snapshotPath());
+    if (!file.open(QIODevice::WriteOnly))
+    {
+        qCWarning(KALARM_LOG) << "Cannot open alarm snapshot" << file.fileName();
+        return;
+    }
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_5_6);
+    out << SNAPSHOT_MAGIC << SNAPSHOT_VERSION << static_cast<qint32>(events.count());
+    for (int i = 0, end = events.count();  i < end;  ++i)
+        out << static_cast<qint64>(events[i]->collectionId()) << events[i]->id() << triggers[i];
+    out << ICalFormat().toString(calendar).toUtf8();
+    calendar->close();
+    if (!file.commit())
+        qCWarning(KALARM_LOG) << "Error writing alarm snapshot" << file.fileName();
+}
+
+/******************************************************************************
+* Return the stub for an archived event, or null if none.
+*/
+AlarmCalendar::ArchivedStub* AlarmCalendar::archivedStub(const EventId& id) const
+{
+    QMap<Collection::Id, ArchivedStubMap>::Iterator ait = mArchivedStubs.find(id.collectionId());
+    if (ait == mArchivedStubs.end())
+        return nullptr;
+    ArchivedStubMap::Iterator it = ait.value().find(id.eventId());
+    if (it == ait.value().end())
+        return nullptr;
+    return &it.value();
+}
+
+/******************************************************************************
+* Return the event for an archived event stub, constructing it from AkonadiModel
+* if it is not already held.
+* If the number of archived events held exceeds the configured limit, the least
+* recently used ones are discarded once control returns to the event loop, so
+* that the pointer returned remains valid until then.
+*/
+KAEvent* AlarmCalendar::archivedEvent(ArchivedStub& stub, Collection::Id collectionId) const
+{
+    if (!stub.event)
+    {
+        const KAEvent event = AkonadiModel::instance()->event(stub.itemId);
+        if (!event.isValid())
+            return nullptr;
+        stub.event = new KAEvent(event);
+        stub.event->setCollectionId(collectionId);
+    }
+    return stub.event;
+}
+
+/******************************************************************************
+* Append all archived events in a collection to a list, constructing them as
+* necessary.
+*/
+void AlarmCalendar::archivedEvents(Collection::Id collectionId, KAEvent::List& list) const
+{
+    QMap<Collection::Id, ArchivedStubMap>::Iterator ait = mArchivedStubs.find(collectionId);
+    if (ait == mArchivedStubs.end())
+        return;
+    ArchivedStubMap& stubs = ait.value();
+    list.reserve(list.count() + stubs.count());
+    for (ArchivedStubMap::Iterator it = stubs.begin();  it != stubs.end();  ++it)
+    {
+        KAEvent* event = archivedEvent(it.value(), collectionId);
+        if (event)
+            list += event;
+    }
+}
+
+/******************************************************************************
+* Record an archived event which has been added or changed in AkonadiModel.
+* If the event is currently held, it is updated.
+*/
+void AlarmCalendar::setArchivedStub(Collection::Id collectionId, const KAEvent& event)
+{
+    ArchivedStubMap& stubs = mArchivedStubs[collectionId];
+    const bool exists = stubs.contains(event.id());
+    ArchivedStub& stub = stubs[event.id()];
+    const KDateTime created = event.createdDateTime();
+    if (!exists  ||  created.date() != stub.created.date())
+    {
+        // Update the creation date index
+        ArchivedDateMap& dates = mArchivedDates[collectionId];
+        if (exists)
+            dates.remove(stub.created.date(), event.id());
+        dates.insert(created.date(), event.id());
+    }
+    if (!exists)
+        addUidIndex(EventId(collectionId, event.id()));
+    stub.itemId  = event.itemId();
+    stub.created = created;
+    if (stub.event)
+    {
+        *stub.event = event;
+        stub.event->setCollectionId(collectionId);
     }
-    // Now update the earliest alarm to trigger for its calendar
-    findEarliestAlarm(AkonadiModel::instance()->collection(*event));
+}
+
+/******************************************************************************
+* Remove an archived event stub, and delete its event if it is held.
+* Reply = true if the stub existed.
+*/
+bool AlarmCalendar::removeArchivedStub(const EventId& id)
+{
+    QMap<Collection::Id, ArchivedStubMap>::Iterator ait = mArchivedStubs.find(id.collectionId());
+    if (ait == mArchivedStubs.end())
+        return false;
+    ArchivedStubMap::Iterator it = ait.value().find(id.eventId());
+    if (it == ait.value().end())
+        return false;
+    mPurgePending.remove(it.value().itemId);
+    delete it.value().event;
+    QMap<Collection::Id, ArchivedDateMap>::Iterator dit = mArchivedDates.find(id.collectionId());
+    if (dit != mArchivedDates.end())
+    {
+        dit.value().remove(it.value().created.date(), id.eventId());
+        if (dit.value().isEmpty())
+            mArchivedDates.erase(dit);
+    }
+    ait.value().erase(it);
+    if (ait.value().isEmpty())
+        mArchivedStubs.erase(ait);
+    removeUidIndex(id);
+    return true;
+}
+
+/******************************************************************************
+* Remove all archived event stubs for a collection.
+*/
+void AlarmCalendar::removeArchivedStubs(Collection::Id collectionId)
+{
+    QMap<Collection::Id, ArchivedStubMap>::Iterator ait = mArchivedStubs.find(collectionId);
+    if (ait == mArchivedStubs.end())
+        return;
+    const ArchivedStubMap& stubs = ait.value();
+    for (ArchivedStubMap::ConstIterator it = stubs.constBegin();  it != stubs.constEnd();  ++it)
+    {
+        removeUidIndex(EventId(collectionId, it.key()));
+        mPurgePending.remove(it.value().itemId);
+        delete it.value().event;
+    }
+    mArchivedStubs.erase(ait);
+    mArchivedDates.remove(collectionId);
+    mPurgeQueues.remove(collectionId);
+}
+
+/******************************************************************************
+* Record that an event ID is held in mEventMap or mArchivedStubs, so that events
+* can be found by UID alone.
+*/
+void AlarmCalendar::addUidIndex(const EventId& id)
+{
+    if (!mUidIndex.contains(id.eventId(), id.collectionId()))
+        mUidIndex.insert(id.eventId(), id.collectionId());
+}
+
+void AlarmCalendar::removeUidIndex(const EventId& id)
+{
+    mUidIndex.remove(id.eventId(), id.collectionId());
 }
 
 /******************************************************************************
@@ -1579,7 +2440,11 @@ void AlarmCalendar::adjustStartOfDay()
     if (!isValid())
         return;
     for (ResourceMap::ConstIterator rit = mResourceMap.constBegin();  rit != mResourceMap.constEnd();  ++rit)
-        KAEvent::adjustStartOfDay(rit.value());
+    {
+        for (int l = 0;  l < LIST_COUNT;  ++l)
+            KAEvent::adjustStartOfDay(rit.value().lists[l]);
+    }
+    slotTriggerTimesChanged();
 }
 
 /******************************************************************************
@@ -23,6 +23,8 @@
 
 #include "akonadimodel.h"
 #include "eventid.h"
+#include "triggerheap.h"
+#include "triggerindex.h"
 
 #include <kalarmcal/kaevent.h>
 
@@ -32,7 +34,9 @@
 
 #include <QHash>
 #include <QObject>
+#include <QSet>
 #include <QUrl>
+class QTimer;
 
 
 using namespace KAlarmCal;
@@ -53,14 +57,24 @@ class AlarmCalendar : public QObject
         int                   load();
         bool                  reload();
         bool                  save();
+        bool                  flush();
         void                  close();
         void                  startUpdate();
         bool                  endUpdate();
         KAEvent*              earliestAlarm() const;
+        KAEvent::List         dueAlarms(const KDateTime& dt) const;
+        KAEvent::List         upcomingAlarms(const KDateTime& start = KDateTime(), const KDateTime& end = KDateTime(), int maxCount = -1) const
+                                                    { return mUpcomingAlarms.events(start, end, maxCount); }
+        DateTime              nextTrigger(const KAEvent&, KAEvent::TriggerType) const;
+        quint64               triggerCacheHits() const     { return mTriggerCacheHits; }
+        quint64               triggerCacheMisses() const   { return mTriggerCacheMisses; }
         void                  setAlarmPending(KAEvent*, bool pending = true);
         bool                  haveDisabledAlarms() const   { return mHaveDisabledAlarms; }
         void                  disabledChanged(const KAEvent*);
         KAEvent::List         atLoginAlarms() const;
+        KAEvent*              snapshotEvent(const EventId&) const;
+        void                  setSnapshotEventHandled(const EventId&, const KDateTime& executed = KDateTime());
+        bool                  snapshotAlarmExecuted(const EventId&, const KDateTime& trigger);
         KCalCore::Event::Ptr  kcalEvent(const QString& uniqueID);   // if Akonadi, display calendar only
         KAEvent*              event(const EventId& uniqueId, bool checkDuplicates = false);
         KAEvent*              templateEvent(const QString& templateName);
@@ -76,7 +90,8 @@ class AlarmCalendar : public QObject
         KAEvent*              updateEvent(const KAEvent*);
         bool                  deleteEvent(const KAEvent&, bool save = false);
         bool                  deleteDisplayEvent(const QString& eventID, bool save = false);
-        void                  purgeEvents(const KAEvent::List&);
+        bool                  purgeArchivedEvents(Akonadi::Collection::Id, const QDate& cutoff, int maxCount);
+        bool                  isPurging() const      { return !mPurgeChunk.isEmpty(); }
         bool                  isOpen();
         QString               path() const           { return (mCalType == RESOURCES) ? QString() : mUrl.toDisplayString(); }
         QString               urlString() const      { return (mCalType == RESOURCES) ? QString() : mUrl.toString(); }
@@ -96,6 +111,22 @@ class AlarmCalendar : public QObject
         void                  haveDisabledAlarmsChanged(bool haveDisabled);
         void                  atLoginEventAdded(const KAEvent&);
         void                  calendarSaved(AlarmCalendar*);
+        /** Emitted when a deferred write of the calendar file fails. */
+        void                  deferredSaveFailed(AlarmCalendar*);
+        /** Emitted when all deletions started by purgeArchivedEvents() have completed. */
+        void                  purgeChunkDone();
+
+    protected:
+        // Interface for benchmark programs, which feed events to a resources
+        // calendar directly, without AkonadiModel or the active alarm snapshot.
+        enum Detached { DETACHED };
+        explicit AlarmCalendar(Detached);
+        void                  addEvents(const AkonadiModel::EventList& events)    { slotEventsAdded(events); }
+        void                  changeEvent(const AkonadiModel::Event& event)       { slotEventChanged(event); }
+        void                  removeEvents(const AkonadiModel::EventList& events) { slotEventsToBeRemoved(events); }
+        void                  removeCollectionEvents(Akonadi::Collection::Id id)  { removeKAEvents(id); }
+        void                  rebuildTriggerIndex(const Akonadi::Collection& c)   { findEarliestAlarm(c); }
+        KAEvent::List         atLoginEvents() const;
 
     private Q_SLOTS:
         void                  setAskResource(bool ask);
@@ -104,15 +135,62 @@ class AlarmCalendar : public QObject
         void                  slotEventsAdded(const AkonadiModel::EventList&);
         void                  slotEventsToBeRemoved(const AkonadiModel::EventList&);
         void                  slotEventChanged(const AkonadiModel::Event&);
+        void                  findEarliestAlarms();
+        void                  slotTriggerTimesChanged();
+        void                  slotSaveTimer();
+        void                  slotCollectionPopulated(Akonadi::Collection::Id);
+        void                  slotCollectionTreeFetched();
+        void                  slotItemDone(Akonadi::Item::Id, bool status);
+        void                  writeSnapshot();
     private:
         enum CalType { RESOURCES, LOCAL_ICAL, LOCAL_VCAL };
-        typedef QMap<Akonadi::Collection::Id, KAEvent::List> ResourceMap;  // id = invalid for display calendar
-        typedef QMap<Akonadi::Collection::Id, KAEvent*> EarliestMap;
+        // Indexes of the per-category event lists in CollectionEvents
+        enum { ACTIVE_LIST, ARCHIVED_LIST, TEMPLATE_LIST, DISPLAYING_LIST, OTHER_LIST, LIST_COUNT };
+        struct CollectionEvents   // a collection's events, in a separate list for each category
+        {
+            KAEvent::List lists[LIST_COUNT];
+            bool isEmpty() const;
+        };
+        typedef QMap<Akonadi::Collection::Id, CollectionEvents> ResourceMap;  // id = invalid for display calendar
+        struct EventSlot          // position of an event in mResourceMap
+        {
+            EventSlot() : list(OTHER_LIST), index(-1), disabled(false), atLogin(false) {}
+            int   list;           // index of the category list containing the event
+            int   index;          // index of the event within its category list
+            bool  disabled;       // the event is counted in mDisabledCount
+            bool  atLogin;        // the event is in mAtLoginEvents
+        };
         typedef QHash<EventId, KAEvent*> KAEventMap;  // indexed by collection and event UID
+        struct TriggerCache
+        {
+            TriggerCache() : allValid(false), displayValid(false) {}
+            DateTime  all;            // cached nextTrigger(ALL_TRIGGER)
+            DateTime  display;        // cached nextTrigger(DISPLAY_TRIGGER)
+            bool      allValid;
+            bool      displayValid;
+        };
+        typedef QHash<EventId, TriggerCache> TriggerCacheMap;
+        struct ArchivedStub       // archived event, constructed only when it is accessed
+        {
+            ArchivedStub() : itemId(-1), event(nullptr) {}
+            Akonadi::Item::Id itemId;
+            KDateTime         created;    // creation time of the event
+            KAEvent*          event;      // the event, or null if not constructed
+        };
+        typedef QHash<QString, ArchivedStub> ArchivedStubMap;   // indexed by event UID
+        typedef QMultiMap<QDate, QString> ArchivedDateMap;      // event UIDs indexed by creation date
+        struct PurgeQueue         // archived events remaining to be purged from a collection
+        {
+            PurgeQueue() : next(0) {}
+            QDate                    cutoff;    // cutoff date of the purge
+            QList<Akonadi::Item::Id> itemIds;   // item IDs of the events to purge, oldest first
+            int                      next;      // index in itemIds of the next event to purge
+        };
 
         AlarmCalendar();
         AlarmCalendar(const QString& file, CalEvent::Type);
         bool                  saveCal(const QString& newFile = QString());
+        void                  saveFailed(const QString& newFile, const QString& errmsg);
         bool                  isValid() const   { return mCalType == RESOURCES || mCalendarStorage; }
         void                  addNewEvent(const Akonadi::Collection&, KAEvent*, bool replace = false);
         CalEvent::Type        deleteEventInternal(const KAEvent&, bool deleteFromAkonadi = true);
@@ -121,11 +199,29 @@ class AlarmCalendar : public QObject
         CalEvent::Type        deleteEventInternal(const QString& eventID, const KAEvent& = KAEvent(),
                                                    const Akonadi::Collection& = Akonadi::Collection(), bool deleteFromAkonadi = true);
         void                  updateDisplayKAEvents();
+        static int            listIndex(CalEvent::Type);
+        static void           appendEvents(const CollectionEvents&, CalEvent::Types, KAEvent::List&);
+        void                  insertEvent(Akonadi::Collection::Id, KAEvent*);
+        void                  removeEvent(Akonadi::Collection::Id, KAEvent*);
+        void                  updateEventState(KAEvent*);
         void                  removeKAEvents(Akonadi::Collection::Id, bool closing = false, CalEvent::Types = CalEvent::ACTIVE | CalEvent::ARCHIVED | CalEvent::TEMPLATE);
         void                  findEarliestAlarm(const Akonadi::Collection&);
-        void                  findEarliestAlarm(Akonadi::Collection::Id);  //deprecated
+        void                  updateEarliestAlarm(KAEvent*);
+        void                  updateUpcomingAlarm(KAEvent*);
         void                  checkForDisabledAlarms();
         void                  checkForDisabledAlarms(bool oldEnabled, bool newEnabled);
+        void                  loadSnapshot();
+        void                  snapshotChanged();
+        bool                  removeSnapshotEvent(const EventId&);
+        bool                  removeSnapshotEvents(Akonadi::Collection::Id);
+        ArchivedStub*         archivedStub(const EventId&) const;
+        KAEvent*              archivedEvent(ArchivedStub&, Akonadi::Collection::Id) const;
+        void                  archivedEvents(Akonadi::Collection::Id, KAEvent::List&) const;
+        void                  setArchivedStub(Akonadi::Collection::Id, const KAEvent&);
+        bool                  removeArchivedStub(const EventId&);
+        void                  removeArchivedStubs(Akonadi::Collection::Id);
+        void                  addUidIndex(const EventId&);
+        void                  removeUidIndex(const EventId&);
 
         static AlarmCalendar* mResourcesCalendar;  // the calendar resources
         static AlarmCalendar* mDisplayCalendar;    // the display calendar
@@ -133,8 +229,24 @@ class AlarmCalendar : public QObject
         KCalCore::FileStorage::Ptr mCalendarStorage; // null pointer for Akonadi
         ResourceMap           mResourceMap;
         KAEventMap            mEventMap;           // lookup of all events by UID
-        EarliestMap           mEarliestAlarm;      // alarm with earliest trigger time, by resource
-        QList<QString>        mPendingAlarms;      // IDs of alarms which are currently being processed after triggering
+        QHash<const KAEvent*, EventSlot> mEventSlots;  // position and state of each event in mResourceMap
+        QSet<KAEvent*>        mAtLoginEvents;      // active at-login alarms
+        int                   mDisabledCount;      // number of individually disabled active alarms
+        QMultiHash<QString, Akonadi::Collection::Id> mUidIndex;  // collections containing each event UID in mEventMap or mArchivedStubs
+        TriggerHeap           mEarliestAlarms;     // active alarms indexed by next trigger time
+        TriggerIndex          mUpcomingAlarms;     // enabled, unexpired active alarms ordered by next display trigger time
+        QSet<QString>         mPendingAlarms;      // IDs of alarms which are currently being processed after triggering
+        mutable TriggerCacheMap mTriggerCache;     // next trigger times of events in mEventMap
+        mutable quint64       mTriggerCacheHits;   // number of nextTrigger() calls answered from mTriggerCache
+        mutable quint64       mTriggerCacheMisses; // number of nextTrigger() calls which were evaluated
+        QHash<EventId, KAEvent*> mSnapshotEvents;  // active alarms loaded from the snapshot, not yet received from Akonadi
+        QHash<EventId, qint64> mSnapshotExecuted;  // trigger times of alarms executed from the snapshot
+        QTimer*               mSnapshotTimer;      // timer to write the active alarm snapshot
+        mutable QMap<Akonadi::Collection::Id, ArchivedStubMap> mArchivedStubs;  // archived events, not held in mResourceMap
+        QMap<Akonadi::Collection::Id, ArchivedDateMap> mArchivedDates;  // archived event UIDs by creation date
+        QSet<Akonadi::Item::Id> mPurgePending;  // item IDs of archived events being deleted by purgeArchivedEvents()
+        QSet<Akonadi::Item::Id> mPurgeChunk;    // item IDs of purged events whose deletion has not yet completed
+        QMap<Akonadi::Collection::Id, PurgeQueue> mPurgeQueues;  // purges in progress, for each collection
         QUrl                  mUrl;                // URL of current calendar file
         QUrl                  mICalUrl;            // URL of iCalendar file
         QString               mLocalFile;          // calendar file, or local copy if it's a remote file
@@ -142,7 +254,10 @@ class AlarmCalendar : public QObject
         CalEvent::Type        mEventType;         // what type of events the calendar file is for
         bool                  mOpen;               // true if the calendar file is open
         int                   mUpdateCount;        // nesting level of group of calendar update calls
-        bool                  mUpdateSave;         // save() was called while mUpdateCount > 0
+        bool                  mUpdateSave;         // save() was called while mUpdateCount > 0, or a deferred save is pending
+        int                   mSaveCount;          // number of save() calls since the calendar was last written
+        int                   mSaveRetryDelay;     // delay before retrying a failed save, or 0 if the last save succeeded
+        QTimer*               mSaveTimer;          // timer to write deferred changes to the calendar file
         bool                  mHaveDisabledAlarms; // there is at least one individually disabled alarm
 
         using QObject::event;   // prevent "hidden" warning
@@ -0,0 +1,857 @@
+/*
+ *  alarmengine.cpp  -  alarm scheduling engine without a user interface
+ *  Program:  kalarm
+ *  Copyright © 2017 by David Jarvie <djarvie@kde.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include "kalarm.h"
+#include "alarmengine.h"
+
+#include "alarmnotifier.h"
+#include "clocktimer.h"
+#include "shellprocess.h"
+
+#include <kalarmcal/collectionattribute.h>
+#include <kalarmcal/compatibilityattribute.h>
+#include <kalarmcal/eventattribute.h>
+#include <kalarmcal/kacalendar.h>
+
+#include <AkonadiCore/attributefactory.h>
+#include <AkonadiCore/collectionfetchjob.h>
+#include <AkonadiCore/collectionfetchscope.h>
+#include <AkonadiCore/itemcreatejob.h>
+#include <AkonadiCore/itemdeletejob.h>
+#include <AkonadiCore/itemfetchjob.h>
+#include <AkonadiCore/itemfetchscope.h>
+#include <AkonadiCore/itemmodifyjob.h>
+#include <AkonadiCore/monitor.h>
+
+#include <KCodecs>
+#include <KEmailAddress>
+#include <KMime/Message>
+#include <kshell.h>
+#include <ksystemtimezone.h>
+
+#include <QDateTime>
+#include <QFile>
+#include <QLockFile>
+#include <QMimeDatabase>
+#include <QStandardPaths>
+#include <QTemporaryFile>
+#include <QTextStream>
+#include <QUrl>
+#include "kalarm_debug.h"
+
+using namespace Akonadi;
+
+static const int LOCK_RETRY_INTERVAL = 60;   // seconds between attempts to acquire the execution lock
+
+
+AlarmEngine::AlarmEngine(AlarmNotifier* notifier, QObject* parent)
+    : QObject(parent),
+      mNotifier(notifier),
+      mExecutionLock(AlarmScheduler::createExecutionLock()),
+      mTimeSpec(KSystemTimeZones::local()),
+      mArchivedKeepDays(0),
+      mStarted(false),
+      mCollectionsFetched(false),
+      mFetched(false),
+      mLoginAlarmsDone(false)
+{
+    mTimer = new ClockTimer(this);
+    connect(mTimer, &ClockTimer::timeout, this, &AlarmEngine::processDueAlarms);
+
+    AttributeFactory::registerAttribute<CollectionAttribute>();
+    AttributeFactory::registerAttribute<CompatibilityAttribute>();
+    AttributeFactory::registerAttribute<EventAttribute>();
+
+    // Monitor the same collections as KAlarm does. Archived alarm collections
+    // are monitored in order to know which is the standard one.
+    mMonitor = new Monitor(this);
+    mMonitor->setCollectionMonitored(Collection::root());
+    mMonitor->setResourceMonitored("akonadi_kalarm_resource");
+    mMonitor->setResourceMonitored("akonadi_kalarm_dir_resource");
+    mMonitor->setMimeTypeMonitored(KAlarmCal::MIME_ACTIVE);
+    mMonitor->setMimeTypeMonitored(KAlarmCal::MIME_ARCHIVED);
+    mMonitor->itemFetchScope().fetchFullPayload();
+    mMonitor->itemFetchScope().fetchAttribute<EventAttribute>();
+    connect(mMonitor, &Monitor::collectionAdded, this, &AlarmEngine::slotCollectionChanged);
+    connect(mMonitor, SIGNAL(collectionChanged(Akonadi::Collection)), SLOT(slotCollectionChanged(Akonadi::Collection)));
+    connect(mMonitor, &Monitor::collectionRemoved, this, &AlarmEngine::slotCollectionRemoved);
+    connect(mMonitor, &Monitor::itemAdded, this, &AlarmEngine::slotItemAdded);
+    connect(mMonitor, &Monitor::itemChanged, this, &AlarmEngine::slotItemChanged);
+    connect(mMonitor, &Monitor::itemMoved, this, &AlarmEngine::slotItemMoved);
+    connect(mMonitor, &Monitor::itemRemoved, this, &AlarmEngine::slotItemRemoved);
+}
+
+AlarmEngine::~AlarmEngine()
+{
+    mTriggers.clear();
+    qDeleteAll(mEvents);
+    purgeDeletedEvents();
+    for (QHash<ShellProcess*, QString>::ConstIterator it = mTempFiles.constBegin();  it != mTempFiles.constEnd();  ++it)
+        QFile::remove(it.value());
+    delete mExecutionLock;
+}
+
+/******************************************************************************
+* Set the time zone in which alarms are scheduled.
+*/
+void AlarmEngine::setTimeZone(const KTimeZone& tz)
+{
+    mTimeSpec = tz.isValid() ? KDateTime::Spec(tz) : KDateTime::Spec(KSystemTimeZones::local());
+}
+
+/******************************************************************************
+* Start scheduling alarms, once the Akonadi server is running.
+*/
+void AlarmEngine::start()
+{
+    if (mStarted)
+        return;
+    mStarted = true;
+    if (ServerManager::isRunning())
+        fetchCollections();
+    else
+    {
+        connect(ServerManager::self(), &ServerManager::stateChanged, this, &AlarmEngine::slotServerStateChanged);
+        ServerManager::start();
+    }
+}
+
+/******************************************************************************
+* Called when the Akonadi server changes state.
+* Once it is running, fetch the alarms.
+*/
+void AlarmEngine::slotServerStateChanged(ServerManager::State state)
+{
+    qCDebug(KALARM_LOG) << state;
+    if (state == ServerManager::Running)
+    {
+        disconnect(ServerManager::self(), &ServerManager::stateChanged, this, &AlarmEngine::slotServerStateChanged);
+        fetchCollections();
+    }
+}
+
+/******************************************************************************
+* Fetch all collections which contain KAlarm alarms.
+*/
+void AlarmEngine::fetchCollections()
+{
+    CollectionFetchJob* job = new CollectionFetchJob(Collection::root(), CollectionFetchJob::Recursive);
+    job->fetchScope().setContentMimeTypes(QStringList() << KAlarmCal::MIME_ACTIVE << KAlarmCal::MIME_ARCHIVED);
+    connect(job, &CollectionFetchJob::result, this, &AlarmEngine::slotCollectionsFetched);
+}
+
+/******************************************************************************
+* Called when the collection fetch job has completed.
+* Fetch the alarms in each collection which is to be scheduled.
+*/
+void AlarmEngine::slotCollectionsFetched(KJob* j)
+{
+    CollectionFetchJob* job = static_cast<CollectionFetchJob*>(j);
+    if (j->error())
+        qCCritical(KALARM_LOG) << "CollectionFetchJob error: " << j->errorString();
+    else
+    {
+        const Collection::List collections = job->collections();
+        for (int i = 0, count = collections.count();  i < count;  ++i)
+            setCollection(collections[i]);
+    }
+    mCollectionsFetched = true;
+    if (mItemFetchJobs.isEmpty())
+    {
+        mFetched = true;
+        qCDebug(KALARM_LOG) << "Scheduling" << mTriggers.count() << "alarms";
+        processDueAlarms();
+    }
+}
+
+/******************************************************************************
+* Called when an item fetch job has completed.
+* Schedule the collection's alarms, and once all collections have been fetched,
+* start processing alarms.
+*/
+void AlarmEngine::slotItemsFetched(KJob* j)
+{
+    const Collection::Id id = mItemFetchJobs.take(j);
+    if (j->error())
+        qCCritical(KALARM_LOG) << "ItemFetchJob: collection" << id << "error: " << j->errorString();
+    else if (isScheduled(mCollections.value(id)))
+    {
+        const Item::List items = static_cast<ItemFetchJob*>(j)->items();
+        for (int i = 0, count = items.count();  i < count;  ++i)
+            setEvent(items[i], id);
+        qCDebug(KALARM_LOG) << "Collection" << id << ":" << items.count() << "alarms fetched";
+    }
+    if (mItemFetchJobs.isEmpty()  &&  mCollectionsFetched)
+    {
+        if (!mFetched)
+        {
+            mFetched = true;
+            qCDebug(KALARM_LOG) << "Scheduling" << mTriggers.count() << "alarms";
+            processDueAlarms();
+        }
+        else
+            checkNextDueAlarm();
+    }
+}
+
+/******************************************************************************
+* Return whether a collection's alarms are to be scheduled, i.e. it is used by
+* KAlarm and active alarms are enabled in it.
+*/
+bool AlarmEngine::isScheduled(const Collection& collection) const
+{
+    return collection.isValid()
+       &&  mCollectionIds.contains(collection.id())
+       &&  collection.contentMimeTypes().contains(KAlarmCal::MIME_ACTIVE)
+       &&  collection.hasAttribute<CollectionAttribute>()
+       &&  collection.attribute<CollectionAttribute>()->isEnabled(CalEvent::ACTIVE);
+}
+
+/******************************************************************************
+* Record a collection's current properties. If its alarms are to be scheduled
+* and are not already, fetch them; if they are no longer to be scheduled,
+* remove them.
+*/
+void AlarmEngine::setCollection(const Collection& collection)
+{
+    if (!collection.contentMimeTypes().contains(KAlarmCal::MIME_ACTIVE)
+    &&  !collection.contentMimeTypes().contains(KAlarmCal::MIME_ARCHIVED))
+        return;
+    const bool wasScheduled = isScheduled(mCollections.value(collection.id()));
+    mCollections[collection.id()] = collection;
+    if (isScheduled(collection))
+    {
+        if (!wasScheduled)
+        {
+            qCDebug(KALARM_LOG) << "Fetching collection" << collection.id();
+            ItemFetchJob* job = new ItemFetchJob(collection, this);
+            job->fetchScope().fetchFullPayload();
+            job->fetchScope().fetchAttribute<EventAttribute>();
+            mItemFetchJobs[job] = collection.id();
+            connect(job, &ItemFetchJob::result, this, &AlarmEngine::slotItemsFetched);
+        }
+    }
+    else if (wasScheduled)
+    {
+        removeCollection(collection.id());
+        checkNextDueAlarm();
+    }
+}
+
+/******************************************************************************
+* Called when a collection has been added or changed.
+*/
+void AlarmEngine::slotCollectionChanged(const Collection& collection)
+{
+    setCollection(collection);
+}
+
+/******************************************************************************
+* Called when a collection has been removed.
+*/
+void AlarmEngine::slotCollectionRemoved(const Collection& collection)
+{
+    removeCollection(collection.id());
+    mCollections.remove(collection.id());
+    checkNextDueAlarm();
+}
+
+/******************************************************************************
+* Stop scheduling the alarms belonging to a collection.
+*/
+void AlarmEngine::removeCollection(Collection::Id id)
+{
+    mTriggers.removeCollection(id);
+    for (QHash<Item::Id, KAEvent*>::Iterator it = mEvents.begin();  it != mEvents.end();  )
+    {
+        if (it.value()->collectionId() == id)
+        {
+            delete it.value();
+            it = mEvents.erase(it);
+        }
+        else
+            ++it;
+    }
+}
+
+/******************************************************************************
+* Called when an item has been added to a monitored collection.
+*/
+void AlarmEngine::slotItemAdded(const Item& item, const Collection& collection)
+{
+    if (isScheduled(mCollections.value(collection.id())))
+    {
+        setEvent(item, collection.id());
+        checkNextDueAlarm();
+    }
+}
+
+/******************************************************************************
+* Called when an item has been changed.
+* Changes made by the engine itself are ignored while further changes by the
+* engine are still to be written, since the engine's copy is then the latest.
+*/
+void AlarmEngine::slotItemChanged(const Item& item)
+{
+    if (mItemModifyQueue.contains(item.id()))
+        return;
+    Collection::Id id = item.parentCollection().id();
+    if (id < 0  &&  mEvents.contains(item.id()))
+        id = mEvents[item.id()]->collectionId();
+    if (isScheduled(mCollections.value(id)))
+        setEvent(item, id);
+    else
+        removeEvent(item.id());
+    checkNextDueAlarm();
+}
+
+/******************************************************************************
+* Called when an item has been moved to another collection.
+*/
+void AlarmEngine::slotItemMoved(const Item& item, const Collection&, const Collection& destination)
+{
+    removeEvent(item.id());
+    if (isScheduled(mCollections.value(destination.id())))
+        setEvent(item, destination.id());
+    checkNextDueAlarm();
+}
+
+/******************************************************************************
+* Called when an item has been removed.
+*/
+void AlarmEngine::slotItemRemoved(const Item& item)
+{
+    removeEvent(item.id());
+    checkNextDueAlarm();
+}
+
+/******************************************************************************
+* Schedule the event contained in an item, replacing any previous version.
+*/
+void AlarmEngine::setEvent(const Item& item, Collection::Id id)
+{
+    removeEvent(item.id());
+    if (!item.hasPayload<KAEvent>())
+        return;
+    KAEvent* event = new KAEvent(item.payload<KAEvent>());
+    if (!event->isValid()  ||  event->category() != CalEvent::ACTIVE  ||  !event->enabled())
+    {
+        delete event;
+        return;    // only active, enabled alarms are scheduled
+    }
+    event->setItemId(item.id());
+    event->setCollectionId(id);
+    mEvents[item.id()] = event;
+    updateTrigger(event);
+}
+
+/******************************************************************************
+* Stop scheduling an item's event.
+*/
+void AlarmEngine::removeEvent(Item::Id id)
+{
+    KAEvent* event = mEvents.take(id);
+    if (event)
+    {
+        mTriggers.remove(EventId(*event));
+        delete event;
+    }
+}
+
+/******************************************************************************
+* Return the time at which alarms are being processed.
+*/
+KDateTime AlarmEngine::currentTime() const
+{
+    return mNow.isValid() ? mNow : KDateTime::currentDateTime(mTimeSpec);
+}
+
+/******************************************************************************
+* Called when the timer expires, to process all alarms which are due.
+* Alarms are only executed if no other process, i.e. KAlarm, is executing
+* alarms. Once acquired, the execution lock is held until the calendar changes
+* resulting from executing the alarms have been written, so that KAlarm does
+* not execute them again.
+*/
+void AlarmEngine::processDueAlarms()
+{
+    if (!mFetched)
+        return;
+    if (!mExecutionLock->isLocked()  &&  !mExecutionLock->tryLock(0))
+    {
+        qCDebug(KALARM_LOG) << "Alarms are being executed by another process";
+        mTimer->start(QDateTime::currentDateTimeUtc().addSecs(LOCK_RETRY_INTERVAL));
+        return;
+    }
+    mNow = KDateTime::currentDateTime(mTimeSpec);
+    processLoginAlarms();
+    const QVector<KAEvent*> events = mTriggers.due(mNow);
+    for (int i = 0, end = events.count();  i < end;  ++i)
+        handleEvent(events[i], mNow);
+    mNow = KDateTime();
+    purgeDeletedEvents();
+    releaseExecutionLock();
+    checkNextDueAlarm();
+}
+
+/******************************************************************************
+* Release the execution lock, if all calendar changes have been written.
+*/
+void AlarmEngine::releaseExecutionLock()
+{
+    if (mItemJobs.isEmpty()  &&  !mNow.isValid())
+        mExecutionLock->unlock();
+}
+
+/******************************************************************************
+* Execute all repeat-at-login alarms, once only, when alarms are first
+* processed. Any scheduled reminders or deferrals for them are cancelled first,
+* since these are superseded by the at-login trigger.
+*/
+void AlarmEngine::processLoginAlarms()
+{
+    if (mLoginAlarmsDone)
+        return;
+    mLoginAlarmsDone = true;
+    KAEvent::List events;
+    for (QHash<Item::Id, KAEvent*>::ConstIterator it = mEvents.constBegin();  it != mEvents.constEnd();  ++it)
+    {
+        if (it.value()->repeatAtLogin())
+            events += it.value();
+    }
+    for (int i = 0, end = events.count();  i < end;  ++i)
+    {
+        if (!cancelReminderAndDeferral(*events[i]))
+            handleEvent(events[i], mNow);
+    }
+}
+
+/******************************************************************************
+* Set the timer to expire when the next alarm is due.
+*/
+void AlarmEngine::checkNextDueAlarm()
+{
+    if (!mFetched)
+        return;
+    if (mTriggers.isEmpty())
+    {
+        qCDebug(KALARM_LOG) << "No alarms";
+        mTimer->stop();
+        return;
+    }
+    const QDateTime next = QDateTime::fromMSecsSinceEpoch(mTriggers.topTime(), Qt::UTC);
+    qCDebug(KALARM_LOG) << "Next alarm:" << next;
+    mTimer->start(next);
+}
+
+/******************************************************************************
+* Execute the alarm in an event which is due, and reschedule it.
+* Late-cancel, working time and repeat-at-login alarms are handled in the same
+* way as by the KAlarm application.
+* Reply = true if an alarm was executed or the event was changed.
+*/
+bool AlarmEngine::handleEvent(KAEvent* event, const KDateTime& now)
+{
+    KAAlarm alarm;
+    bool updated;
+    if (!findDueAlarm(*event, now, alarm, updated))
+        return true;    // the event has been deleted
+    if (alarm.isValid())
+    {
+        qCDebug(KALARM_LOG) << event->id() << ": alarm" << alarm.type() << "due at" << alarm.dateTime(true).effectiveKDateTime().dateTime();
+        execAlarm(*event, alarm);
+        if (rescheduleAlarm(*event, alarm, true) < 0)
+            return true;    // the event has been deleted
+    }
+    else if (updated)
+        updateEvent(*event);
+    updateTrigger(event, now);
+    return alarm.isValid()  ||  updated;
+}
+
+/******************************************************************************
+* Execute an alarm.
+* Command and email alarms are executed by the engine; other alarms are passed
+* to the notifier.
+*/
+void AlarmEngine::execAlarm(KAEvent& event, const KAAlarm& alarm)
+{
+    event.setArchive();
+    switch (alarm.action())
+    {
+        case KAAlarm::COMMAND:
+            execCommand(event);
+            break;
+        case KAAlarm::EMAIL:
+            sendEmail(event);
+            break;
+        default:
+            if (mNotifier)
+                mNotifier->notify(event, alarm);
+            break;
+    }
+}
+
+/******************************************************************************
+* Return whether the engine may make a specified kind of change to a
+* collection. Collections in an old format are left for KAlarm to convert,
+* since it asks the user first.
+*/
+bool AlarmEngine::isWritable(Collection::Id id, Collection::Rights rights) const
+{
+    const Collection collection = mCollections.value(id);
+    return collection.isValid()
+       &&  (collection.rights() & rights) == rights
+       &&  collection.hasAttribute<CompatibilityAttribute>()
+       &&  collection.attribute<CompatibilityAttribute>()->compatibility() == KACalendar::Current;
+}
+
+/******************************************************************************
+* Write an event which has been changed by the alarm scheduler to its calendar.
+*/
+void AlarmEngine::updateEvent(KAEvent& event)
+{
+    if (!isWritable(event.collectionId(), Collection::CanChangeItem))
+    {
+        qCWarning(KALARM_LOG) << event.id() << ": calendar is read-only or in an old format: change not saved";
+        return;
+    }
+    Item item(event.itemId());
+    if (!event.setItemPayload(item, mCollections.value(event.collectionId()).contentMimeTypes()))
+    {
+        qCWarning(KALARM_LOG) << "Invalid mime type for collection";
+        return;
+    }
+    QHash<Item::Id, Item>::Iterator it = mItemModifyQueue.find(item.id());
+    if (it != mItemModifyQueue.end())
+    {
+        // A job is already executing for the item. Queue the new value to
+        // be written when it completes.
+        it.value() = item;
+        return;
+    }
+    mItemModifyQueue[item.id()] = Item();   // mark the item as having a job executing
+    startItemModifyJob(item);
+}
+
+/******************************************************************************
+* Start a job to write a changed item.
+*/
+void AlarmEngine::startItemModifyJob(const Item& item)
+{
+    ItemModifyJob* job = new ItemModifyJob(item, this);
+    job->disableRevisionCheck();
+    startItemJob(job, item.id());
+}
+
+/******************************************************************************
+* Record an item job which has been started.
+*/
+void AlarmEngine::startItemJob(KJob* job, Item::Id id)
+{
+    mItemJobs[job] = id;
+    connect(job, &KJob::result, this, &AlarmEngine::slotItemJobDone);
+}
+
+/******************************************************************************
+* Delete an event which has no more alarms from its calendar.
+* The KAEvent instance is not deleted until processing is complete, since the
+* caller may still refer to it.
+*/
+void AlarmEngine::deleteEvent(KAEvent& event)
+{
+    mTriggers.remove(EventId(event));
+    mEvents.remove(event.itemId());
+    mDeletedEvents += &event;
+    if (!isWritable(event.collectionId(), Collection::CanDeleteItem))
+    {
+        qCWarning(KALARM_LOG) << event.id() << ": calendar is read-only or in an old format: deletion not saved";
+        return;
+    }
+    QHash<Item::Id, Item>::Iterator it = mItemModifyQueue.find(event.itemId());
+    if (it != mItemModifyQueue.end())
+        it.value() = Item();   // no point in modifying it first
+    startItemJob(new ItemDeleteJob(Item(event.itemId()), this), event.itemId());
+}
+
+/******************************************************************************
+* Save an event which is about to be deleted in the standard archived alarm
+* calendar, in the same way as KAlarm does.
+*/
+void AlarmEngine::archiveEvent(const KAEvent& event)
+{
+    if (!mArchivedKeepDays)
+        return;   // expired alarms aren't being kept
+    const Collection collection = archivedCollection();
+    if (!collection.isValid())
+    {
+        qCWarning(KALARM_LOG) << event.id() << ": no archived alarm calendar to save expired alarm";
+        return;
+    }
+    KAEvent newevent(event);
+    newevent.setItemId(-1);    // invalidate the Akonadi item ID since it's a new item
+    newevent.setCategory(CalEvent::ARCHIVED);    // this changes the event ID
+    newevent.setCreatedDateTime(KDateTime::currentUtcDateTime());   // time stamp to control purging
+    Item item;
+    if (!newevent.setItemPayload(item, collection.contentMimeTypes()))
+    {
+        qCWarning(KALARM_LOG) << "Invalid mime type for collection";
+        return;
+    }
+    qCDebug(KALARM_LOG) << event.id() << "-> collection" << collection.id();
+    startItemJob(new ItemCreateJob(item, collection, this), -1);
+}
+
+/******************************************************************************
+* Return the standard archived alarm collection, if it can be written to.
+*/
+Collection AlarmEngine::archivedCollection() const
+{
+    for (QHash<Collection::Id, Collection>::ConstIterator it = mCollections.constBegin();  it != mCollections.constEnd();  ++it)
+    {
+        const Collection& collection = it.value();
+        if (mCollectionIds.contains(collection.id())
+        &&  collection.contentMimeTypes().contains(KAlarmCal::MIME_ARCHIVED)
+        &&  collection.hasAttribute<CollectionAttribute>()
+        &&  (collection.attribute<CollectionAttribute>()->standard() & CalEvent::ARCHIVED)
+        &&  isWritable(collection.id(), Collection::CanCreateItem))
+            return collection;
+    }
+    return Collection();
+}
+
+/******************************************************************************
+* Called when an item create, modify or delete job has completed.
+* If another change to the item has been queued meanwhile, write it. Once all
+* changes have been written, the execution lock is released.
+*/
+void AlarmEngine::slotItemJobDone(KJob* job)
+{
+    const Item::Id id = mItemJobs.take(job);
+    if (job->error())
+        qCCritical(KALARM_LOG) << "Item" << id << ":" << job->errorString();
+    ItemModifyJob* modifyJob = qobject_cast<ItemModifyJob*>(job);
+    if (modifyJob)
+    {
+        const QHash<Item::Id, Item>::Iterator it = mItemModifyQueue.find(id);
+        if (it != mItemModifyQueue.end())
+        {
+            if (it.value().isValid())
+            {
+                const Item item = it.value();
+                it.value() = Item();   // mark the queued item as now executing
+                startItemModifyJob(item);
+            }
+            else
+                mItemModifyQueue.erase(it);
+        }
+    }
+    else if (qobject_cast<ItemDeleteJob*>(job))
+        mItemModifyQueue.remove(id);
+    releaseExecutionLock();
+}
+
+/******************************************************************************
+* Delete the events which were removed while processing alarms.
+*/
+void AlarmEngine::purgeDeletedEvents()
+{
+    qDeleteAll(mDeletedEvents);
+    mDeletedEvents.clear();
+}
+
+/******************************************************************************
+* Update an event's position in the trigger index.
+* If 'now' is valid and the event's next trigger time is not after it, the
+* event has no alarm which can be executed (e.g. only an at-login alarm is
+* due), so it is removed from the index to avoid repeatedly processing it.
+*/
+void AlarmEngine::updateTrigger(KAEvent* event, const KDateTime& now)
+{
+    const KDateTime next = event->nextTrigger(KAEvent::ALL_TRIGGER).effectiveKDateTime();
+    if (now.isValid()  &&  next.isValid()  &&  next <= now)
+        mTriggers.remove(EventId(*event));
+    else
+        mTriggers.update(event, next);
+}
+
+/******************************************************************************
+* Execute a command alarm.
+* If the command's output is to be logged, it is appended to the log file;
+* otherwise it is passed to the engine's standard output.
+* Commands which are to be run in a terminal window, or whose output is to be
+* displayed, are simply executed since there is no display.
+*/
+void AlarmEngine::execCommand(const KAEvent& event)
+{
+    QString command = event.cleanText();
+    QString tmpFile;
+    if (event.commandScript())
+    {
+        // Store the command script in a temporary file for execution
+        QTemporaryFile file;
+        file.setAutoRemove(false);     // don't delete file when it is destructed
+        if (!file.open())
+        {
+            qCCritical(KALARM_LOG) << "Unable to create a temporary script file";
+            return;
+        }
+        file.setPermissions(QFile::ReadUser | QFile::WriteUser | QFile::ExeUser);
+        QTextStream stream(&file);
+        stream << command;
+        stream.flush();
+        tmpFile = file.fileName();
+        command = tmpFile;
+    }
+
+    qCDebug(KALARM_LOG) << command;
+    ShellProcess* proc = new ShellProcess(command);
+    proc->setEnv(QStringLiteral("KALARM_UID"), event.id(), true);
+    if (event.logFile().isEmpty())
+        proc->setOutputChannelMode(KProcess::ForwardedChannels);
+    else
+    {
+        proc->setOutputChannelMode(KProcess::MergedChannels);   // combine stdout & stderr
+        proc->setStandardOutputFile(event.logFile(), QIODevice::Append);
+    }
+    connect(proc, &ShellProcess::shellExited, this, &AlarmEngine::slotCommandExited);
+    if (!tmpFile.isEmpty())
+        mTempFiles[proc] = tmpFile;
+    if (!proc->start(QIODevice::WriteOnly))
+    {
+        qCWarning(KALARM_LOG) << "Command failed to start:" << event.id();
+        if (!tmpFile.isEmpty())
+            QFile::remove(tmpFile);
+        mTempFiles.remove(proc);
+        delete proc;
+    }
+}
+
+/******************************************************************************
+* Send an email alarm using sendmail.
+* Only local files may be attached to the email.
+*/
+void AlarmEngine::sendEmail(const KAEvent& event)
+{
+    if (mEmailFrom.isEmpty())
+    {
+        qCWarning(KALARM_LOG) << event.id() << ": no 'From' email address is configured";
+        return;
+    }
+    QStringList paths;
+    paths << QStringLiteral("/sbin") << QStringLiteral("/usr/sbin") << QStringLiteral("/usr/lib");
+    QString command = QStandardPaths::findExecutable(QStringLiteral("sendmail"), paths);
+    if (command.isEmpty())
+    {
+        qCCritical(KALARM_LOG) << "sendmail not found";
+        return;
+    }
+    command += QStringLiteral(" -f ");
+    command += KShell::quoteArg(KEmailAddress::extractEmailAddress(KEmailAddress::normalizeAddressesAndEncodeIdn(mEmailFrom)));
+    command += QStringLiteral(" -oi -t");
+
+    KMime::Message message;
+    KMime::Headers::Date* date = new KMime::Headers::Date;
+    date->setDateTime(QDateTime::currentDateTime());
+    message.setHeader(date);
+    KMime::Headers::From* from = new KMime::Headers::From;
+    from->fromUnicodeString(mEmailFrom, "utf-8");
+    message.setHeader(from);
+    KMime::Headers::To* to = new KMime::Headers::To;
+    const KCalCore::Person::List toList = event.emailAddressees();
+    for (int i = 0, count = toList.count();  i < count;  ++i)
+        to->addAddress(toList[i]->email().toLatin1(), toList[i]->name());
+    message.setHeader(to);
+    if (event.emailBcc()  &&  !mEmailBcc.isEmpty())
+    {
+        KMime::Headers::Bcc* bcc = new KMime::Headers::Bcc;
+        bcc->fromUnicodeString(mEmailBcc, "utf-8");
+        message.setHeader(bcc);
+    }
+    KMime::Headers::Subject* subject = new KMime::Headers::Subject;
+    subject->fromUnicodeString(event.emailSubject(), "utf-8");
+    message.setHeader(subject);
+
+    const QStringList attachments = event.emailAttachments();
+    KMime::Content* body = &message;
+    if (!attachments.isEmpty())
+    {
+        message.contentType()->setMimeType("multipart/mixed");
+        message.contentType()->setBoundary(KMime::multiPartBoundary());
+        body = new KMime::Content;
+        message.addContent(body);
+    }
+    body->contentType()->setMimeType("text/plain");
+    body->contentType()->setCharset("utf-8");
+    body->fromUnicodeString(event.message());
+    auto encodings = KMime::encodingsForData(body->body());
+    encodings.removeAll(KMime::Headers::CE8Bit);  // not handled by KMime
+    body->contentTransferEncoding()->setEncoding(encodings[0]);
+    body->assemble();
+
+    QMimeDatabase mimeDb;
+    for (int i = 0, end = attachments.count();  i < end;  ++i)
+    {
+        const QUrl url = QUrl::fromUserInput(attachments[i], QString(), QUrl::AssumeLocalFile);
+        QFile file(url.toLocalFile());
+        if (!url.isLocalFile()  ||  !file.open(QIODevice::ReadOnly))
+        {
+            qCCritical(KALARM_LOG) << event.id() << ": error attaching file" << attachments[i];
+            return;
+        }
+        KMime::Content* content = new KMime::Content;
+        content->setBody(KCodecs::base64Encode(file.readAll()) + "\n\n");
+        content->contentType()->setMimeType(mimeDb.mimeTypeForFile(file.fileName()).name().toLatin1());
+        content->contentType()->setName(attachments[i], "local");
+        content->contentTransferEncoding()->setEncoding(KMime::Headers::CEbase64);
+        content->contentTransferEncoding()->setDecoded(false);
+        content->assemble();
+        message.addContent(content);
+    }
+    message.assemble();
+
+    qCDebug(KALARM_LOG) << event.id() << ": email to" << event.emailAddresses(QStringLiteral(","));
+    ShellProcess* proc = new ShellProcess(command);
+    proc->setOutputChannelMode(KProcess::ForwardedChannels);
+    connect(proc, &ShellProcess::shellExited, this, &AlarmEngine::slotCommandExited);
+    if (!proc->start(QIODevice::WriteOnly))
+    {
+        qCWarning(KALARM_LOG) << "Email failed to start:" << event.id();
+        delete proc;
+        return;
+    }
+    proc->write(message.encodedContent());
+    proc->closeWriteChannel();
+}
+
+/******************************************************************************
+* Called when a command alarm's execution, or an email send command, completes.
+*/
+void AlarmEngine::slotCommandExited(ShellProcess* proc)
+{
+    if (proc->status() != ShellProcess::SUCCESS  ||  proc->exitCode())
+        qCWarning(KALARM_LOG) << "Command failed:" << proc->command() << proc->errorMessage();
+    const QString tmpFile = mTempFiles.take(proc);
+    if (!tmpFile.isEmpty())
+        QFile::remove(tmpFile);
+    proc->deleteLater();
+}
+
+// vim: et sw=4:
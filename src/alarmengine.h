@@ -0,0 +1,165 @@
+/*
+ *  alarmengine.h  -  alarm scheduling engine without a user interface
+ *  Program:  kalarm
+ *  Copyright © 2017 by David Jarvie <djarvie@kde.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#ifndef ALARMENGINE_H
+#define ALARMENGINE_H
+
+/* @file alarmengine.h - alarm scheduling engine without a user interface */
+
+#include "alarmscheduler.h"
+#include "triggerheap.h"
+
+#include <kalarmcal/kaevent.h>
+
+#include <AkonadiCore/collection.h>
+#include <AkonadiCore/item.h>
+#include <AkonadiCore/servermanager.h>
+
+#include <KDateTime>
+
+#include <QHash>
+#include <QObject>
+#include <QSet>
+
+class QLockFile;
+class KJob;
+class AlarmNotifier;
+class ClockTimer;
+class ShellProcess;
+namespace Akonadi { class Monitor; }
+
+using namespace KAlarmCal;
+
+
+/** AlarmEngine schedules and executes the active alarms held in KAlarm's
+ *  Akonadi calendars, without requiring a graphical user interface.
+ *
+ *  Which alarms are due, and how they are cancelled or rescheduled, is
+ *  decided by AlarmScheduler, in the same way as in the KAlarm application.
+ *  Command and email alarms are executed by the engine itself. Display and
+ *  audio alarms are passed to an AlarmNotifier.
+ *
+ *  The calendars are accessed through Akonadi, in the same way as by KAlarm,
+ *  so that both file and directory calendar resources are handled, and
+ *  changes made by KAlarm or the resources are seen by the engine. Only the
+ *  calendars which KAlarm uses, and in which active alarms are enabled, are
+ *  scheduled. Rescheduled events are written back to their calendars, and
+ *  expired events are archived in the standard archived alarm calendar, so
+ *  that alarms are not executed again when the engine is restarted.
+ *
+ *  Alarms are only executed while the engine can acquire the execution lock,
+ *  i.e. while the KAlarm application is not running. The lock is kept until
+ *  the resulting calendar changes have been written.
+ */
+class AlarmEngine : public QObject, private AlarmScheduler
+{
+        Q_OBJECT
+    public:
+        /** Constructor.
+         *  @param notifier  Notifier to deliver display and audio alarms.
+         *                   Ownership is not transferred.
+         */
+        explicit AlarmEngine(AlarmNotifier* notifier, QObject* parent = nullptr);
+        ~AlarmEngine();
+
+        /** Set the IDs of the Akonadi collections which KAlarm uses. Only
+         *  these collections are scheduled or archived to. */
+        void setCollections(const QList<Akonadi::Collection::Id>& ids)   { mCollectionIds = ids.toSet(); }
+        /** Set the time zone in which alarms are scheduled. If invalid, the
+         *  system time zone is used. */
+        void setTimeZone(const KTimeZone&);
+        /** Set the number of days to keep expired alarms, or 0 to not
+         *  archive them. */
+        void setArchivedKeepDays(int days)   { mArchivedKeepDays = days; }
+        /** Set the 'From' and 'Bcc' addresses for email alarms. */
+        void setEmailAddresses(const QString& from, const QString& bcc)   { mEmailFrom = from;  mEmailBcc = bcc; }
+        /** Start the Akonadi server if necessary, fetch the alarms from the
+         *  calendars and start scheduling them. Repeat-at-login alarms are
+         *  executed once the alarms have been fetched. */
+        void start();
+
+    protected:
+        KDateTime currentTime() const Q_DECL_OVERRIDE;
+        void updateEvent(KAEvent&) Q_DECL_OVERRIDE;
+        void deleteEvent(KAEvent&) Q_DECL_OVERRIDE;
+        void archiveEvent(const KAEvent&) Q_DECL_OVERRIDE;
+
+    private Q_SLOTS:
+        void processDueAlarms();
+        void slotServerStateChanged(Akonadi::ServerManager::State);
+        void slotCollectionsFetched(KJob*);
+        void slotItemsFetched(KJob*);
+        void slotCollectionChanged(const Akonadi::Collection&);
+        void slotCollectionRemoved(const Akonadi::Collection&);
+        void slotItemAdded(const Akonadi::Item&, const Akonadi::Collection&);
+        void slotItemChanged(const Akonadi::Item&);
+        void slotItemMoved(const Akonadi::Item&, const Akonadi::Collection& source, const Akonadi::Collection& destination);
+        void slotItemRemoved(const Akonadi::Item&);
+        void slotItemJobDone(KJob*);
+        void slotCommandExited(ShellProcess*);
+
+    private:
+        void fetchCollections();
+        void setCollection(const Akonadi::Collection&);
+        void removeCollection(Akonadi::Collection::Id);
+        bool isScheduled(const Akonadi::Collection&) const;
+        void setEvent(const Akonadi::Item&, Akonadi::Collection::Id);
+        void removeEvent(Akonadi::Item::Id);
+        bool isWritable(Akonadi::Collection::Id, Akonadi::Collection::Rights) const;
+        Akonadi::Collection archivedCollection() const;
+        void startItemModifyJob(const Akonadi::Item&);
+        void startItemJob(KJob*, Akonadi::Item::Id);
+        void releaseExecutionLock();
+        void processLoginAlarms();
+        bool handleEvent(KAEvent*, const KDateTime& now);
+        void execAlarm(KAEvent&, const KAAlarm&);
+        void execCommand(const KAEvent&);
+        void sendEmail(const KAEvent&);
+        void updateTrigger(KAEvent*, const KDateTime& now = KDateTime());
+        void purgeDeletedEvents();
+        void checkNextDueAlarm();
+
+        AlarmNotifier*       mNotifier;
+        ClockTimer*          mTimer;           // wakes the engine when the next alarm is due
+        Akonadi::Monitor*    mMonitor;         // notifies changes to the calendars
+        QLockFile*           mExecutionLock;   // lock which must be held to execute alarms
+        QSet<Akonadi::Collection::Id> mCollectionIds;  // collections used by KAlarm
+        QHash<Akonadi::Collection::Id, Akonadi::Collection> mCollections;  // KAlarm collections known to Akonadi
+        QHash<Akonadi::Item::Id, KAEvent*> mEvents;    // scheduled active events, by Akonadi item ID
+        QHash<KJob*, Akonadi::Collection::Id> mItemFetchJobs;  // item fetch jobs, and the collection fetched
+        QHash<KJob*, Akonadi::Item::Id> mItemJobs;     // item create, modify and delete jobs which are executing
+        QHash<Akonadi::Item::Id, Akonadi::Item> mItemModifyQueue;  // next modification for items with a job executing
+        KAEvent::List        mDeletedEvents;   // events deleted while processing alarms
+        TriggerHeap          mTriggers;        // scheduled events, by next trigger time
+        QHash<ShellProcess*, QString> mTempFiles;  // temporary script file for each command process
+        QString              mEmailFrom;       // 'From' address for email alarms
+        QString              mEmailBcc;        // 'Bcc' address for email alarms
+        KDateTime::Spec      mTimeSpec;        // time zone in which alarms are scheduled
+        KDateTime            mNow;             // time at which alarms are being processed
+        int                  mArchivedKeepDays; // days to keep expired alarms, or 0 to not archive
+        bool                 mStarted;         // start() has been called
+        bool                 mCollectionsFetched; // the initial collection fetch has completed
+        bool                 mFetched;         // alarms have been fetched from the calendars
+        bool                 mLoginAlarmsDone; // repeat-at-login alarms have been executed
+};
+
+#endif // ALARMENGINE_H
+
+// vim: et sw=4:
@@ -21,6 +21,8 @@
 #include "kalarm.h"
 #include "alarmlistview.h"
 
+#include "synchtimer.h"
+
 #include <ksharedconfig.h>
 #include <kconfiggroup.h>
 
@@ -30,10 +32,17 @@
 
 AlarmListView::AlarmListView(const QByteArray& configGroup, QWidget* parent)
     : EventListView(parent),
-      mConfigGroup(configGroup)
+      mConfigGroup(configGroup),
+      mTimeToWidth(0)
 {
     setEditOnSingleClick(true);
     connect(header(), &QHeaderView::sectionMoved, this, &AlarmListView::sectionMoved);
+    MinuteTimer::connect(this, SLOT(updateTimeToColumn()));
+}
+
+AlarmListView::~AlarmListView()
+{
+    MinuteTimer::disconnect(this);
 }
 
 void AlarmListView::setModel(QAbstractItemModel* model)
@@ -68,6 +77,42 @@ void AlarmListView::sectionMoved()
     config.sync();
 }
 
+/******************************************************************************
+* Called every minute to update the time-to-alarm column.
+* Only rows which are currently visible are checked, and only those whose text
+* has changed since the last update are repainted. This avoids signalling a
+* change for every alarm through all the models. Since no change is signalled,
+* the column is resized here if the width of its widest text has changed.
+*/
+void AlarmListView::updateTimeToColumn()
+{
+    QHash<Akonadi::Item::Id, QString> texts;
+    int width = 0;
+    if (model()  &&  !header()->isSectionHidden(AlarmListModel::TimeToColumn))
+    {
+        const QFontMetrics fm = viewOptions().fontMetrics;
+        const QRect area = viewport()->rect();
+        for (QModelIndex ix = indexAt(area.topLeft());  ix.isValid();  ix = indexBelow(ix))
+        {
+            const QModelIndex cell = ix.sibling(ix.row(), AlarmListModel::TimeToColumn);
+            const QRect rect = visualRect(cell);
+            if (rect.top() > area.bottom())
+                break;
+            const Akonadi::Item::Id id = cell.data(AkonadiModel::ItemIdRole).toLongLong();
+            const QString text = cell.data(Qt::DisplayRole).toString();
+            QHash<Akonadi::Item::Id, QString>::ConstIterator it = mTimeToText.constFind(id);
+            if (it == mTimeToText.constEnd()  ||  it.value() != text)
+                viewport()->update(rect);
+            texts[id] = text;
+            width = qMax(width, fm.width(text));
+        }
+        if (width != mTimeToWidth)
+            resizeColumnToContents(AlarmListModel::TimeToColumn);
+    }
+    mTimeToText = texts;
+    mTimeToWidth = width;
+}
+
 /******************************************************************************
 * Set which time columns are to be displayed.
 */
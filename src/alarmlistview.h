@@ -26,6 +26,7 @@
 #include "eventlistview.h"
 
 #include <QByteArray>
+#include <QHash>
 
 
 class AlarmListView : public EventListView
@@ -33,14 +34,18 @@ class AlarmListView : public EventListView
         Q_OBJECT
     public:
         explicit AlarmListView(const QByteArray& configGroup, QWidget* parent = nullptr);
+        ~AlarmListView();
         void        setModel(QAbstractItemModel*) Q_DECL_OVERRIDE;
         void        selectTimeColumns(bool time, bool timeTo);
 
     private Q_SLOTS:
         void        sectionMoved();
+        void        updateTimeToColumn();
 
     private:
         QByteArray  mConfigGroup;
+        QHash<Akonadi::Item::Id, QString> mTimeToText;  // time-to-alarm texts of visible rows at the last update
+        int         mTimeToWidth;     // width of the widest time-to-alarm text at the last update
 };
 
 #endif // ALARMLISTVIEW_H
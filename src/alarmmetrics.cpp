@@ -0,0 +1,289 @@
+/*
+ *  alarmmetrics.cpp  -  statistics on alarm trigger latency and execution time
+ *  Program:  kalarm
+ *  Copyright © 2017 by David Jarvie <djarvie@kde.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include "kalarm.h"
+#include "alarmmetrics.h"
+
+#include "preferences.h"
+
+#include <QSaveFile>
+#include <QStringList>
+#include <QTextStream>
+#include <QTimer>
+#include <qalgorithms.h>
+#include "kalarm_debug.h"
+
+namespace
+{
+const int SUB_BUCKET_BITS  = 3;
+const int SUB_BUCKET_COUNT = 1 << SUB_BUCKET_BITS;
+// Values below SUB_BUCKET_COUNT have one bucket each; each higher power of 2
+// has SUB_BUCKET_COUNT buckets.
+const int BUCKET_COUNT = (64 - SUB_BUCKET_BITS) * SUB_BUCKET_COUNT;
+const int METRICS_WRITE_DELAY = 10000;   // milliseconds to wait before writing the metrics file
+}
+
+
+MetricsHistogram::MetricsHistogram()
+    : mBuckets(BUCKET_COUNT, 0),
+      mCount(0),
+      mSum(0),
+      mMin(0),
+      mMax(0)
+{
+}
+
+/******************************************************************************
+* Return the bucket index for a value.
+*/
+int MetricsHistogram::bucketIndex(qint64 value)
+{
+    if (value < SUB_BUCKET_COUNT)
+        return static_cast<int>(value);
+    const int msb = 63 - qCountLeadingZeroBits(static_cast<quint64>(value));
+    return (msb - SUB_BUCKET_BITS + 1) * SUB_BUCKET_COUNT
+         + static_cast<int>((value >> (msb - SUB_BUCKET_BITS)) & (SUB_BUCKET_COUNT - 1));
+}
+
+/******************************************************************************
+* Return the highest value which is contained in a bucket.
+*/
+qint64 MetricsHistogram::bucketUpper(int index)
+{
+    if (index < SUB_BUCKET_COUNT)
+        return index;
+    const int shift = index / SUB_BUCKET_COUNT - 1;
+    const qint64 lower = static_cast<qint64>(SUB_BUCKET_COUNT + index % SUB_BUCKET_COUNT) << shift;
+    return lower + (Q_INT64_C(1) << shift) - 1;
+}
+
+void MetricsHistogram::record(qint64 value)
+{
+    if (value < 0)
+        value = 0;
+    ++mBuckets[bucketIndex(value)];
+    if (!mCount  ||  value < mMin)
+        mMin = value;
+    if (value > mMax)
+        mMax = value;
+    ++mCount;
+    mSum += value;
+}
+
+qint64 MetricsHistogram::percentile(double percent) const
+{
+    if (!mCount)
+        return 0;
+    quint64 target = static_cast<quint64>(mCount * percent / 100 + 0.5);
+    if (!target)
+        target = 1;
+    quint64 total = 0;
+    for (int i = 0;  i < BUCKET_COUNT;  ++i)
+    {
+        total += mBuckets[i];
+        if (total >= target)
+            return qMin(bucketUpper(i), mMax);
+    }
+    return mMax;
+}
+
+/******************************************************************************
+* Write the histogram as cumulative bucket counts, omitting empty buckets,
+* followed by its sum and count.
+*/
+void MetricsHistogram::write(QTextStream& out, const QString& name, const QString& labels) const
+{
+    const QString sep = labels.isEmpty() ? QString() : QStringLiteral(",");
+    const QString braced = labels.isEmpty() ? QString() : QLatin1Char('{') + labels + QLatin1Char('}');
+    quint64 total = 0;
+    for (int i = 0;  i < BUCKET_COUNT  &&  total < mCount;  ++i)
+    {
+        if (mBuckets[i])
+        {
+            total += mBuckets[i];
+            out << name << "_bucket{" << labels << sep << "le=\"" << bucketUpper(i) << "\"} " << total << '\n';
+        }
+    }
+    out << name << "_bucket{" << labels << sep << "le=\"+Inf\"} " << mCount << '\n';
+    out << name << "_sum" << braced << ' ' << mSum << '\n';
+    out << name << "_count" << braced << ' ' << mCount << '\n';
+}
+
+
+AlarmMetrics* AlarmMetrics::mInstance = nullptr;
+
+AlarmMetrics* AlarmMetrics::instance()
+{
+    if (!mInstance)
+        mInstance = new AlarmMetrics;
+    return mInstance;
+}
+
+AlarmMetrics::AlarmMetrics()
+    : mLateCancelled(0),
+      mRescheduled(0),
+      mSaveFailures(0),
+      mItemModifyRequests(0),
+      mItemModifyJobs(0),
+      mWriteTimer(new QTimer(this))
+{
+    mWriteTimer->setSingleShot(true);
+    mWriteTimer->setInterval(METRICS_WRITE_DELAY);
+    connect(mWriteTimer, &QTimer::timeout, this, &AlarmMetrics::writeFile);
+}
+
+void AlarmMetrics::recordLatency(KAAlarm::Action action, qint64 msecs)
+{
+    mLatency[actionType(action)].record(msecs);
+    changed();
+}
+
+void AlarmMetrics::recordQueueWait(qint64 msecs)
+{
+    mQueueWait.record(msecs);
+    changed();
+}
+
+void AlarmMetrics::recordExecution(KAAlarm::Action action, qint64 msecs)
+{
+    mExecution[actionType(action)].record(msecs);
+    changed();
+}
+
+void AlarmMetrics::recordDispatch(int count)
+{
+    mDispatched.record(count);
+    changed();
+}
+
+/******************************************************************************
+* Called when a statistic has changed, to schedule writing the metrics file.
+*/
+void AlarmMetrics::changed()
+{
+    if (!mWriteTimer->isActive()  &&  !Preferences::metricsFile().isEmpty())
+        mWriteTimer->start();
+}
+
+QString AlarmMetrics::report() const
+{
+    QString text;
+    QTextStream out(&text);
+    writeHistograms(out, QStringLiteral("kalarm_alarm_latency_ms"), "Delay between alarms' scheduled times and their execution", mLatency, ACTION_COUNT);
+    writeHistograms(out, QStringLiteral("kalarm_alarm_execution_ms"), "Time taken to execute or initiate alarm actions", mExecution, ACTION_COUNT);
+    writeHistograms(out, QStringLiteral("kalarm_queue_wait_ms"), "Time spent by actions in the execution queue", &mQueueWait, 1);
+    writeHistograms(out, QStringLiteral("kalarm_alarms_dispatched"), "Number of alarms queued each time due alarms were found", &mDispatched, 1);
+    out << "# TYPE kalarm_alarms_late_cancelled_total counter\n"
+        << "kalarm_alarms_late_cancelled_total " << mLateCancelled << '\n'
+        << "# TYPE kalarm_alarms_rescheduled_total counter\n"
+        << "kalarm_alarms_rescheduled_total " << mRescheduled << '\n'
+        << "# TYPE kalarm_calendar_save_failures_total counter\n"
+        << "kalarm_calendar_save_failures_total " << mSaveFailures << '\n'
+        << "# TYPE kalarm_item_modify_requests_total counter\n"
+        << "kalarm_item_modify_requests_total " << mItemModifyRequests << '\n'
+        << "# TYPE kalarm_item_modify_jobs_total counter\n"
+        << "kalarm_item_modify_jobs_total " << mItemModifyJobs << '\n';
+    out.flush();
+    return text;
+}
+
+/******************************************************************************
+* Write a histogram family, followed by separate gauge families containing the
+* median, 99th percentile and maximum of each histogram.
+* If 'count' is ACTION_COUNT, the histograms are labelled with their action
+* types; otherwise 'count' must be 1, and no labels are written.
+*/
+void AlarmMetrics::writeHistograms(QTextStream& out, const QString& name, const char* help,
+                                   const MetricsHistogram* histograms, int count)
+{
+    QStringList labels;
+    for (int i = 0;  i < count;  ++i)
+        labels += (count == ACTION_COUNT) ? QStringLiteral("action=\"%1\"").arg(actionName(ActionType(i))) : QString();
+
+    out << "# HELP " << name << ' ' << help << '\n'
+        << "# TYPE " << name << " histogram\n";
+    for (int i = 0;  i < count;  ++i)
+        histograms[i].write(out, name, labels[i]);
+
+    static const char* const gauges[] = { "_p50", "_p99", "_max" };
+    static const char* const gaugeHelp[] = { "median", "99th percentile", "maximum" };
+    for (int g = 0;  g < 3;  ++g)
+    {
+        const QString gaugeName = name + QLatin1String(gauges[g]);
+        out << "# HELP " << gaugeName << ' ' << help << ": " << gaugeHelp[g] << '\n'
+            << "# TYPE " << gaugeName << " gauge\n";
+        for (int i = 0;  i < count;  ++i)
+        {
+            const qint64 value = (g == 0) ? histograms[i].percentile(50)
+                               : (g == 1) ? histograms[i].percentile(99)
+                               :            histograms[i].max();
+            out << gaugeName;
+            if (!labels[i].isEmpty())
+                out << '{' << labels[i] << '}';
+            out << ' ' << value << '\n';
+        }
+    }
+}
+
+/******************************************************************************
+* Write the statistics to the metrics file, if one is configured.
+*/
+void AlarmMetrics::writeFile()
+{
+    const QString path = Preferences::metricsFile();
+    if (path.isEmpty())
+        return;
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text))
+    {
+        qCWarning(KALARM_LOG) << "Cannot open metrics file" << path;
+        return;
+    }
+    file.write(report().toUtf8());
+    if (!file.commit())
+        qCWarning(KALARM_LOG) << "Error writing metrics file" << path;
+}
+
+AlarmMetrics::ActionType AlarmMetrics::actionType(KAAlarm::Action action)
+{
+    switch (action)
+    {
+        case KAAlarm::COMMAND:  return COMMAND;
+        case KAAlarm::EMAIL:    return EMAIL;
+        case KAAlarm::AUDIO:    return AUDIO;
+        case KAAlarm::MESSAGE:
+        case KAAlarm::FILE:
+        default:                return DISPLAY;
+    }
+}
+
+QString AlarmMetrics::actionName(ActionType type)
+{
+    switch (type)
+    {
+        case COMMAND:  return QStringLiteral("command");
+        case EMAIL:    return QStringLiteral("email");
+        case AUDIO:    return QStringLiteral("audio");
+        case DISPLAY:
+        default:       return QStringLiteral("display");
+    }
+}
+
+// vim: et sw=4:
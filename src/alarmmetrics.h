@@ -0,0 +1,138 @@
+/*
+ *  alarmmetrics.h  -  statistics on alarm trigger latency and execution time
+ *  Program:  kalarm
+ *  Copyright © 2017 by David Jarvie <djarvie@kde.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#ifndef ALARMMETRICS_H
+#define ALARMMETRICS_H
+
+/* @file alarmmetrics.h - statistics on alarm trigger latency and execution time */
+
+#include <kalarmcal/kaalarm.h>
+
+#include <QObject>
+#include <QVector>
+
+class QTextStream;
+class QTimer;
+
+using namespace KAlarmCal;
+
+
+/** Histogram of non-negative values, such as times in milliseconds.
+ *  Buckets are spaced logarithmically, with 8 linear sub-buckets in each
+ *  power of 2, so that any recorded value is reported with a relative error
+ *  of at most 12.5%, whatever its magnitude.
+ */
+class MetricsHistogram
+{
+    public:
+        MetricsHistogram();
+        /** Record a value. Negative values are recorded as zero. */
+        void    record(qint64 value);
+        quint64 count() const    { return mCount; }
+        qint64  sum() const      { return mSum; }
+        qint64  min() const      { return mCount ? mMin : 0; }
+        qint64  max() const      { return mMax; }
+        /** Return the upper bound of the bucket containing a percentile.
+         *  @param percent  percentile, in the range 0 - 100.
+         */
+        qint64  percentile(double percent) const;
+        /** Write the histogram's series in the Prometheus text exposition
+         *  format. Percentiles are not written, since a histogram family may
+         *  only contain bucket, sum and count series. */
+        void    write(QTextStream&, const QString& name, const QString& labels = QString()) const;
+
+    private:
+        static int    bucketIndex(qint64 value);
+        static qint64 bucketUpper(int index);
+
+        QVector<quint64> mBuckets;
+        quint64          mCount;
+        qint64           mSum;
+        qint64           mMin;
+        qint64           mMax;
+};
+
+/** AlarmMetrics records how late alarms are executed, how long actions wait
+ *  in the execution queue, and how long it takes to execute each type of
+ *  alarm action.
+ *
+ *  The statistics are available from report(), and if the MetricsFile
+ *  configuration option is set, they are also written periodically to that
+ *  file.
+ */
+class AlarmMetrics : public QObject
+{
+        Q_OBJECT
+    public:
+        static AlarmMetrics* instance();
+
+        /** Record the delay between an alarm's scheduled time and its execution. */
+        void    recordLatency(KAAlarm::Action, qint64 msecs);
+        /** Record the time an action spent in the execution queue. */
+        void    recordQueueWait(qint64 msecs);
+        /** Record the time taken to execute (or to initiate) an alarm action. */
+        void    recordExecution(KAAlarm::Action, qint64 msecs);
+        /** Record the number of alarms queued for execution when the alarm
+         *  timer found alarms due. */
+        void    recordDispatch(int count);
+        /** Count an alarm which was cancelled because it was too late. */
+        void    countLateCancel()     { ++mLateCancelled;  changed(); }
+        /** Count an alarm which was rescheduled without being executed. */
+        void    countRescheduled()    { ++mRescheduled;  changed(); }
+        /** Count a deferred calendar file write which failed. */
+        void    countSaveFailure()    { ++mSaveFailures;  changed(); }
+        /** Count a request to modify an Akonadi item. */
+        void    countItemModifyRequest()  { ++mItemModifyRequests;  changed(); }
+        /** Count an Akonadi job executed to modify an item. Successive
+         *  modifications to the same item are combined into one job, so the
+         *  difference from the number of requests is the number of jobs saved. */
+        void    countItemModifyJob()      { ++mItemModifyJobs;  changed(); }
+        /** Return all statistics in the Prometheus text exposition format. */
+        QString report() const;
+
+    private Q_SLOTS:
+        void    writeFile();
+
+    private:
+        enum ActionType { DISPLAY, COMMAND, EMAIL, AUDIO, ACTION_COUNT };
+
+        AlarmMetrics();
+        static ActionType actionType(KAAlarm::Action);
+        static QString    actionName(ActionType);
+        void    changed();
+        static void writeHistograms(QTextStream&, const QString& name, const char* help,
+                                    const MetricsHistogram* histograms, int count);
+
+        static AlarmMetrics* mInstance;
+        MetricsHistogram mLatency[ACTION_COUNT];     // scheduled time to execution, per action type
+        MetricsHistogram mExecution[ACTION_COUNT];   // execution time, per action type
+        MetricsHistogram mQueueWait;                 // time spent in the execution queue
+        MetricsHistogram mDispatched;                // number of alarms queued per wake-up with alarms due
+        quint64          mLateCancelled;             // number of alarms cancelled for being late
+        quint64          mRescheduled;               // number of alarms rescheduled without execution
+        quint64          mSaveFailures;              // number of failed deferred calendar writes
+        quint64          mItemModifyRequests;        // number of Akonadi item modifications requested
+        quint64          mItemModifyJobs;            // number of Akonadi item modification jobs executed
+        QTimer*          mWriteTimer;                // delays writing the metrics file
+};
+
+#endif // ALARMMETRICS_H
+
+// vim: et sw=4:
@@ -0,0 +1,92 @@
+/*
+ *  alarmnotifier.cpp  -  notification of alarms which the engine cannot execute itself
+ *  Program:  kalarm
+ *  Copyright © 2017 by David Jarvie <djarvie@kde.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include "kalarm.h"
+#include "alarmnotifier.h"
+
+#include "shellprocess.h"
+
+#include <QDateTime>
+#include <QTextStream>
+#include "kalarm_debug.h"
+
+
+/******************************************************************************
+* Return a description of an event's action type.
+*/
+QString AlarmNotifier::actionName(const KAEvent& event)
+{
+    switch (event.actionSubType())
+    {
+        case KAEvent::MESSAGE:
+        case KAEvent::FILE:     return QStringLiteral("display");
+        case KAEvent::COMMAND:  return QStringLiteral("command");
+        case KAEvent::EMAIL:    return QStringLiteral("email");
+        case KAEvent::AUDIO:    return QStringLiteral("audio");
+    }
+    return QString();
+}
+
+/******************************************************************************
+* Write an alarm's details to standard output.
+*/
+void LogNotifier::notify(const KAEvent& event, const KAAlarm& alarm)
+{
+    QTextStream out(stdout);
+    out << QDateTime::currentDateTime().toString(Qt::ISODate) << ' '
+        << actionName(event) << ' ' << event.id();
+    if (alarm.isReminder())
+        out << " (reminder)";
+    out << ": " << event.cleanText() << endl;
+}
+
+CommandNotifier::CommandNotifier(const QString& command, QObject* parent)
+    : QObject(parent),
+      mCommand(command)
+{
+}
+
+/******************************************************************************
+* Execute the notification command for an alarm.
+*/
+void CommandNotifier::notify(const KAEvent& event, const KAAlarm& alarm)
+{
+    qCDebug(KALARM_LOG) << event.id();
+    ShellProcess* proc = new ShellProcess(mCommand);
+    proc->setEnv(QStringLiteral("KALARM_UID"), event.id(), true);
+    proc->setEnv(QStringLiteral("KALARM_ACTION"), actionName(event) + (alarm.isReminder() ? QStringLiteral("-reminder") : QString()), true);
+    proc->setEnv(QStringLiteral("KALARM_TEXT"), event.cleanText(), true);
+    proc->setOutputChannelMode(KProcess::ForwardedChannels);
+    connect(proc, &ShellProcess::shellExited, this, &CommandNotifier::slotExited);
+    if (!proc->start())
+    {
+        qCWarning(KALARM_LOG) << "Failed to start notification command:" << mCommand;
+        delete proc;
+    }
+}
+
+void CommandNotifier::slotExited(ShellProcess* proc)
+{
+    if (!proc->normalExit())
+        qCWarning(KALARM_LOG) << "Notification command failed:" << proc->errorMessage();
+    proc->deleteLater();
+}
+
+// vim: et sw=4:
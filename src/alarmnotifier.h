@@ -0,0 +1,82 @@
+/*
+ *  alarmnotifier.h  -  notification of alarms which the engine cannot execute itself
+ *  Program:  kalarm
+ *  Copyright © 2017 by David Jarvie <djarvie@kde.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#ifndef ALARMNOTIFIER_H
+#define ALARMNOTIFIER_H
+
+/* @file alarmnotifier.h - notification of alarms which the engine cannot execute itself */
+
+#include <kalarmcal/kaevent.h>
+
+#include <QObject>
+
+class ShellProcess;
+
+using namespace KAlarmCal;
+
+
+/** AlarmNotifier is the interface used by AlarmEngine to deliver alarms which
+ *  it does not execute itself, i.e. display and audio alarms.
+ *  This allows the engine to run without a graphical user interface.
+ */
+class AlarmNotifier
+{
+    public:
+        virtual ~AlarmNotifier() {}
+
+        /** Deliver an alarm.
+         *  @param event  The event containing the alarm.
+         *  @param alarm  The alarm which has triggered.
+         */
+        virtual void notify(const KAEvent& event, const KAAlarm& alarm) = 0;
+
+        /** Return a description of an alarm's action type, for use in
+         *  notifications. */
+        static QString actionName(const KAEvent&);
+};
+
+/** Notifier which writes alarms to standard output. */
+class LogNotifier : public AlarmNotifier
+{
+    public:
+        void notify(const KAEvent&, const KAAlarm&) Q_DECL_OVERRIDE;
+};
+
+/** Notifier which executes a shell command for each alarm.
+ *  The command is passed details of the alarm in the environment variables
+ *  KALARM_UID, KALARM_ACTION and KALARM_TEXT.
+ */
+class CommandNotifier : public QObject, public AlarmNotifier
+{
+        Q_OBJECT
+    public:
+        explicit CommandNotifier(const QString& command, QObject* parent = nullptr);
+        void notify(const KAEvent&, const KAAlarm&) Q_DECL_OVERRIDE;
+
+    private Q_SLOTS:
+        void slotExited(ShellProcess*);
+
+    private:
+        QString  mCommand;
+};
+
+#endif // ALARMNOTIFIER_H
+
+// vim: et sw=4:
@@ -0,0 +1,397 @@
+/*
+ *  alarmscheduler.cpp  -  decides how due alarms are triggered and rescheduled
+ *  Program:  kalarm
+ *  Copyright © 2017 by David Jarvie <djarvie@kde.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include "kalarm.h"
+#include "alarmscheduler.h"
+
+#include <QDir>
+#include <QLockFile>
+#include <QStandardPaths>
+#include "kalarm_debug.h"
+
+
+/******************************************************************************
+* Find the maximum number of seconds late which a late-cancel alarm is allowed
+* to be. This is calculated as the late cancel interval, plus a few seconds
+* leeway to cater for any timing irregularities.
+*/
+int AlarmScheduler::maxLateness(int lateCancel)
+{
+    static const int LATENESS_LEEWAY = 5;
+    int lc = (lateCancel >= 1) ? (lateCancel - 1)*60 : 0;
+    return LATENESS_LEEWAY + lc;
+}
+
+/******************************************************************************
+* Return the path of the lock file which a process must hold to execute alarms.
+*/
+QString AlarmScheduler::executionLockPath()
+{
+    const QString dir = QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation) + QStringLiteral("/kalarm");
+    QDir().mkpath(dir);
+    return dir + QStringLiteral("/execution.lock");
+}
+
+/******************************************************************************
+* Create a lock file object for the execution lock.
+* The lock is held indefinitely by its owner, so it must never be treated as
+* stale while the owning process is still running.
+*/
+QLockFile* AlarmScheduler::createExecutionLock()
+{
+    QLockFile* lock = new QLockFile(executionLockPath());
+    lock->setStaleLockTime(0);
+    return lock;
+}
+
+/******************************************************************************
+* Check each of an event's alarms in turn, to find which is due.
+* Alarms which are too late are cancelled, and alarms which are restricted to
+* working time are rescheduled if it is not now working time.
+* Reply = false if the event has been deleted.
+*/
+bool AlarmScheduler::findDueAlarm(KAEvent& event, const KDateTime& now, KAAlarm& alarmToExecute, bool& updated)
+{
+    updated = false;
+    alarmToExecute = KAAlarm();
+    bool alarmToExecuteValid = false;
+    bool restart = false;
+    // Check all the alarms in turn.
+    // Note that the main alarm is fetched before any other alarms.
+    for (KAAlarm alarm = event.firstAlarm();
+         alarm.isValid();
+         alarm = (restart ? event.firstAlarm() : event.nextAlarm(alarm)), restart = false)
+    {
+        // Check if the alarm is due yet.
+        KDateTime nextDT = alarm.dateTime(true).effectiveKDateTime();
+        int secs = nextDT.secsTo(now);
+        if (secs < 0)
+        {
+            // The alarm appears to be in the future.
+            // Check if it's an invalid local clock time during a daylight
+            // saving time shift, which has actually passed.
+            if (alarm.dateTime().timeSpec() != KDateTime::ClockTime
+            ||  nextDT > now.toTimeSpec(KDateTime::ClockTime))
+            {
+                // This alarm is definitely not due yet
+                qCDebug(KALARM_LOG) << "Alarm" << alarm.type() << "at" << nextDT.dateTime() << ": not due";
+                continue;
+            }
+        }
+        bool reschedule = false;
+        bool rescheduleWork = false;
+        if ((event.workTimeOnly() || event.holidaysExcluded())  &&  !alarm.deferred())
+        {
+            // The alarm is restricted to working hours and/or non-holidays
+            // (apart from deferrals). This needs to be re-evaluated every
+            // time it triggers, since working hours could change.
+            if (alarm.dateTime().isDateOnly())
+            {
+                KDateTime dt(nextDT);
+                dt.setDateOnly(true);
+                reschedule = !event.isWorkingTime(dt);
+            }
+            else
+                reschedule = !event.isWorkingTime(nextDT);
+            rescheduleWork = reschedule;
+            if (reschedule)
+                qCDebug(KALARM_LOG) << "Alarm" << alarm.type() << "at" << nextDT.dateTime() << ": not during working hours";
+        }
+        if (!reschedule  &&  alarm.repeatAtLogin())
+        {
+            // Alarm is to be displayed at every login.
+            qCDebug(KALARM_LOG) << "REPEAT_AT_LOGIN";
+            // Check if the main alarm is already being displayed.
+            // (We don't want to display both at the same time.)
+            if (alarmToExecute.isValid())
+                continue;
+
+            // Set the time to display if it's a display alarm
+            alarm.setTime(now);
+        }
+        if (!reschedule  &&  event.lateCancel())
+        {
+            // Alarm is due, and it is to be cancelled if too late.
+            qCDebug(KALARM_LOG) << "LATE_CANCEL";
+            bool cancel = false;
+            if (alarm.dateTime().isDateOnly())
+            {
+                // The alarm has no time, so cancel it if its date is too far past
+                int maxlate = event.lateCancel() / 1440;    // maximum lateness in days
+                KDateTime limit(DateTime(nextDT.addDays(maxlate + 1)).effectiveKDateTime());
+                if (now >= limit)
+                {
+                    // It's too late to display the scheduled occurrence.
+                    // Find the last previous occurrence of the alarm.
+                    DateTime next;
+                    KAEvent::OccurType type = event.previousOccurrence(now, next, true);
+                    switch (type & ~KAEvent::OCCURRENCE_REPEAT)
+                    {
+                        case KAEvent::FIRST_OR_ONLY_OCCURRENCE:
+                        case KAEvent::RECURRENCE_DATE:
+                        case KAEvent::RECURRENCE_DATE_TIME:
+                        case KAEvent::LAST_RECURRENCE:
+                            limit.setDate(next.date().addDays(maxlate + 1));
+                            if (now >= limit)
+                            {
+                                if (type == KAEvent::LAST_RECURRENCE
+                                ||  (type == KAEvent::FIRST_OR_ONLY_OCCURRENCE && !event.recurs()))
+                                    cancel = true;   // last occurrence (and there are no repetitions)
+                                else
+                                    reschedule = true;
+                            }
+                            break;
+                        case KAEvent::NO_OCCURRENCE:
+                        default:
+                            reschedule = true;
+                            break;
+                    }
+                }
+            }
+            else
+            {
+                // The alarm is timed. Allow it to be the permitted amount late before cancelling it.
+                int maxlate = maxLateness(event.lateCancel());
+                if (secs > maxlate)
+                {
+                    // It's over the maximum interval late.
+                    // Find the most recent occurrence of the alarm.
+                    DateTime next;
+                    KAEvent::OccurType type = event.previousOccurrence(now, next, true);
+                    switch (type & ~KAEvent::OCCURRENCE_REPEAT)
+                    {
+                        case KAEvent::FIRST_OR_ONLY_OCCURRENCE:
+                        case KAEvent::RECURRENCE_DATE:
+                        case KAEvent::RECURRENCE_DATE_TIME:
+                        case KAEvent::LAST_RECURRENCE:
+                            if (next.effectiveKDateTime().secsTo(now) > maxlate)
+                            {
+                                if (type == KAEvent::LAST_RECURRENCE
+                                ||  (type == KAEvent::FIRST_OR_ONLY_OCCURRENCE && !event.recurs()))
+                                    cancel = true;   // last occurrence (and there are no repetitions)
+                                else
+                                    reschedule = true;
+                            }
+                            break;
+                        case KAEvent::NO_OCCURRENCE:
+                        default:
+                            reschedule = true;
+                            break;
+                    }
+                }
+            }
+
+            if (cancel)
+            {
+                // All recurrences are finished, so cancel the event
+                alarmCancelledLate(event);
+                event.setArchive();
+                if (cancelAlarm(event, alarm.type(), false))
+                    return false;   // event has been deleted
+                updated = true;
+                continue;
+            }
+        }
+        if (reschedule)
+        {
+            // The latest repetition was too long ago, so schedule the next one
+            alarmRescheduled(event);
+            switch (rescheduleAlarm(event, alarm, false, (rescheduleWork ? nextDT : KDateTime())))
+            {
+                case 1:
+                    // A working-time-only alarm has been rescheduled and the
+                    // rescheduled time is already due. Start processing the
+                    // event again.
+                    alarmToExecuteValid = false;
+                    restart = true;
+                    break;
+                case -1:
+                    return false;   // event has been deleted
+                default:
+                    break;
+            }
+            updated = true;
+            continue;
+        }
+        if (!alarmToExecuteValid)
+        {
+            qCDebug(KALARM_LOG) << "Alarm" << alarm.type() << ": execute";
+            alarmToExecute = alarm;             // note the alarm to be displayed
+            alarmToExecuteValid = true;         // only trigger one alarm for the event
+        }
+        else
+            qCDebug(KALARM_LOG) << "Alarm" << alarm.type() << ": skip";
+    }
+    return true;
+}
+
+/******************************************************************************
+* Reschedule the alarm for its next recurrence after now. If none remain,
+* delete it.  If the alarm is deleted and it is the last alarm for its event,
+* the event is deleted.
+* If 'nextDt' is valid, the event is rescheduled for the next non-working
+* time occurrence after that.
+* Reply = 1 if 'nextDt' is valid and the rescheduled event is already due
+*       = -1 if the event has been deleted
+*       = 0 otherwise.
+*/
+int AlarmScheduler::rescheduleAlarm(KAEvent& event, const KAAlarm& alarm, bool updateCalAndDisplay, const KDateTime& nextDt)
+{
+    qCDebug(KALARM_LOG) << "Alarm type:" << alarm.type();
+    int reply = 0;
+    bool update = false;
+    event.startChanges();
+    if (alarm.repeatAtLogin())
+    {
+        // Leave an alarm which repeats at every login until its main alarm triggers
+        if (!event.reminderActive()  &&  event.reminderMinutes() < 0)
+        {
+            // Executing an at-login alarm: first schedule the reminder
+            // which occurs AFTER the main alarm.
+            event.activateReminderAfter(currentTime());
+            update = true;
+        }
+    }
+    else if (alarm.isReminder()  ||  alarm.deferred())
+    {
+        // It's a reminder alarm or an extra deferred alarm, so delete it
+        event.removeExpiredAlarm(alarm.type());
+        update = true;
+    }
+    else
+    {
+        // Reschedule the alarm for its next occurrence.
+        bool cancelled = false;
+        DateTime last = event.mainDateTime(false);   // note this trigger time
+        if (last != event.mainDateTime(true))
+            last = DateTime();                       // but ignore sub-repetition triggers
+        bool next = nextDt.isValid();
+        KDateTime next_dt = nextDt;
+        KDateTime now = currentTime();
+        do
+        {
+            KAEvent::OccurType type = event.setNextOccurrence(next ? next_dt : now);
+            switch (type)
+            {
+                case KAEvent::NO_OCCURRENCE:
+                    // All repetitions are finished, so cancel the event
+                    qCDebug(KALARM_LOG) << "No occurrence";
+                    if (event.reminderMinutes() < 0  &&  last.isValid()
+                    &&  alarm.type() != KAAlarm::AT_LOGIN_ALARM  &&  !event.mainExpired())
+                    {
+                        // Set the reminder which is now due after the last main alarm trigger.
+                        // Note that at-login reminders are scheduled in execAlarm().
+                        event.activateReminderAfter(last);
+                        updateCalAndDisplay = true;
+                    }
+                    if (cancelAlarm(event, alarm.type(), updateCalAndDisplay))
+                        return -1;
+                    break;
+                default:
+                    if (!(type & KAEvent::OCCURRENCE_REPEAT))
+                        break;
+                    // Next occurrence is a repeat, so fall through to recurrence handling
+                case KAEvent::RECURRENCE_DATE:
+                case KAEvent::RECURRENCE_DATE_TIME:
+                case KAEvent::LAST_RECURRENCE:
+                    // The event is due by now and repetitions still remain, so rewrite the event
+                    if (updateCalAndDisplay)
+                        update = true;
+                    break;
+                case KAEvent::FIRST_OR_ONLY_OCCURRENCE:
+                    // The first occurrence is still due?!?, so don't do anything
+                    break;
+            }
+            if (cancelled)
+                break;
+            if (event.deferred())
+            {
+                // Just in case there's also a deferred alarm, ensure it's removed
+                event.removeExpiredAlarm(KAAlarm::DEFERRED_ALARM);
+                update = true;
+            }
+            if (next)
+            {
+                // The alarm is restricted to working hours and/or non-holidays.
+                // Check if the calculated next time is valid.
+                next_dt = event.mainDateTime(true).effectiveKDateTime();
+                if (event.mainDateTime(false).isDateOnly())
+                {
+                    KDateTime dt(next_dt);
+                    dt.setDateOnly(true);
+                    next = !event.isWorkingTime(dt);
+                }
+                else
+                    next = !event.isWorkingTime(next_dt);
+            }
+        } while (next && next_dt <= now);
+        reply = (!cancelled && next_dt.isValid() && (next_dt <= now)) ? 1 : 0;
+
+        if (event.reminderMinutes() < 0  &&  last.isValid()
+        &&  alarm.type() != KAAlarm::AT_LOGIN_ALARM)
+        {
+            // Set the reminder which is now due after the last main alarm trigger.
+            // Note that at-login reminders are scheduled in execAlarm().
+            event.activateReminderAfter(last);
+        }
+    }
+    event.endChanges();
+    if (update)
+        updateEvent(event);
+    return reply;
+}
+
+/******************************************************************************
+* Delete the alarm. If it is the last alarm for its event, the event is deleted.
+* Reply = true if event has been deleted.
+*/
+bool AlarmScheduler::cancelAlarm(KAEvent& event, KAAlarm::Type alarmType, bool updateCalAndDisplay)
+{
+    qCDebug(KALARM_LOG);
+    if (alarmType == KAAlarm::MAIN_ALARM  &&  !event.displaying()  &&  event.toBeArchived())
+    {
+        // The event is being deleted. Save it in the archived resources first.
+        archiveEvent(event);
+    }
+    event.removeExpiredAlarm(alarmType);
+    if (!event.alarmCount())
+    {
+        deleteEvent(event);
+        return true;
+    }
+    if (updateCalAndDisplay)
+        updateEvent(event);
+    return false;
+}
+
+/******************************************************************************
+* Cancel any reminder or deferred alarms in an repeat-at-login event.
+* This should be called when the event is first loaded.
+* If there are no more alarms left in the event, the event is deleted.
+* Reply = true if event has been deleted.
+*/
+bool AlarmScheduler::cancelReminderAndDeferral(KAEvent& event)
+{
+    return cancelAlarm(event, KAAlarm::REMINDER_ALARM, false)
+       ||  cancelAlarm(event, KAAlarm::DEFERRED_REMINDER_ALARM, false)
+       ||  cancelAlarm(event, KAAlarm::DEFERRED_ALARM, true);
+}
+
+// vim: et sw=4:
@@ -0,0 +1,112 @@
+/*
+ *  alarmscheduler.h  -  decides how due alarms are triggered and rescheduled
+ *  Program:  kalarm
+ *  Copyright © 2017 by David Jarvie <djarvie@kde.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#ifndef ALARMSCHEDULER_H
+#define ALARMSCHEDULER_H
+
+/* @file alarmscheduler.h - decides how due alarms are triggered and rescheduled */
+
+#include <kalarmcal/kaevent.h>
+
+#include <KDateTime>
+
+class QLockFile;
+
+using namespace KAlarmCal;
+
+
+/** AlarmScheduler contains the logic which determines which of an event's
+ *  alarms is due, cancels alarms which are too late, reschedules alarms
+ *  which are restricted to working time, and reschedules or cancels alarms
+ *  once they have triggered.
+ *
+ *  It is shared by the KAlarm application and by the alarm daemon, so that
+ *  both trigger alarms in the same way. Storage of the updated events is
+ *  provided by the derived class.
+ */
+class AlarmScheduler
+{
+    public:
+        virtual ~AlarmScheduler() {}
+
+        /** Return the number of seconds an alarm may be late before it is
+         *  cancelled, for a late-cancel value in minutes. */
+        static int maxLateness(int lateCancel);
+
+        /** Return the path of the lock file which must be held by a process
+         *  in order to execute alarms. This prevents alarms being executed by
+         *  both the KAlarm application and the alarm daemon. */
+        static QString executionLockPath();
+
+        /** Create a lock file object for executionLockPath(). Ownership is
+         *  passed to the caller. */
+        static QLockFile* createExecutionLock();
+
+    protected:
+        /** Check which of an event's alarms is due, and cancel or reschedule
+         *  any alarms which should not be executed.
+         *  @param event           The event to check.
+         *  @param now             The current time.
+         *  @param alarmToExecute  Updated to the alarm which should now be
+         *                         executed, or invalid if none.
+         *  @param updated         Set true if the event has been changed, and
+         *                         needs to be written by updateEvent().
+         *  @return false if the event has been deleted.
+         */
+        bool findDueAlarm(KAEvent& event, const KDateTime& now, KAAlarm& alarmToExecute, bool& updated);
+
+        /** Reschedule an alarm for its next recurrence after now. If none
+         *  remain, delete it.
+         *  @param nextDt  If valid, the event is rescheduled for the next
+         *                 working time occurrence after that.
+         *  @return 1 if 'nextDt' is valid and the rescheduled event is already due,
+         *          -1 if the event has been deleted,
+         *          0 otherwise.
+         */
+        int  rescheduleAlarm(KAEvent&, const KAAlarm&, bool updateCalAndDisplay, const KDateTime& nextDt = KDateTime());
+
+        /** Delete an alarm. If it is the last alarm for its event, the event
+         *  is deleted.
+         *  @return true if the event has been deleted.
+         */
+        bool cancelAlarm(KAEvent&, KAAlarm::Type, bool updateCalAndDisplay);
+
+        /** Cancel any reminder or deferred alarms in a repeat-at-login event.
+         *  @return true if the event has been deleted.
+         */
+        bool cancelReminderAndDeferral(KAEvent&);
+
+        /** Return the current time. */
+        virtual KDateTime currentTime() const   { return KDateTime::currentUtcDateTime(); }
+        /** Write an event which has been changed. */
+        virtual void updateEvent(KAEvent&) = 0;
+        /** Delete an event which has no more alarms. */
+        virtual void deleteEvent(KAEvent&) = 0;
+        /** Archive an event before it is deleted. */
+        virtual void archiveEvent(const KAEvent&) {}
+        /** Called when an alarm is cancelled because it is too late. */
+        virtual void alarmCancelledLate(const KAEvent&) {}
+        /** Called when an alarm is rescheduled without being executed. */
+        virtual void alarmRescheduled(const KAEvent&) {}
+};
+
+#endif // ALARMSCHEDULER_H
+
+// vim: et sw=4:
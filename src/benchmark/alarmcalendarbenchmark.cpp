@@ -0,0 +1,425 @@
+/*
+ *  alarmcalendarbenchmark.cpp  -  measures alarm calendar and scheduling performance
+ *  Program:  kalarm
+ *  Copyright © 2017 by David Jarvie <djarvie@kde.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+/* @file alarmcalendarbenchmark.cpp - measures alarm calendar and scheduling performance
+ *
+ * For each requested number of alarms, a synthetic calendar is generated and
+ * written to file. The benchmark then measures:
+ *  - parsing the calendar file;
+ *  - loading the alarms into AlarmCalendar and building its trigger indexes;
+ *  - rebuilding the trigger index (findEarliestAlarm());
+ *  - fetching the earliest alarm (earliestAlarm());
+ *  - processing due alarms over a simulated period, using the same scheduling
+ *    logic as KAlarmApp::handleEvent(), which is provided by AlarmScheduler;
+ *  - process memory usage.
+ * Results are written in JSON format.
+ *
+ * Alarms are fed to a resources AlarmCalendar which is not connected to
+ * AkonadiModel, so that only KAlarm's own processing is measured and no
+ * Akonadi server is needed.
+ */
+
+#include "kalarm.h"
+#include "calendargenerator.h"
+
+#include "alarmcalendar.h"
+#include "alarmscheduler.h"
+
+#include <kalarmcal/kacalendar.h>
+
+#include <KCalCore/FileStorage>
+#include <KCalCore/MemoryCalendar>
+#include <ksystemtimezone.h>
+
+#include <QApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QStandardPaths>
+#include <QTemporaryDir>
+#include <QTextStream>
+#include "kalarm_debug.h"
+
+#ifdef Q_OS_UNIX
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+using namespace KCalCore;
+
+namespace
+{
+const Akonadi::Collection::Id BENCHMARK_COLLECTION_ID = 1;
+const int EARLIEST_ALARM_CALLS = 100000;   // number of calls to time earliestAlarm() over
+
+qint64 residentMemory();
+qint64 maxResidentMemory();
+}
+
+
+/** BenchmarkCalendar is a resources calendar whose events are supplied
+ *  directly, instead of by AkonadiModel.
+ */
+class BenchmarkCalendar : public AlarmCalendar
+{
+    public:
+        BenchmarkCalendar() : AlarmCalendar(DETACHED) {}
+        using AlarmCalendar::addEvents;
+        using AlarmCalendar::changeEvent;
+        using AlarmCalendar::removeEvents;
+        using AlarmCalendar::removeCollectionEvents;
+        using AlarmCalendar::rebuildTriggerIndex;
+        using AlarmCalendar::atLoginEvents;
+};
+
+/** AlarmCalendarBenchmark runs the benchmarks for one calendar size. It acts
+ *  as the storage for AlarmScheduler, writing updated events back to the
+ *  resources calendar as AkonadiModel would once Akonadi has stored them.
+ */
+class AlarmCalendarBenchmark : private AlarmScheduler
+{
+    public:
+        AlarmCalendarBenchmark(const KDateTime& base, int simulateDays);
+        QJsonObject run(int count, const QString& dir);
+
+    protected:
+        KDateTime currentTime() const Q_DECL_OVERRIDE   { return mNow; }
+        void updateEvent(KAEvent&) Q_DECL_OVERRIDE;
+        void deleteEvent(KAEvent&) Q_DECL_OVERRIDE;
+
+    private:
+        int  processLoginAlarms();
+        int  processDueAlarms();
+        bool handleEvent(KAEvent*);
+
+        BenchmarkCalendar   mCalendar;
+        Akonadi::Collection mCollection;
+        KDateTime           mBase;
+        KDateTime           mNow;
+        int                 mSimulateDays;
+        int                 mExecuted;      // number of alarms which would have been executed
+        int                 mUpdates;       // number of event updates written to the calendar
+        int                 mDeletions;     // number of events deleted
+};
+
+AlarmCalendarBenchmark::AlarmCalendarBenchmark(const KDateTime& base, int simulateDays)
+    : mCollection(BENCHMARK_COLLECTION_ID),
+      mBase(base),
+      mSimulateDays(simulateDays),
+      mExecuted(0),
+      mUpdates(0),
+      mDeletions(0)
+{
+    mCollection.setContentMimeTypes(CalEvent::mimeTypes(CalEvent::ACTIVE));
+}
+
+/******************************************************************************
+* Run all the benchmarks for a calendar containing 'count' alarms.
+*/
+QJsonObject AlarmCalendarBenchmark::run(int count, const QString& dir)
+{
+    QJsonObject result;
+    result[QStringLiteral("alarms")] = count;
+    const qint64 memBefore = residentMemory();
+    QElapsedTimer timer;
+
+    // Generate the calendar file
+    timer.start();
+    CalendarGenerator generator(mBase);
+    const QString path = dir + QStringLiteral("/benchmark-%1.ics").arg(count);
+    if (!CalendarGenerator::writeCalendar(generator.generate(count), path))
+    {
+        result[QStringLiteral("error")] = QStringLiteral("Error writing calendar file");
+        return result;
+    }
+    result[QStringLiteral("generateMs")] = timer.elapsed();
+    result[QStringLiteral("fileBytes")] = QFile(path).size();
+
+    // Parse the calendar file
+    timer.start();
+    MemoryCalendar::Ptr kcal(new MemoryCalendar(KSystemTimeZones::local()));
+    FileStorage::Ptr storage(new FileStorage(kcal, path));
+    if (!storage->load())
+    {
+        result[QStringLiteral("error")] = QStringLiteral("Error reading calendar file");
+        return result;
+    }
+    AkonadiModel::EventList events;
+    const Event::List kcalEvents = kcal->rawEvents();
+    for (int i = 0, end = kcalEvents.count();  i < end;  ++i)
+    {
+        KAEvent event(kcalEvents[i]);
+        event.setCollectionId(mCollection.id());
+        events += AkonadiModel::Event(event, mCollection);
+    }
+    result[QStringLiteral("parseMs")] = timer.elapsed();
+    storage.clear();
+    kcal.clear();
+
+    // Load the alarms into the resources calendar
+    timer.start();
+    mCalendar.addEvents(events);
+    result[QStringLiteral("loadMs")] = timer.elapsed();
+    events.clear();
+    result[QStringLiteral("rssBytes")] = residentMemory() - memBefore;
+
+    // Rebuild the trigger time index
+    timer.start();
+    mCalendar.rebuildTriggerIndex(mCollection);
+    result[QStringLiteral("findEarliestAlarmMs")] = timer.elapsed();
+
+    // Fetch the earliest alarm
+    timer.start();
+    const KAEvent* earliest = nullptr;
+    for (int i = 0;  i < EARLIEST_ALARM_CALLS;  ++i)
+        earliest = mCalendar.earliestAlarm();
+    result[QStringLiteral("earliestAlarmNs")] = static_cast<double>(timer.nsecsElapsed()) / EARLIEST_ALARM_CALLS;
+    if (!earliest)
+        qCWarning(KALARM_LOG) << "No earliest alarm";
+
+    // Process alarms as they become due over the simulated period
+    mExecuted = mUpdates = mDeletions = 0;
+    mNow = mBase;
+    timer.start();
+    int handled = processLoginAlarms();
+    for (int minute = 0, end = mSimulateDays * 1440;  minute < end;  ++minute)
+    {
+        mNow = mBase.addSecs(static_cast<qint64>(minute) * 60);
+        handled += processDueAlarms();
+    }
+    const qint64 handleMs = timer.elapsed();
+    result[QStringLiteral("handleEventMs")] = handleMs;
+    result[QStringLiteral("handleEventCalls")] = handled;
+    result[QStringLiteral("handleEventPerSec")] = handleMs ? handled * 1000.0 / handleMs : 0.0;
+    result[QStringLiteral("alarmsExecuted")] = mExecuted;
+    result[QStringLiteral("eventUpdates")] = mUpdates;
+    result[QStringLiteral("eventDeletions")] = mDeletions;
+
+    // Remove the alarms, ready for the next calendar size
+    timer.start();
+    mCalendar.removeCollectionEvents(mCollection.id());
+    result[QStringLiteral("unloadMs")] = timer.elapsed();
+    result[QStringLiteral("maxRssBytes")] = maxResidentMemory();
+    QFile::remove(path);
+    return result;
+}
+
+/******************************************************************************
+* Cancel any reminders or deferrals in at-login alarms, and process their
+* at-login triggers, as is done by KAlarmApp at program start-up.
+* Reply = number of alarms processed.
+*/
+int AlarmCalendarBenchmark::processLoginAlarms()
+{
+    const KAEvent::List atLogins = mCalendar.atLoginEvents();
+    for (int i = 0, end = atLogins.count();  i < end;  ++i)
+    {
+        KAEvent event = *atLogins[i];
+        if (!cancelReminderAndDeferral(event))
+            handleEvent(atLogins[i]);
+    }
+    return atLogins.count();
+}
+
+/******************************************************************************
+* Process all alarms which are due at the simulated current time.
+* Reply = number of alarms processed.
+*/
+int AlarmCalendarBenchmark::processDueAlarms()
+{
+    const KAEvent::List due = mCalendar.dueAlarms(mNow);
+    QStringList ids;
+    for (int i = 0, end = due.count();  i < end;  ++i)
+        ids += due[i]->id();
+    // Processing an event may replace or delete the calendar's instance, so
+    // look up each event again before it is handled.
+    for (int i = 0, end = ids.count();  i < end;  ++i)
+    {
+        KAEvent* event = mCalendar.event(EventId(mCollection.id(), ids[i]));
+        if (event)
+            handleEvent(event);
+    }
+    return ids.count();
+}
+
+/******************************************************************************
+* Handle an event which is due, in the same way as KAlarmApp::handleEvent().
+* The alarm's action is not executed.
+* Reply = false if the event has been deleted.
+*/
+bool AlarmCalendarBenchmark::handleEvent(KAEvent* ev)
+{
+    KAEvent event(*ev);   // the calendar's instance may be replaced by updateEvent()
+    KAAlarm alarm;
+    bool updated;
+    if (!findDueAlarm(event, mNow, alarm, updated))
+        return false;
+    if (alarm.isValid())
+    {
+        ++mExecuted;
+        return rescheduleAlarm(event, alarm, true) >= 0;
+    }
+    if (updated)
+        updateEvent(event);
+    return true;
+}
+
+/******************************************************************************
+* Write a changed event to the calendar.
+*/
+void AlarmCalendarBenchmark::updateEvent(KAEvent& event)
+{
+    ++mUpdates;
+    event.setCollectionId(mCollection.id());
+    mCalendar.changeEvent(AkonadiModel::Event(event, mCollection));
+}
+
+/******************************************************************************
+* Delete an event from the calendar.
+*/
+void AlarmCalendarBenchmark::deleteEvent(KAEvent& event)
+{
+    ++mDeletions;
+    event.setCollectionId(mCollection.id());
+    mCalendar.removeEvents(AkonadiModel::EventList() << AkonadiModel::Event(event, mCollection));
+}
+
+
+namespace
+{
+
+/******************************************************************************
+* Return the current resident memory size of the process, in bytes.
+* Reply = -1 if not available.
+*/
+qint64 residentMemory()
+{
+#ifdef Q_OS_LINUX
+    QFile file(QStringLiteral("/proc/self/statm"));
+    if (file.open(QIODevice::ReadOnly))
+    {
+        const QList<QByteArray> fields = file.readAll().simplified().split(' ');
+        if (fields.count() >= 2)
+            return fields[1].toLongLong() * sysconf(_SC_PAGESIZE);
+    }
+#endif
+    return -1;
+}
+
+/******************************************************************************
+* Return the peak resident memory size of the process, in bytes.
+* Reply = -1 if not available.
+*/
+qint64 maxResidentMemory()
+{
+#ifdef Q_OS_UNIX
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage))
+        return -1;
+#ifdef Q_OS_MAC
+    return usage.ru_maxrss;           // in bytes
+#else
+    return usage.ru_maxrss * 1024;    // in kilobytes
+#endif
+#else
+    return -1;
+#endif
+}
+
+}
+
+
+int main(int argc, char* argv[])
+{
+    QApplication app(argc, argv);
+    // Don't touch the user's configuration or snapshot files
+    QStandardPaths::setTestModeEnabled(true);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("Measures KAlarm's alarm calendar and scheduling performance"));
+    parser.addHelpOption();
+    QCommandLineOption countsOption(QStringLiteral("counts"),
+                                    QStringLiteral("Comma separated numbers of alarms to benchmark"),
+                                    QStringLiteral("counts"), QStringLiteral("1000,10000,50000,200000"));
+    QCommandLineOption daysOption(QStringLiteral("days"),
+                                  QStringLiteral("Number of days over which to simulate alarm processing"),
+                                  QStringLiteral("days"), QStringLiteral("1"));
+    QCommandLineOption outputOption(QStringLiteral("output"),
+                                    QStringLiteral("File to write the JSON results to, instead of standard output"),
+                                    QStringLiteral("file"));
+    parser.addOption(countsOption);
+    parser.addOption(daysOption);
+    parser.addOption(outputOption);
+    parser.process(app);
+
+    QList<int> counts;
+    const QStringList countStrings = parser.value(countsOption).split(QLatin1Char(','), QString::SkipEmptyParts);
+    for (int i = 0, end = countStrings.count();  i < end;  ++i)
+    {
+        bool ok;
+        const int count = countStrings[i].trimmed().toInt(&ok);
+        if (!ok  ||  count <= 0)
+        {
+            qCCritical(KALARM_LOG) << "Invalid alarm count:" << countStrings[i];
+            return 1;
+        }
+        counts += count;
+    }
+    bool ok;
+    const int days = parser.value(daysOption).toInt(&ok);
+    if (!ok  ||  days < 0)
+    {
+        qCCritical(KALARM_LOG) << "Invalid number of days:" << parser.value(daysOption);
+        return 1;
+    }
+
+    QTemporaryDir dir;
+    if (!dir.isValid())
+    {
+        qCCritical(KALARM_LOG) << "Error creating temporary directory";
+        return 1;
+    }
+
+    const KDateTime base = KDateTime::currentDateTime(KSystemTimeZones::local());
+    AlarmCalendarBenchmark benchmark(base, days);
+    QJsonArray results;
+    for (int i = 0, end = counts.count();  i < end;  ++i)
+        results += benchmark.run(counts[i], dir.path());
+
+    const QByteArray json = QJsonDocument(results).toJson();
+    if (parser.isSet(outputOption))
+    {
+        QFile file(parser.value(outputOption));
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)
+        ||  file.write(json) != json.size())
+        {
+            qCCritical(KALARM_LOG) << "Error writing" << file.fileName();
+            return 1;
+        }
+    }
+    else
+        QTextStream(stdout) << json;
+    return 0;
+}
+
+// vim: et sw=4:
@@ -0,0 +1,167 @@
+/*
+ *  alarmsortbenchmark.cpp  -  measures sorting of the alarm list columns
+ *  Program:  kalarm
+ *  Copyright © 2017 by David Jarvie <djarvie@kde.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+/* @file alarmsortbenchmark.cpp - measures sorting of the alarm list columns
+ *
+ * A model is filled with the SortRole values of synthetic alarms for the time
+ * and repetition columns, and is sorted on each column through a
+ * QSortFilterProxyModel, as the alarm list views do. Sorting on the numeric
+ * keys returned by AkonadiModel is compared with sorting on the values which
+ * it formerly returned: a QDateTime for the time column, and a zero-padded
+ * string for the repetition column. Results are written in JSON format.
+ */
+
+#include "kalarm.h"
+#include "calendargenerator.h"
+
+#include "akonadimodel.h"
+
+#include <ksystemtimezone.h>
+
+#include <QApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSortFilterProxyModel>
+#include <QStandardItemModel>
+#include <QTextStream>
+#include "kalarm_debug.h"
+
+namespace
+{
+enum { TIME_COLUMN, REPEAT_COLUMN, COLUMN_COUNT };
+enum KeyType { NUMERIC_KEYS, FORMER_KEYS };
+
+QVariant sortKey(const KAEvent&, int column, KeyType);
+QJsonObject sortColumn(const QVector<KAEvent>&, int column, KeyType);
+}
+
+
+int main(int argc, char* argv[])
+{
+    QApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("Measures sorting of KAlarm's alarm list columns"));
+    parser.addHelpOption();
+    QCommandLineOption rowsOption(QStringLiteral("rows"),
+                                  QStringLiteral("Number of alarms to sort"),
+                                  QStringLiteral("rows"), QStringLiteral("100000"));
+    QCommandLineOption outputOption(QStringLiteral("output"),
+                                    QStringLiteral("File to write the JSON results to, instead of standard output"),
+                                    QStringLiteral("file"));
+    parser.addOption(rowsOption);
+    parser.addOption(outputOption);
+    parser.process(app);
+
+    bool ok;
+    const int rows = parser.value(rowsOption).toInt(&ok);
+    if (!ok  ||  rows <= 0)
+    {
+        qCCritical(KALARM_LOG) << "Invalid number of rows:" << parser.value(rowsOption);
+        return 1;
+    }
+
+    CalendarGenerator generator(KDateTime::currentDateTime(KSystemTimeZones::local()), 365);
+    const QVector<KAEvent> events = generator.generate(rows);
+    QJsonArray results;
+    for (int column = 0;  column < COLUMN_COUNT;  ++column)
+    {
+        results += sortColumn(events, column, NUMERIC_KEYS);
+        results += sortColumn(events, column, FORMER_KEYS);
+    }
+
+    const QByteArray json = QJsonDocument(results).toJson();
+    if (parser.isSet(outputOption))
+    {
+        QFile file(parser.value(outputOption));
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)
+        ||  file.write(json) != json.size())
+        {
+            qCCritical(KALARM_LOG) << "Error writing" << file.fileName();
+            return 1;
+        }
+    }
+    else
+        QTextStream(stdout) << json;
+    return 0;
+}
+
+
+namespace
+{
+
+/******************************************************************************
+* Return the SortRole value of an event for a column.
+*/
+QVariant sortKey(const KAEvent& event, int column, KeyType keyType)
+{
+    if (keyType == NUMERIC_KEYS)
+        return (column == TIME_COLUMN) ? AkonadiModel::timeSortKey(event) : AkonadiModel::repeatOrder(event);
+
+    if (column == TIME_COLUMN)
+    {
+        const DateTime due = event.expired() ? event.startDateTime() : event.nextTrigger(KAEvent::DISPLAY_TRIGGER);
+        return due.isValid() ? due.effectiveKDateTime().toUtc().dateTime()
+                             : QDateTime(QDate(9999,12,31), QTime(0,0,0));
+    }
+    const qint64 key = AkonadiModel::repeatOrder(event);
+    return QStringLiteral("%1%2").arg(static_cast<char>('0' + static_cast<int>(key >> 32)))
+                                 .arg(static_cast<quint32>(key), 8, 10, QLatin1Char('0'));
+}
+
+/******************************************************************************
+* Fill a model with the sort keys for a column, and sort it.
+*/
+QJsonObject sortColumn(const QVector<KAEvent>& events, int column, KeyType keyType)
+{
+    QElapsedTimer timer;
+    timer.start();
+    QStandardItemModel model(events.count(), COLUMN_COUNT);
+    for (int row = 0, end = events.count();  row < end;  ++row)
+        model.setData(model.index(row, column), sortKey(events[row], column, keyType), AkonadiModel::SortRole);
+    const qint64 fillMs = timer.elapsed();
+
+    QSortFilterProxyModel proxy;
+    proxy.setSortRole(AkonadiModel::SortRole);
+    proxy.setSourceModel(&model);
+    timer.start();
+    proxy.sort(column, Qt::AscendingOrder);
+    const qint64 ascendingMs = timer.elapsed();
+    timer.start();
+    proxy.sort(column, Qt::DescendingOrder);
+    const qint64 descendingMs = timer.elapsed();
+
+    QJsonObject result;
+    result[QStringLiteral("rows")] = events.count();
+    result[QStringLiteral("column")] = (column == TIME_COLUMN) ? QStringLiteral("time") : QStringLiteral("repeat");
+    result[QStringLiteral("keys")] = (keyType == NUMERIC_KEYS) ? QStringLiteral("numeric") : QStringLiteral("former");
+    result[QStringLiteral("fillMs")] = fillMs;
+    result[QStringLiteral("sortAscendingMs")] = ascendingMs;
+    result[QStringLiteral("sortDescendingMs")] = descendingMs;
+    return result;
+}
+
+}
+
+// vim: et sw=4:
@@ -0,0 +1,160 @@
+/*
+ *  calendargenerator.cpp  -  generates synthetic alarm calendars for benchmarks
+ *  Program:  kalarm
+ *  Copyright © 2017 by David Jarvie <djarvie@kde.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include "kalarm.h"
+#include "calendargenerator.h"
+
+#include <kalarmcal/kacalendar.h>
+#include <kalarmcal/repetition.h>
+
+#include <KCalCore/FileStorage>
+#include <KCalCore/MemoryCalendar>
+#include <ksystemtimezone.h>
+
+#include <QBitArray>
+#include <QColor>
+#include <QFont>
+#include "kalarm_debug.h"
+
+using namespace KCalCore;
+
+
+CalendarGenerator::CalendarGenerator(const KDateTime& base, int days, quint32 seed)
+    : mBase(base),
+      mDays(days > 0 ? days : 1),
+      mRandom(seed)
+{
+}
+
+/******************************************************************************
+* Return the next value of the pseudo-random sequence, in the range
+* 0 to limit - 1.
+*/
+quint32 CalendarGenerator::random(quint32 limit)
+{
+    mRandom = mRandom * 1103515245 + 12345;
+    return (mRandom >> 8) % limit;
+}
+
+/******************************************************************************
+* Generate 'count' active alarms, cycling through each kind of alarm in turn.
+*/
+QVector<KAEvent> CalendarGenerator::generate(int count)
+{
+    QVector<KAEvent> events;
+    events.reserve(count);
+    for (int i = 0;  i < count;  ++i)
+        events += createEvent(static_cast<AlarmKind>(i % KIND_COUNT), i);
+    return events;
+}
+
+/******************************************************************************
+* Create an alarm of the specified kind.
+* Timed alarms are spread over the generator's period, starting one hour
+* before the base time so that some alarms are already due.
+*/
+KAEvent CalendarGenerator::createEvent(AlarmKind kind, int index)
+{
+    const int periodMins = mDays * 1440;
+    const KDateTime dt = mBase.addSecs(static_cast<qint64>(random(periodMins + 60)) * 60 - 3600);
+    const QString text = QStringLiteral("Benchmark alarm %1 (%2)").arg(index).arg(kindName(kind));
+    const bool command = !random(4);    // a quarter of the alarms are command alarms
+    const KAEvent::SubAction action = command ? KAEvent::COMMAND : KAEvent::MESSAGE;
+    KAEvent::Flags flags = 0;
+    int lateCancel = 0;
+    switch (kind)
+    {
+        case WORK_TIME:    flags |= KAEvent::WORK_TIME_ONLY;  break;
+        case LATE_CANCEL:  lateCancel = 1 + random(60);  break;
+        case AT_LOGIN:     flags |= KAEvent::REPEAT_AT_LOGIN;  break;
+        default:  break;
+    }
+    KAEvent event(dt, (command ? QStringLiteral("true") : text), Qt::white, Qt::black, QFont(), action, lateCancel, flags, true);
+    event.setEventId(QStringLiteral("kalarm-benchmark-%1").arg(index));
+    event.setCategory(CalEvent::ACTIVE);
+    switch (kind)
+    {
+        case RECURRING:
+            if (random(2))
+            {
+                // Daily recurrence, with a sub-repetition every 10 minutes
+                event.setRecurDaily(1, QBitArray(7, true), -1, QDate());
+                event.setRepetition(Repetition(KCalCore::Duration(600), 2));
+            }
+            else
+                event.setRecurMinutely(15 + 15 * random(8), -1, KDateTime());
+            break;
+        case WORK_TIME:
+            event.setRecurMinutely(60, -1, KDateTime());
+            break;
+        case LATE_CANCEL:
+            if (random(2))
+                event.setRecurDaily(1, QBitArray(7, true), 10, QDate());
+            break;
+        case AT_LOGIN:
+            if (random(2))
+                event.setReminder(-30, false);   // reminder after the main alarm
+            break;
+        default:
+            break;
+    }
+    event.endChanges();
+    return event;
+}
+
+/******************************************************************************
+* Write alarms to a calendar file in KAlarm format.
+*/
+bool CalendarGenerator::writeCalendar(const QVector<KAEvent>& events, const QString& path)
+{
+    MemoryCalendar::Ptr calendar(new MemoryCalendar(KSystemTimeZones::local()));
+    KACalendar::setKAlarmVersion(calendar);
+    for (int i = 0, end = events.count();  i < end;  ++i)
+    {
+        Event::Ptr kcalEvent(new Event);
+        events[i].updateKCalEvent(kcalEvent, KAEvent::UID_SET);
+        calendar->addEvent(kcalEvent);
+    }
+    FileStorage::Ptr storage(new FileStorage(calendar, path));
+    if (!storage->save())
+    {
+        qCCritical(KALARM_LOG) << "Error writing calendar file" << path;
+        return false;
+    }
+    return true;
+}
+
+/******************************************************************************
+* Return the name of an alarm kind.
+*/
+QString CalendarGenerator::kindName(AlarmKind kind)
+{
+    switch (kind)
+    {
+        case ONE_SHOT:     return QStringLiteral("one-shot");
+        case RECURRING:    return QStringLiteral("recurring");
+        case WORK_TIME:    return QStringLiteral("work-time");
+        case LATE_CANCEL:  return QStringLiteral("late-cancel");
+        case AT_LOGIN:     return QStringLiteral("at-login");
+        default:           return QString();
+    }
+}
+
+// vim: et sw=4:
@@ -0,0 +1,78 @@
+/*
+ *  calendargenerator.h  -  generates synthetic alarm calendars for benchmarks
+ *  Program:  kalarm
+ *  Copyright © 2017 by David Jarvie <djarvie@kde.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#ifndef CALENDARGENERATOR_H
+#define CALENDARGENERATOR_H
+
+/* @file calendargenerator.h - generates synthetic alarm calendars for benchmarks */
+
+#include <kalarmcal/kaevent.h>
+
+#include <KDateTime>
+
+#include <QVector>
+
+using namespace KAlarmCal;
+
+
+/** CalendarGenerator creates a reproducible set of active alarms for use in
+ *  benchmarks, containing an equal mix of one-shot, recurring, working time
+ *  only, late-cancel and repeat-at-login alarms. Trigger times are spread
+ *  over a period starting shortly before the base time, so that some alarms
+ *  are already due.
+ */
+class CalendarGenerator
+{
+    public:
+        enum AlarmKind { ONE_SHOT, RECURRING, WORK_TIME, LATE_CANCEL, AT_LOGIN, KIND_COUNT };
+
+        /** Constructor.
+         *  @param base  Base time for the alarms' trigger times.
+         *  @param days  Number of days over which trigger times are spread.
+         *  @param seed  Seed for the pseudo-random sequence, so that the same
+         *               alarms are generated on each run.
+         */
+        explicit CalendarGenerator(const KDateTime& base, int days = 30, quint32 seed = 1);
+
+        /** Generate active alarms.
+         *  @param count  Number of alarms to generate.
+         */
+        QVector<KAEvent> generate(int count);
+
+        /** Write alarms to a calendar file in KAlarm format.
+         *  @return true if successful.
+         */
+        static bool writeCalendar(const QVector<KAEvent>& events, const QString& path);
+
+        /** Return the name of an alarm kind, for use in reports. */
+        static QString kindName(AlarmKind);
+
+    private:
+        KAEvent  createEvent(AlarmKind, int index);
+        quint32  random(quint32 limit);
+
+        KDateTime  mBase;
+        int        mDays;
+        quint32    mRandom;      // state of the pseudo-random sequence
+};
+
+#endif // CALENDARGENERATOR_H
+
+// vim: et sw=4:
@@ -25,6 +25,7 @@
 #include "kalarmdirsettings.h"
 #include "mainwindow.h"
 #include "messagebox.h"
+#include "startuptrace.h"
 
 #include <kalarmcal/collectionattribute.h>
 #include <kalarmcal/compatibilityattribute.h>
@@ -185,6 +186,8 @@ void CalendarMigrator::execute()
 void CalendarMigrator::migrateOrCreate()
 {
     qCDebug(KALARM_LOG);
+    // The span ends when AkonadiModel reports that migration has completed.
+    StartupTrace::begin(QStringLiteral("CalendarMigrator::migrateOrCreate"));
 
     // First, check whether any Akonadi resources already exist, and if
     // so, find their alarm types.
@@ -22,6 +22,7 @@
 #include "autoqpointer.h"
 #include "messagebox.h"
 #include "preferences.h"
+#include "startuptrace.h"
 
 #include <kalarmcal/collectionattribute.h>
 #include <kalarmcal/compatibilityattribute.h>
@@ -1246,6 +1247,22 @@ Collection::List CollectionControlModel::enabledCollections(CalEvent::Type type,
     return result;
 }
 
+/******************************************************************************
+* Return the IDs of the collections in KAlarm's list.
+* If the list has not been initialised yet, the IDs saved in the config file by
+* FavoriteCollectionsModel are returned.
+*/
+QList<Collection::Id> CollectionControlModel::collectionIds()
+{
+    if (!mInstance)
+        return KConfigGroup(KSharedConfig::openConfig(), "Collections").readEntry("FavoriteCollectionIds", QList<Collection::Id>());
+    QList<Collection::Id> ids;
+    const Collection::List cols = mInstance->collections();
+    for (int i = 0, count = cols.count();  i < count;  ++i)
+        ids += cols[i].id();
+    return ids;
+}
+
 /******************************************************************************
 * Return the collection ID for a given resource ID.
 */
@@ -1288,6 +1305,7 @@ bool CollectionControlModel::isPopulated(Collection::Id colId)
 bool CollectionControlModel::waitUntilPopulated(Collection::Id colId, int timeout)
 {
     qCDebug(KALARM_LOG);
+    StartupTrace::Span trace(QStringLiteral("CollectionControlModel::waitUntilPopulated"));
     int result = 1;
     AkonadiModel* model = AkonadiModel::instance();
     while (!model->isCollectionTreeFetched()
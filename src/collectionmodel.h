@@ -259,6 +259,12 @@ class CollectionControlModel : public Akonadi::FavoriteCollectionsModel
          */
         static Akonadi::Collection::List enabledCollections(CalEvent::Type, bool writable);
 
+        /** Return the IDs of the collections in KAlarm's list. Before the
+         *  collection list has been fetched from Akonadi, this returns the
+         *  list saved in the config file when KAlarm last ran.
+         */
+        static QList<Akonadi::Collection::Id> collectionIds();
+
         /** Return the collection ID for a given resource ID.
          *  @return  collection ID, or -1 if the resource is not in KAlarm's list.
          */
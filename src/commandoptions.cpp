@@ -203,6 +203,10 @@ QStringList CommandOptions::setOptions(QCommandLineParser* parser, const QString
               = new QCommandLineOption(QStringList() << QStringLiteral("t") << QStringLiteral("time"),
                                        i18n("Trigger alarm at time [[[yyyy-]mm-]dd-]hh:mm [TZ], or date yyyy-mm-dd [TZ]"),
                                        QStringLiteral("time"));
+    mOptions[TRACE]
+              = new QCommandLineOption(QStringLiteral("trace"),
+                                       i18n("Write the timing of start-up phases to a file, in Chrome trace format"),
+                                       QStringLiteral("file"));
     mOptions[OptTRAY]
               = new QCommandLineOption(QStringLiteral("tray"),
                                        i18n("Display system tray icon"));
@@ -410,6 +414,8 @@ void CommandOptions::process()
         if (!args.empty())
             mText = args[0];
     }
+    if (mParser->isSet(*mOptions[TRACE]))
+        mTraceFile = mParser->value(*mOptions[TRACE]);
     if (mParser->isSet(*mOptions[DISABLE_ALL]))
     {
         if (mCommand == TRIGGER_EVENT  ||  mCommand == LIST)
@@ -81,6 +81,7 @@ class CommandOptions
         uint                fromID() const            { return mFromID; }
         KAEvent::Flags      flags() const             { return mFlags; }
         bool                disableAll() const        { return mDisableAll; }
+        QString             traceFile() const         { return mTraceFile; }
         QString             outputText() const        { return mError; }
 #ifndef NDEBUG
         KDateTime           simulationTime() const    { return mSimulationTime; }
@@ -128,6 +129,7 @@ class CommandOptions
             TEST_SET_TIME,
 #endif
             TIME,
+            TRACE,
             OptTRAY,
             OptTRIGGER_EVENT,
             UNTIL,
@@ -177,6 +179,7 @@ class CommandOptions
         uint                mFromID;         // NEW: email sender ID
         KAEvent::Flags      mFlags;          // NEW: event flags
         bool                mDisableAll;     // disable all alarm monitoring
+        QString             mTraceFile;      // file to write start-up trace to
 #ifndef NDEBUG
         KDateTime           mSimulationTime; // system time to be simulated, or invalid if none
 #endif
@@ -2,3 +2,6 @@
 
 /* Define to 1 if you have the Xlib */
 #cmakedefine01 KDEPIM_HAVE_X11
+
+/* Define to 1 if you have <sys/timerfd.h> */
+#cmakedefine01 HAVE_SYS_TIMERFD_H
@@ -21,6 +21,7 @@
 #include "kalarm.h"
 
 #include "alarmcalendar.h"
+#include "alarmmetrics.h"
 #include "alarmtime.h"
 #include "functions.h"
 #include "kalarmapp.h"
@@ -74,6 +75,11 @@ QString DBusHandler::list()
     return theApp()->dbusList();
 }
 
+QString DBusHandler::metrics()
+{
+    return AlarmMetrics::instance()->report();
+}
+
 bool DBusHandler::scheduleMessage(const QString& message, const QString& startDateTime, int lateCancel, unsigned flags,
                                   const QString& bgColor, const QString& fgColor, const QString& font,
                                   const QString& audioUrl, int reminderMins, const QString& recurrence,
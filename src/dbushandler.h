@@ -43,6 +43,7 @@ class DBusHandler : public QObject, public KAlarmIface
         Q_SCRIPTABLE bool cancelEvent(const QString& eventId);
         Q_SCRIPTABLE bool triggerEvent(const QString& eventId);
         Q_SCRIPTABLE QString list();
+        Q_SCRIPTABLE QString metrics();
 
         Q_SCRIPTABLE bool scheduleMessage(const QString& message, const QString& startDateTime, int lateCancel, unsigned flags,
                                           const QString& bgColor, const QString& fgColor, const QString& font,
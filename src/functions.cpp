@@ -137,6 +137,13 @@ const QLatin1String KORGANIZER_UID("-korg");
 
 const QLatin1String ALARM_OPTS_FILE("alarmopts");
 const char*         DONT_SHOW_ERRORS_GROUP = "DontShowErrors";
+const int           DONT_SHOW_ERRORS_WRITE_DELAY = 2000;   // milliseconds to wait before writing changes
+const int           PURGE_CHUNK = 100;   // maximum number of archived alarms to purge at a time
+
+QString dontShowErrorsKey(const EventId& eventId)
+{
+    return QStringLiteral("%1:%2").arg(eventId.collectionId()).arg(eventId.eventId());
+}
 
 void editNewTemplate(EditAlarmDlg::Type, const KAEvent* preset, QWidget* parent);
 void displayUpdateError(QWidget* parent, KAlarm::UpdateError, const UpdateStatusData&, bool showKOrgError = true);
@@ -288,6 +295,7 @@ UpdateResult addEvents(QVector<KAEvent>& events, QWidget* msgParent, bool allowK
     if (status.status == UPDATE_OK)
     {
         AlarmCalendar* cal = AlarmCalendar::resources();
+        cal->startUpdate();    // batch the calendar updates
         for (int i = 0, end = events.count();  i < end;  ++i)
         {
             // Save the event details in the calendar file, and get the new event ID
@@ -303,6 +311,7 @@ UpdateResult addEvents(QVector<KAEvent>& events, QWidget* msgParent, bool allowK
             }
 
         }
+        cal->endUpdate();
         if (status.warnErr == events.count())
             status.status = UPDATE_FAILED;
         else if (!cal->save())
@@ -498,6 +507,7 @@ UpdateResult deleteEvents(QVector<KAEvent>& events, bool archive, QWidget* msgPa
     AlarmCalendar* cal = AlarmCalendar::resources();
     bool deleteWakeFromSuspendAlarm = false;
     QString wakeFromSuspendId = checkRtcWakeConfig().value(0);
+    cal->startUpdate();    // batch the calendar updates
     for (int i = 0, end = events.count();  i < end;  ++i)
     {
         // Save the event details in the calendar file, and get the new event ID
@@ -531,6 +541,7 @@ UpdateResult deleteEvents(QVector<KAEvent>& events, bool archive, QWidget* msgPa
         // Remove "Don't show error messages again" for this alarm
         setDontShowErrors(EventId(*event));
     }
+    cal->endUpdate();
 
     if (status.warnErr == events.count())
         status.status = UPDATE_FAILED;
@@ -557,6 +568,7 @@ UpdateResult deleteTemplates(const KAEvent::List& events, QWidget* msgParent)
         return UpdateResult(UPDATE_OK);
     UpdateStatusData status;
     AlarmCalendar* cal = AlarmCalendar::resources();
+    cal->startUpdate();    // batch the calendar updates
     for (int i = 0, end = count;  i < end;  ++i)
     {
         // Update the window lists
@@ -565,6 +577,7 @@ UpdateResult deleteTemplates(const KAEvent::List& events, QWidget* msgParent)
         if (!cal->deleteEvent(*events[i], false))   // don't save calendar after deleting
             status.setError(UPDATE_ERROR);
     }
+    cal->endUpdate();
 
     if (status.warnErr == count)
         status.status = UPDATE_FAILED;
@@ -620,6 +633,7 @@ UpdateResult reactivateEvents(QVector<KAEvent>& events, QVector<EventId>& inelig
         int count = 0;
         AlarmCalendar* cal = AlarmCalendar::resources();
         KDateTime now = KDateTime::currentUtcDateTime();
+        cal->startUpdate();    // batch the calendar updates
         for (int i = 0, end = events.count();  i < end;  ++i)
         {
             // Delete the event from the archived resource
@@ -658,6 +672,7 @@ UpdateResult reactivateEvents(QVector<KAEvent>& events, QVector<EventId>& inelig
                 status.setError(UPDATE_ERROR);
             events[i] = newevent;
         }
+        cal->endUpdate();
 
         if (status.warnErr == count)
             status.status = UPDATE_FAILED;
@@ -683,6 +698,7 @@ UpdateResult enableEvents(QVector<KAEvent>& events, bool enable, QWidget* msgPar
     AlarmCalendar* cal = AlarmCalendar::resources();
     bool deleteWakeFromSuspendAlarm = false;
     QString wakeFromSuspendId = checkRtcWakeConfig().value(0);
+    cal->startUpdate();    // batch the calendar updates
     for (int i = 0, end = events.count();  i < end;  ++i)
     {
         KAEvent* event = &events[i];
@@ -711,6 +727,7 @@ UpdateResult enableEvents(QVector<KAEvent>& events, bool enable, QWidget* msgPar
             }
         }
     }
+    cal->endUpdate();
 
     if (!cal->save())
         status.setError(SAVE_FAILED, events.count());
@@ -731,52 +748,20 @@ UpdateResult enableEvents(QVector<KAEvent>& events, bool enable, QWidget* msgPar
 * Purge all archived events from the default archived alarm resource whose end
 * time is longer ago than 'purgeDays'. All events are deleted if 'purgeDays' is
 * zero.
+* To avoid holding up other processing, only a limited number of events are
+* purged in each call.
+* Reply = true if more events remain to be purged.
 */
-void purgeArchive(int purgeDays)
+bool purgeArchive(int purgeDays)
 {
     if (purgeDays < 0)
-        return;
+        return false;
     qCDebug(KALARM_LOG) << purgeDays;
-    QDate cutoff = KDateTime::currentLocalDate().addDays(-purgeDays);
+    const QDate cutoff = purgeDays ? KDateTime::currentLocalDate().addDays(-purgeDays) : QDate();
     Collection collection = CollectionControlModel::getStandard(CalEvent::ARCHIVED);
     if (!collection.isValid())
-        return;
-    KAEvent::List events = AlarmCalendar::resources()->events(collection);
-    for (int i = 0;  i < events.count();  )
-    {
-        if (purgeDays  &&  events[i]->createdDateTime().date() >= cutoff)
-            events.remove(i);
-        else
-            ++i;
-    }
-    if (!events.isEmpty())
-        AlarmCalendar::resources()->purgeEvents(events);   // delete the events and save the calendar
-}
-
-/******************************************************************************
-* Display an error message about an error when saving an event.
-* If 'model' is non-null, the AlarmListModel* which it points to is used; if
-* that is null, it is created.
-*/
-QVector<KAEvent> getSortedActiveEvents(QObject* parent, AlarmListModel** model)
-{
-    AlarmListModel* mdl = nullptr;
-    if (!model)
-        model = &mdl;
-    if (!*model)
-    {
-        *model = new AlarmListModel(parent);
-        (*model)->setEventTypeFilter(CalEvent::ACTIVE);
-        (*model)->sort(AlarmListModel::TimeColumn);
-    }
-    QVector<KAEvent> result;
-    for (int i = 0, count = (*model)->rowCount();  i < count;  ++i)
-    {
-        KAEvent event = (*model)->event(i);
-        if (event.enabled()  &&  !event.expired())
-            result += event;
-    }
-    return result;
+        return false;
+    return AlarmCalendar::resources()->purgeArchivedEvents(collection.id(), cutoff, PURGE_CHUNK);
 }
 
 /******************************************************************************
@@ -1008,20 +993,21 @@ Desktop currentDesktopIdentity()
 */
 QStringList checkRtcWakeConfig(bool checkEventExists)
 {
-    KConfigGroup config(KSharedConfig::openConfig(), "General");
-    QStringList params = config.readEntry("RtcWake", QStringList());
-    if (params.count() == 3  &&  params[2].toUInt() > KDateTime::currentUtcDateTime().toTime_t())
-    {
-        if (checkEventExists  &&  !AlarmCalendar::getEvent(EventId(params[0].toLongLong(), params[1])))
-            return QStringList();
-        return params;                   // config entry is valid
-    }
-    if (!params.isEmpty())
-    {
-        config.deleteEntry("RtcWake");   // delete the expired config entry
-        config.sync();
-    }
-    return QStringList();
+    const QStringList params = Private::instance()->rtcWake();
+    if (!params.isEmpty()  &&  checkEventExists
+    &&  !AlarmCalendar::getEvent(EventId(params[0].toLongLong(), params[1])))
+        return QStringList();
+    return params;
+}
+
+/******************************************************************************
+* Set the wake-on-suspend alarm in the config.
+*/
+void setRtcWakeConfig(Akonadi::Collection::Id collectionId, const QString& eventId, unsigned triggerTime)
+{
+    QStringList params;
+    params << QString::number(collectionId) << eventId << QString::number(triggerTime);
+    Private::instance()->setRtcWake(params);
 }
 
 /******************************************************************************
@@ -1029,9 +1015,69 @@ QStringList checkRtcWakeConfig(bool checkEventExists)
 */
 void deleteRtcWakeConfig()
 {
+    Private::instance()->setRtcWake(QStringList());
+}
+
+/******************************************************************************
+* Return the wake-on-suspend config entry, reading it from the config file the
+* first time. If it has expired, it is deleted.
+*/
+QStringList Private::rtcWake()
+{
+    if (!mRtcWakeLoaded)
+    {
+        mRtcWakeLoaded = true;
+        KConfigGroup config(KSharedConfig::openConfig(), "General");
+        mRtcWake = config.readEntry("RtcWake", QStringList());
+        if (!mRtcWake.isEmpty())
+            checkRtcWakeExpiry();
+    }
+    return mRtcWake;
+}
+
+/******************************************************************************
+* Set or delete the wake-on-suspend config entry, and write it to the config
+* file.
+*/
+void Private::setRtcWake(const QStringList& params)
+{
+    mRtcWakeLoaded = true;
+    mRtcWake = params;
     KConfigGroup config(KSharedConfig::openConfig(), "General");
-    config.deleteEntry("RtcWake");
+    if (params.isEmpty())
+        config.deleteEntry("RtcWake");
+    else
+        config.writeEntry("RtcWake", params);
     config.sync();
+    checkRtcWakeExpiry();
+}
+
+/******************************************************************************
+* Delete the wake-on-suspend config entry if it has expired. Otherwise, set a
+* timer to check again when it is due to expire.
+*/
+void Private::checkRtcWakeExpiry()
+{
+    if (mRtcWakeTimer)
+        mRtcWakeTimer->stop();
+    if (mRtcWake.isEmpty())
+        return;
+    const unsigned now = KDateTime::currentUtcDateTime().toTime_t();
+    const unsigned triggerTime = (mRtcWake.count() == 3) ? mRtcWake[2].toUInt() : 0;
+    if (triggerTime <= now)
+    {
+        setRtcWake(QStringList());   // delete the expired config entry
+        return;
+    }
+    if (!mRtcWakeTimer)
+    {
+        mRtcWakeTimer = new QTimer(this);
+        mRtcWakeTimer->setSingleShot(true);
+        connect(mRtcWakeTimer, &QTimer::timeout, this, &Private::checkRtcWakeExpiry);
+    }
+    // Limit the interval to a day, to avoid timer overflow
+    const unsigned interval = qMin(triggerTime - now, 24u*3600u);
+    mRtcWakeTimer->start(interval * 1000);
 }
 
 /******************************************************************************
@@ -1528,10 +1574,7 @@ QStringList dontShowErrors(const EventId& eventId)
 {
     if (eventId.isEmpty())
         return QStringList();
-    KConfig config(QStandardPaths::writableLocation(QStandardPaths::DataLocation) + QLatin1Char('/') + ALARM_OPTS_FILE);
-    KConfigGroup group(&config, DONT_SHOW_ERRORS_GROUP);
-    const QString id = QStringLiteral("%1:%2").arg(eventId.collectionId()).arg(eventId.eventId());
-    return group.readEntry(id, QStringList());
+    return Private::instance()->dontShowErrors(dontShowErrorsKey(eventId));
 }
 
 /******************************************************************************
@@ -1554,14 +1597,7 @@ void setDontShowErrors(const EventId& eventId, const QStringList& tags)
 {
     if (eventId.isEmpty())
         return;
-    KConfig config(QStandardPaths::writableLocation(QStandardPaths::DataLocation) + QLatin1Char('/') + ALARM_OPTS_FILE);
-    KConfigGroup group(&config, DONT_SHOW_ERRORS_GROUP);
-    const QString id = QStringLiteral("%1:%2").arg(eventId.collectionId()).arg(eventId.eventId());
-    if (tags.isEmpty())
-        group.deleteEntry(id);
-    else
-        group.writeEntry(id, tags);
-    group.sync();
+    Private::instance()->setDontShowErrors(dontShowErrorsKey(eventId), tags);
 }
 
 /******************************************************************************
@@ -1572,16 +1608,99 @@ void setDontShowErrors(const EventId& eventId, const QString& tag)
 {
     if (eventId.isEmpty()  ||  tag.isEmpty())
         return;
-    KConfig config(QStandardPaths::writableLocation(QStandardPaths::DataLocation) + QLatin1Char('/') + ALARM_OPTS_FILE);
-    KConfigGroup group(&config, DONT_SHOW_ERRORS_GROUP);
-    const QString id = QStringLiteral("%1:%2").arg(eventId.collectionId()).arg(eventId.eventId());
-    QStringList tags = group.readEntry(id, QStringList());
+    const QString id = dontShowErrorsKey(eventId);
+    QStringList tags = Private::instance()->dontShowErrors(id);
     if (tags.indexOf(tag) < 0)
     {
         tags += tag;
-        group.writeEntry(id, tags);
-        group.sync();
+        Private::instance()->setDontShowErrors(id, tags);
+    }
+}
+
+/******************************************************************************
+* Return the cached Don't-show-again error message tags for an alarm ID.
+* The config file is read the first time this is called.
+*/
+QStringList Private::dontShowErrors(const QString& id)
+{
+    readDontShowErrors();
+    return mDontShowErrors.value(id);
+}
+
+/******************************************************************************
+* Set the cached Don't-show-again error message tags for an alarm ID, and
+* schedule the change to be written to the config file.
+*/
+void Private::setDontShowErrors(const QString& id, const QStringList& tags)
+{
+    readDontShowErrors();
+    QHash<QString, QStringList>::Iterator it = mDontShowErrors.find(id);
+    if (tags.isEmpty())
+    {
+        if (it == mDontShowErrors.end())
+            return;   // no change
+        mDontShowErrors.erase(it);
     }
+    else
+    {
+        if (it != mDontShowErrors.end()  &&  it.value() == tags)
+            return;   // no change
+        mDontShowErrors[id] = tags;
+    }
+    mDontShowErrorsChanged += id;
+    if (!mDontShowErrorsTimer)
+    {
+        mDontShowErrorsTimer = new QTimer(this);
+        mDontShowErrorsTimer->setSingleShot(true);
+        connect(mDontShowErrorsTimer, &QTimer::timeout, this, &Private::writeDontShowErrors);
+        // Ensure that pending changes are not lost at exit
+        connect(qApp, &QCoreApplication::aboutToQuit, this, &Private::writeDontShowErrors);
+    }
+    if (!mDontShowErrorsTimer->isActive())
+        mDontShowErrorsTimer->start(DONT_SHOW_ERRORS_WRITE_DELAY);
+}
+
+/******************************************************************************
+* Read the Don't-show-again error message tags for all alarms from the config
+* file, if not already done.
+*/
+void Private::readDontShowErrors()
+{
+    if (mDontShowErrorsLoaded)
+        return;
+    mDontShowErrorsLoaded = true;
+    KConfig config(QStandardPaths::writableLocation(QStandardPaths::DataLocation) + QLatin1Char('/') + ALARM_OPTS_FILE);
+    const KConfigGroup group(&config, DONT_SHOW_ERRORS_GROUP);
+    const QStringList ids = group.keyList();
+    for (int i = 0, end = ids.count();  i < end;  ++i)
+    {
+        const QStringList tags = group.readEntry(ids[i], QStringList());
+        if (!tags.isEmpty())
+            mDontShowErrors[ids[i]] = tags;
+    }
+}
+
+/******************************************************************************
+* Write any changed Don't-show-again error message tags to the config file.
+*/
+void Private::writeDontShowErrors()
+{
+    if (mDontShowErrorsTimer)
+        mDontShowErrorsTimer->stop();
+    if (mDontShowErrorsChanged.isEmpty())
+        return;
+    KConfig config(QStandardPaths::writableLocation(QStandardPaths::DataLocation) + QLatin1Char('/') + ALARM_OPTS_FILE);
+    KConfigGroup group(&config, DONT_SHOW_ERRORS_GROUP);
+    for (QSet<QString>::ConstIterator it = mDontShowErrorsChanged.constBegin();  it != mDontShowErrorsChanged.constEnd();  ++it)
+    {
+        QHash<QString, QStringList>::ConstIterator dit = mDontShowErrors.constFind(*it);
+        if (dit == mDontShowErrors.constEnd())
+            group.deleteEntry(*it);
+        else
+            group.writeEntry(*it, dit.value());
+    }
+    group.sync();
+    mDontShowErrorsChanged.clear();
 }
 
 /******************************************************************************
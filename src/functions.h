@@ -45,7 +45,6 @@ class QAction;
 class QAction;
 class KToggleAction;
 class MainWindow;
-class AlarmListModel;
 
 namespace KAlarm
 {
@@ -170,12 +169,12 @@ void                deleteDisplayEvent(const QString& eventID);
 UpdateResult        reactivateEvent(KAEvent&, Akonadi::Collection* = nullptr, QWidget* msgParent = nullptr, bool showKOrgErr = true);
 UpdateResult        reactivateEvents(QVector<KAEvent>&, QVector<EventId>& ineligibleIDs, Akonadi::Collection* = nullptr, QWidget* msgParent = nullptr, bool showKOrgErr = true);
 UpdateResult        enableEvents(QVector<KAEvent>&, bool enable, QWidget* msgParent = nullptr);
-QVector<KAEvent>    getSortedActiveEvents(QObject* parent, AlarmListModel** model = nullptr);
-void                purgeArchive(int purgeDays);    // must only be called from KAlarmApp::processQueue()
+bool                purgeArchive(int purgeDays);    // must only be called from KAlarmApp::processQueue()
 void                displayKOrgUpdateError(QWidget* parent, UpdateError, UpdateResult korgError, int nAlarms = 0);
 Desktop             currentDesktopIdentity();
 QString             currentDesktopIdentityName();
 QStringList         checkRtcWakeConfig(bool checkEventExists = false);
+void                setRtcWakeConfig(Akonadi::Collection::Id, const QString& eventId, unsigned triggerTime);
 void                deleteRtcWakeConfig();
 void                cancelRtcWake(QWidget* msgParent, const QString& eventId = QString());
 bool                setRtcWakeTime(unsigned triggerTime, QWidget* parent);
@@ -23,9 +23,13 @@
 
 #include "kalarm.h"   //krazy:exclude=includes (kalarm.h must be first)
 #include <kwindowsystem.h>
+#include <QHash>
 #include <QObject>
+#include <QSet>
+#include <QStringList>
 
 class EditAlarmDlg;
+class QTimer;
 
 namespace KAlarm
 {
@@ -35,7 +39,9 @@ class Private : public QObject
 {
         Q_OBJECT
     public:
-        explicit Private(QObject* parent = nullptr) : QObject(parent), mMsgParent(nullptr) {}
+        explicit Private(QObject* parent = nullptr)
+            : QObject(parent), mMsgParent(nullptr), mDontShowErrorsTimer(nullptr), mRtcWakeTimer(nullptr),
+              mDontShowErrorsLoaded(false), mRtcWakeLoaded(false) {}
         static bool startKMailMinimised();
         static Private* instance()
         {
@@ -44,14 +50,30 @@ class Private : public QObject
             return mInstance;
         }
 
+        QStringList dontShowErrors(const QString& id);
+        void        setDontShowErrors(const QString& id, const QStringList& tags);
+        QStringList rtcWake();
+        void        setRtcWake(const QStringList& params);
+
         QWidget* mMsgParent;
 
     public Q_SLOTS:
         void windowAdded(WId);
         void cancelRtcWake();
+        void writeDontShowErrors();
+        void checkRtcWakeExpiry();
 
     private:
+        void        readDontShowErrors();
+
         static Private* mInstance;
+        QHash<QString, QStringList> mDontShowErrors;   // cached contents of the don't-show-errors config group
+        QSet<QString>   mDontShowErrorsChanged;        // IDs in mDontShowErrors not yet written to the config file
+        QTimer*         mDontShowErrorsTimer;          // timer to write changes to the config file
+        QStringList     mRtcWake;                      // cached wake-from-suspend config entry
+        QTimer*         mRtcWakeTimer;                 // timer to delete mRtcWake when it expires
+        bool            mDontShowErrorsLoaded;         // mDontShowErrors has been read from the config file
+        bool            mRtcWakeLoaded;                // mRtcWake has been read from the config file
 };
 
 // Private class to handle Edit New Alarm dialog OK button.
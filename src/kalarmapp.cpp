@@ -23,7 +23,9 @@
 
 #include "alarmcalendar.h"
 #include "alarmlistview.h"
+#include "alarmmetrics.h"
 #include "alarmtime.h"
+#include "clocktimer.h"
 #include "commandoptions.h"
 #include "dbushandler.h"
 #include "editdlgtypes.h"
@@ -38,6 +40,7 @@
 #include "prefdlg.h"
 #include "shellprocess.h"
 #include "startdaytimer.h"
+#include "startuptrace.h"
 #include "traywindow.h"
 #include "kalarm_debug.h"
 
@@ -60,6 +63,7 @@
 #include <QObject>
 #include <QTimer>
 #include <QFile>
+#include <QLockFile>
 #include <QTextStream>
 #include <QTemporaryFile>
 #include <QtDBus/QtDBus>
@@ -73,18 +77,7 @@
 #include <climits>
 
 static const int AKONADI_TIMEOUT = 30;   // timeout (seconds) for Akonadi collections to be populated
-
-/******************************************************************************
-* Find the maximum number of seconds late which a late-cancel alarm is allowed
-* to be. This is calculated as the late cancel interval, plus a few seconds
-* leeway to cater for any timing irregularities.
-*/
-static inline int maxLateness(int lateCancel)
-{
-    static const int LATENESS_LEEWAY = 5;
-    int lc = (lateCancel >= 1) ? (lateCancel - 1)*60 : 0;
-    return LATENESS_LEEWAY + lc;
-}
+static const int EXECUTION_LOCK_RETRY_INTERVAL = 2000;   // interval (milliseconds) between attempts to acquire the execution lock
 
 
 KAlarmApp*  KAlarmApp::mInstance  = nullptr;
@@ -106,6 +99,8 @@ KAlarmApp::KAlarmApp(int& argc, char** argv)
       mDBusHandler(new DBusHandler()),
       mTrayWindow(nullptr),
       mAlarmTimer(nullptr),
+      mExecutionLock(nullptr),
+      mExecutionLockTimer(nullptr),
       mArchivedPurgeDays(-1),      // default to not purging
       mPurgeDaysQueued(-1),
       mPendingQuit(false),
@@ -114,6 +109,7 @@ KAlarmApp::KAlarmApp(int& argc, char** argv)
       mAlarmsEnabled(true)
 {
     qCDebug(KALARM_LOG);
+    StartupTrace::start();
     KAlarmMigrateApplication migrate;
     migrate.migrate();
 
@@ -208,11 +204,26 @@ KAlarmApp* KAlarmApp::create(int& argc, char** argv)
 */
 bool KAlarmApp::initialise()
 {
+    StartupTrace::Span trace(QStringLiteral("KAlarmApp::initialise"));
     if (!mAlarmTimer)
     {
-        mAlarmTimer = new QTimer(this);
-        mAlarmTimer->setSingleShot(true);
-        connect(mAlarmTimer, &QTimer::timeout, this, &KAlarmApp::checkNextDueAlarm);
+        mAlarmTimer = new ClockTimer(this);
+        connect(mAlarmTimer, &ClockTimer::timeout, this, &KAlarmApp::checkNextDueAlarm);
+    }
+    if (!mExecutionLock)
+    {
+        // Prevent the alarm daemon from executing alarms while KAlarm is
+        // running. The daemon only holds the lock while it processes due
+        // alarms, so if it is busy, keep trying without blocking.
+        mExecutionLock = AlarmScheduler::createExecutionLock();
+        if (!mExecutionLockTimer)
+        {
+            mExecutionLockTimer = new QTimer(this);
+            mExecutionLockTimer->setSingleShot(true);
+            mExecutionLockTimer->setInterval(EXECUTION_LOCK_RETRY_INTERVAL);
+            connect(mExecutionLockTimer, &QTimer::timeout, this, &KAlarmApp::acquireExecutionLock);
+        }
+        acquireExecutionLock();
     }
     if (!AlarmCalendar::resources())
     {
@@ -221,6 +232,8 @@ bool KAlarmApp::initialise()
         {
             connect(AlarmCalendar::resources(), &AlarmCalendar::earliestAlarmChanged, this, &KAlarmApp::checkNextDueAlarm);
             connect(AlarmCalendar::resources(), &AlarmCalendar::atLoginEventAdded, this, &KAlarmApp::atLoginEventAdded);
+            connect(AlarmCalendar::resources(), &AlarmCalendar::purgeChunkDone, this, &KAlarmApp::processQueue, Qt::QueuedConnection);
+            connect(AlarmCalendar::displayCalendar(), &AlarmCalendar::deferredSaveFailed, this, &KAlarmApp::slotDeferredSaveFailed);
             return true;
         }
     }
@@ -242,6 +255,7 @@ bool KAlarmApp::restoreSession()
 
     // Process is being restored by session management.
     qCDebug(KALARM_LOG) << "Restoring";
+    StartupTrace::Span trace(QStringLiteral("KAlarmApp::restoreSession"));
     ++mActiveCount;
     // Create the session config object now.
     // This is necessary since if initCheck() below causes calendars to be updated,
@@ -373,6 +387,8 @@ int KAlarmApp::activateInstance(const QStringList& args, const QString& workingD
         if (options->simulationTime().isValid())
             KAlarm::setSimulatedSystemTime(options->simulationTime());
 #endif
+        if (!options->traceFile().isEmpty())
+            StartupTrace::setFile(options->traceFile());
         command = options->command();
         if (options->disableAll())
             setAlarmsEnabled(false);   // disable alarm monitoring
@@ -720,6 +736,10 @@ bool KAlarmApp::quitIf(int exitCode, bool force)
     }
     delete mAlarmTimer;     // prevent checking for alarms after deleting calendars
     mAlarmTimer = nullptr;
+    if (mExecutionLockTimer)
+        mExecutionLockTimer->stop();
+    delete mExecutionLock;  // allow the alarm daemon to execute alarms
+    mExecutionLock = nullptr;
     mInitialised = false;   // prevent processQueue() from running
     AlarmCalendar::terminateCalendars();
     exit(exitCode);
@@ -817,68 +837,120 @@ void KAlarmApp::quitFatal()
     QTimer::singleShot(1000, this, &KAlarmApp::quitFatal);
 }
 
+/******************************************************************************
+* Try to acquire the lock which must be held to execute alarms. If the alarm
+* daemon holds it, try again later. Once it is acquired, process any alarms
+* which are due.
+*/
+void KAlarmApp::acquireExecutionLock()
+{
+    if (!mExecutionLock  ||  mExecutionLock->isLocked())
+        return;
+    if (!mExecutionLock->tryLock(0))
+    {
+        qCDebug(KALARM_LOG) << "Alarm execution lock is held by another process" << AlarmScheduler::executionLockPath();
+        mExecutionLockTimer->start();
+        return;
+    }
+    qCDebug(KALARM_LOG) << "Acquired alarm execution lock";
+    if (mInitialised)
+        QTimer::singleShot(0, this, &KAlarmApp::processQueue);
+}
+
+/******************************************************************************
+* Return whether this process holds the lock which must be held to execute
+* alarms.
+*/
+bool KAlarmApp::haveExecutionLock() const
+{
+    return mExecutionLock  &&  mExecutionLock->isLocked();
+}
+
 /******************************************************************************
 * Called by the alarm timer when the next alarm is due.
 * Also called when the execution queue has finished processing to check for the
 * next alarm.
+* Nothing is done until the execution lock is held, since otherwise the alarm
+* daemon could be executing the same alarms.
 */
 void KAlarmApp::checkNextDueAlarm()
 {
-    if (!mAlarmsEnabled)
+    if (!mAlarmsEnabled  ||  !haveExecutionLock())
         return;
     // Find the first alarm due
     KAEvent* nextEvent = AlarmCalendar::resources()->earliestAlarm();
     if (!nextEvent)
         return;   // there are no alarms pending
-    KDateTime nextDt = nextEvent->nextTrigger(KAEvent::ALL_TRIGGER).effectiveKDateTime();
+    KDateTime nextDt = AlarmCalendar::resources()->nextTrigger(*nextEvent, KAEvent::ALL_TRIGGER).effectiveKDateTime();
     KDateTime now = KDateTime::currentDateTime(Preferences::timeZone());
     qint64 interval = now.secsTo(nextDt);
     qCDebug(KALARM_LOG) << "now:" << qPrintable(now.toString(QStringLiteral("%Y-%m-%d %H:%M %:Z"))) << ", next:" << qPrintable(nextDt.toString(QStringLiteral("%Y-%m-%d %H:%M %:Z"))) << ", due:" << interval;
     if (interval <= 0)
     {
-        // Queue the alarm
-        queueAlarmId(*nextEvent);
-        qCDebug(KALARM_LOG) << nextEvent->id() << ": due now";
+        // Queue all alarms which are due, so that they are processed in a
+        // single pass of the execution queue.
+        // Note that 'interval' is rounded down to whole seconds, so the next
+        // alarm may still be up to a second in the future. Include it anyway,
+        // to avoid repeatedly rechecking until it becomes due.
+        const KAEvent::List events = AlarmCalendar::resources()->dueAlarms(qMax(nextDt, now));
+        int queued = 0;
+        for (int i = 0, end = events.count();  i < end;  ++i)
+        {
+            if (queueAlarmId(*events[i]))
+                ++queued;
+        }
+        AlarmMetrics::instance()->recordDispatch(queued);
+        qCDebug(KALARM_LOG) << queued << "alarms queued, first" << nextEvent->id();
         QTimer::singleShot(0, this, &KAlarmApp::processQueue);
     }
     else
     {
         // No alarm is due yet, so set timer to wake us when it's due.
-        // Check for integer overflow before setting timer.
-#ifndef HIBERNATION_SIGNAL
-        /* TODO: REPLACE THIS CODE WHEN A SYSTEM NOTIFICATION SIGNAL BECOMES
-         *       AVAILABLE FOR WAKEUP FROM HIBERNATION.
-         * Re-evaluate the next alarm time every minute, in case the
-         * system clock jumps. The most common case when the clock jumps
-         * is when a laptop wakes from hibernation. If timers were left to
-         * run, they would trigger late by the length of time the system
-         * was asleep.
-         */
-        if (interval > 60)    // 1 minute
-            interval = 60;
-#endif
-        interval *= 1000;
-        if (interval > INT_MAX)
-            interval = INT_MAX;
-        qCDebug(KALARM_LOG) << nextEvent->id() << "wait" << interval/1000 << "seconds";
-        mAlarmTimer->start(static_cast<int>(interval));
+        // The timer also wakes us if the system clock jumps, e.g. when a
+        // laptop wakes from hibernation, so that alarms don't trigger late
+        // by the length of time the system was asleep. If the system can't
+        // notify clock changes, the timer re-evaluates every minute instead.
+        qCDebug(KALARM_LOG) << nextEvent->id() << "wait" << interval << "seconds";
+        mAlarmTimer->start(QDateTime::currentDateTimeUtc().addSecs(interval));
     }
 }
 
 /******************************************************************************
-* Called by the alarm timer when the next alarm is due.
-* Also called when the execution queue has finished processing to check for the
-* next alarm.
+* Queue an alarm for handling, unless it is already queued.
+* Reply = true if the alarm was queued.
 */
-void KAlarmApp::queueAlarmId(const KAEvent& event)
+bool KAlarmApp::queueAlarmId(const KAEvent& event)
 {
     EventId id(event);
-    for (int i = 0, end = mActionQueue.count();  i < end;  ++i)
+    if (mActionQueueIds.contains(id))
+        return false;  // the alarm is already queued
+    enqueueAction(ActionQEntry(EVENT_HANDLE, id));
+    return true;
+}
+
+/******************************************************************************
+* Add an entry to the end of the execution queue.
+*/
+void KAlarmApp::enqueueAction(const ActionQEntry& entry)
+{
+    mActionQueue.enqueue(entry);
+    mActionQueue.last().queued.start();
+    if (entry.function == EVENT_HANDLE  &&  !entry.eventId.isEmpty())
+        ++mActionQueueIds[entry.eventId];
+}
+
+/******************************************************************************
+* Remove the entry at the head of the execution queue.
+*/
+void KAlarmApp::dequeueAction()
+{
+    const ActionQEntry entry = mActionQueue.dequeue();
+    if (entry.function == EVENT_HANDLE  &&  !entry.eventId.isEmpty())
     {
-        if (mActionQueue[i].function == EVENT_HANDLE  &&  mActionQueue[i].eventId == id)
-            return;  // the alarm is already queued
+        QHash<EventId, int>::Iterator it = mActionQueueIds.find(entry.eventId);
+        if (it != mActionQueueIds.end()  &&  --it.value() <= 0)
+            mActionQueueIds.erase(it);
     }
-    mActionQueue.enqueue(ActionQEntry(EVENT_HANDLE, id));
 }
 
 /******************************************************************************
@@ -904,10 +976,12 @@ void KAlarmApp::startProcessQueue()
 * operation. If a calendar file is opened or updated while another calendar
 * operation is in progress, the program has been observed to hang, or the first
 * calendar call has failed with data loss - clearly unacceptable!!
+* The queue is not processed until the execution lock is held, so that alarms
+* are never executed or rescheduled by both KAlarm and the alarm daemon.
 */
 void KAlarmApp::processQueue()
 {
-    if (mInitialised  &&  !mProcessingQueue)
+    if (mInitialised  &&  !mProcessingQueue  &&  haveExecutionLock())
     {
         qCDebug(KALARM_LOG);
         mProcessingQueue = true;
@@ -936,7 +1010,9 @@ void KAlarmApp::processQueue()
         // Process queued events
         while (!mActionQueue.isEmpty())
         {
-            ActionQEntry& entry = mActionQueue.head();
+            // Copy the entry, since processing it may add to the queue
+            ActionQEntry entry = mActionQueue.head();
+            AlarmMetrics::instance()->recordQueueWait(entry.queued.elapsed());
             if (entry.eventId.isEmpty())
             {
                 // It's a new alarm
@@ -954,16 +1030,24 @@ void KAlarmApp::processQueue()
             }
             else
                 handleEvent(entry.eventId, entry.function);
-            mActionQueue.dequeue();
+            dequeueAction();
         }
 
-        // Purge the default archived alarms resource if it's time to do so
-        if (mPurgeDaysQueued >= 0)
+        // Purge the default archived alarms resource if it's time to do so.
+        // A large purge is done in stages. Each stage is started once Akonadi
+        // has completed the deletions of the previous one.
+        if (mPurgeDaysQueued >= 0  &&  !AlarmCalendar::resources()->isPurging())
         {
-            KAlarm::purgeArchive(mPurgeDaysQueued);
-            mPurgeDaysQueued = -1;
+            if (!KAlarm::purgeArchive(mPurgeDaysQueued))
+                mPurgeDaysQueued = -1;
+            else if (!AlarmCalendar::resources()->isPurging())
+                QTimer::singleShot(0, this, &KAlarmApp::processQueue);   // no deletions were started
         }
 
+        // Write any deferred changes to the display calendar, now that there
+        // is nothing more to do for the time being.
+        AlarmCalendar::displayCalendar()->flush();
+
         // Now that the queue has been processed, quit if a quit was queued
         if (mPendingQuit)
         {
@@ -975,6 +1059,9 @@ void KAlarmApp::processQueue()
 
         // Schedule the application to be woken when the next alarm is due
         checkNextDueAlarm();
+
+        // Start-up is complete once the queue has first been processed
+        StartupTrace::finish();
     }
 }
 
@@ -991,7 +1078,7 @@ void KAlarmApp::atLoginEventAdded(const KAEvent& event)
     {
         if (mAlarmsEnabled)
         {
-            mActionQueue.enqueue(ActionQEntry(EVENT_HANDLE, EventId(ev)));
+            enqueueAction(ActionQEntry(EVENT_HANDLE, EventId(ev)));
             if (mInitialised)
                 QTimer::singleShot(0, this, &KAlarmApp::processQueue);
         }
@@ -1291,12 +1378,12 @@ void KAlarmApp::purge(int daysToKeep)
 */
 QStringList KAlarmApp::scheduledAlarmList()
 {
-    QVector<KAEvent> events = KAlarm::getSortedActiveEvents(this);
+    const KAEvent::List events = AlarmCalendar::resources()->upcomingAlarms();
     QStringList alarms;
     for (int i = 0, count = events.count();  i < count;  ++i)
     {
-        KAEvent* event = &events[i];
-        KDateTime dateTime = event->nextTrigger(KAEvent::DISPLAY_TRIGGER).effectiveKDateTime().toLocalZone();
+        const KAEvent* event = events[i];
+        KDateTime dateTime = AlarmCalendar::resources()->nextTrigger(*event, KAEvent::DISPLAY_TRIGGER).effectiveKDateTime().toLocalZone();
         Akonadi::Collection c(event->collectionId());
         AkonadiModel::instance()->refresh(c);
         QString text(c.resource() + QLatin1String(":"));
@@ -1404,8 +1491,8 @@ bool KAlarmApp::scheduleEvent(KAEvent::SubAction action, const QString& text, co
     {
         // Alarm is due for display already.
         // First execute it once without adding it to the calendar file.
-        if (!mInitialised)
-            mActionQueue.enqueue(ActionQEntry(event, EVENT_TRIGGER));
+        if (!mInitialised  ||  !haveExecutionLock())
+            enqueueAction(ActionQEntry(event, EVENT_TRIGGER));
         else
             execAlarm(event, event.firstAlarm(), false);
         // If it's a recurring alarm, reschedule it for its next occurrence
@@ -1416,7 +1503,7 @@ bool KAlarmApp::scheduleEvent(KAEvent::SubAction action, const QString& text, co
     }
 
     // Queue the alarm for insertion into the calendar file
-    mActionQueue.enqueue(ActionQEntry(event));
+    enqueueAction(ActionQEntry(event));
     if (mInitialised)
         QTimer::singleShot(0, this, &KAlarmApp::processQueue);
     return true;
@@ -1430,7 +1517,7 @@ bool KAlarmApp::scheduleEvent(KAEvent::SubAction action, const QString& text, co
 bool KAlarmApp::dbusHandleEvent(const EventId& eventID, EventFunc function)
 {
     qCDebug(KALARM_LOG) << eventID;
-    mActionQueue.append(ActionQEntry(function, eventID));
+    enqueueAction(ActionQEntry(function, eventID));
     if (mInitialised)
         QTimer::singleShot(0, this, &KAlarmApp::processQueue);
     return true;
@@ -1457,13 +1544,12 @@ QString KAlarmApp::dbusList()
 */
 bool KAlarmApp::handleEvent(const EventId& id, EventFunc function, bool checkDuplicates)
 {
-    // Delete any expired wake-on-suspend config data
-    KAlarm::checkRtcWakeConfig();
-
     const QString eventID(id.eventId());
     KAEvent* event = AlarmCalendar::resources()->event(id, checkDuplicates);
     if (!event)
     {
+        if (function == EVENT_HANDLE  &&  handleSnapshotEvent(id))
+            return true;
         if (id.collectionId() != -1)
             qCWarning(KALARM_LOG) << "Event ID not found, or duplicated:" << eventID;
         else
@@ -1482,179 +1568,36 @@ bool KAlarmApp::handleEvent(const EventId& id, EventFunc function, bool checkDup
         {
             KDateTime now = KDateTime::currentUtcDateTime();
             qCDebug(KALARM_LOG) << eventID << "," << (function==EVENT_TRIGGER?"TRIGGER:":"HANDLE:") << qPrintable(now.dateTime().toString(QStringLiteral("yyyy-MM-dd hh:mm"))) << "UTC";
-            bool updateCalAndDisplay = false;
-            bool alarmToExecuteValid = false;
+            bool updateCalAndDisplay;
             KAAlarm alarmToExecute;
-            bool restart = false;
-            // Check all the alarms in turn.
-            // Note that the main alarm is fetched before any other alarms.
-            for (KAAlarm alarm = event->firstAlarm();
-                 alarm.isValid();
-                 alarm = (restart ? event->firstAlarm() : event->nextAlarm(alarm)), restart = false)
-            {
-                // Check if the alarm is due yet.
-                KDateTime nextDT = alarm.dateTime(true).effectiveKDateTime();
-                int secs = nextDT.secsTo(now);
-                if (secs < 0)
-                {
-                    // The alarm appears to be in the future.
-                    // Check if it's an invalid local clock time during a daylight
-                    // saving time shift, which has actually passed.
-                    if (alarm.dateTime().timeSpec() != KDateTime::ClockTime
-                    ||  nextDT > now.toTimeSpec(KDateTime::ClockTime))
-                    {
-                        // This alarm is definitely not due yet
-                        qCDebug(KALARM_LOG) << "Alarm" << alarm.type() << "at" << nextDT.dateTime() << ": not due";
-                        continue;
-                    }
-                }
-                bool reschedule = false;
-                bool rescheduleWork = false;
-                if ((event->workTimeOnly() || event->holidaysExcluded())  &&  !alarm.deferred())
-                {
-                    // The alarm is restricted to working hours and/or non-holidays
-                    // (apart from deferrals). This needs to be re-evaluated every
-                    // time it triggers, since working hours could change.
-                    if (alarm.dateTime().isDateOnly())
-                    {
-                        KDateTime dt(nextDT);
-                        dt.setDateOnly(true);
-                        reschedule = !event->isWorkingTime(dt);
-                    }
-                    else
-                        reschedule = !event->isWorkingTime(nextDT);
-                    rescheduleWork = reschedule;
-                    if (reschedule)
-                        qCDebug(KALARM_LOG) << "Alarm" << alarm.type() << "at" << nextDT.dateTime() << ": not during working hours";
-                }
-                if (!reschedule  &&  alarm.repeatAtLogin())
-                {
-                    // Alarm is to be displayed at every login.
-                    qCDebug(KALARM_LOG) << "REPEAT_AT_LOGIN";
-                    // Check if the main alarm is already being displayed.
-                    // (We don't want to display both at the same time.)
-                    if (alarmToExecute.isValid())
-                        continue;
-
-                    // Set the time to display if it's a display alarm
-                    alarm.setTime(now);
-                }
-                if (!reschedule  &&  event->lateCancel())
-                {
-                    // Alarm is due, and it is to be cancelled if too late.
-                    qCDebug(KALARM_LOG) << "LATE_CANCEL";
-                    bool cancel = false;
-                    if (alarm.dateTime().isDateOnly())
-                    {
-                        // The alarm has no time, so cancel it if its date is too far past
-                        int maxlate = event->lateCancel() / 1440;    // maximum lateness in days
-                        KDateTime limit(DateTime(nextDT.addDays(maxlate + 1)).effectiveKDateTime());
-                        if (now >= limit)
-                        {
-                            // It's too late to display the scheduled occurrence.
-                            // Find the last previous occurrence of the alarm.
-                            DateTime next;
-                            KAEvent::OccurType type = event->previousOccurrence(now, next, true);
-                            switch (type & ~KAEvent::OCCURRENCE_REPEAT)
-                            {
-                                case KAEvent::FIRST_OR_ONLY_OCCURRENCE:
-                                case KAEvent::RECURRENCE_DATE:
-                                case KAEvent::RECURRENCE_DATE_TIME:
-                                case KAEvent::LAST_RECURRENCE:
-                                    limit.setDate(next.date().addDays(maxlate + 1));
-                                    if (now >= limit)
-                                    {
-                                        if (type == KAEvent::LAST_RECURRENCE
-                                        ||  (type == KAEvent::FIRST_OR_ONLY_OCCURRENCE && !event->recurs()))
-                                            cancel = true;   // last occurrence (and there are no repetitions)
-                                        else
-                                            reschedule = true;
-                                    }
-                                    break;
-                                case KAEvent::NO_OCCURRENCE:
-                                default:
-                                    reschedule = true;
-                                    break;
-                            }
-                        }
-                    }
-                    else
-                    {
-                        // The alarm is timed. Allow it to be the permitted amount late before cancelling it.
-                        int maxlate = maxLateness(event->lateCancel());
-                        if (secs > maxlate)
-                        {
-                            // It's over the maximum interval late.
-                            // Find the most recent occurrence of the alarm.
-                            DateTime next;
-                            KAEvent::OccurType type = event->previousOccurrence(now, next, true);
-                            switch (type & ~KAEvent::OCCURRENCE_REPEAT)
-                            {
-                                case KAEvent::FIRST_OR_ONLY_OCCURRENCE:
-                                case KAEvent::RECURRENCE_DATE:
-                                case KAEvent::RECURRENCE_DATE_TIME:
-                                case KAEvent::LAST_RECURRENCE:
-                                    if (next.effectiveKDateTime().secsTo(now) > maxlate)
-                                    {
-                                        if (type == KAEvent::LAST_RECURRENCE
-                                        ||  (type == KAEvent::FIRST_OR_ONLY_OCCURRENCE && !event->recurs()))
-                                            cancel = true;   // last occurrence (and there are no repetitions)
-                                        else
-                                            reschedule = true;
-                                    }
-                                    break;
-                                case KAEvent::NO_OCCURRENCE:
-                                default:
-                                    reschedule = true;
-                                    break;
-                            }
-                        }
-                    }
-
-                    if (cancel)
-                    {
-                        // All recurrences are finished, so cancel the event
-                        event->setArchive();
-                        if (cancelAlarm(*event, alarm.type(), false))
-                            return true;   // event has been deleted
-                        updateCalAndDisplay = true;
-                        continue;
-                    }
-                }
-                if (reschedule)
-                {
-                    // The latest repetition was too long ago, so schedule the next one
-                    switch (rescheduleAlarm(*event, alarm, false, (rescheduleWork ? nextDT : KDateTime())))
-                    {
-                        case 1:
-                            // A working-time-only alarm has been rescheduled and the
-                            // rescheduled time is already due. Start processing the
-                            // event again.
-                            alarmToExecuteValid = false;
-                            restart = true;
-                            break;
-                        case -1:
-                            return true;   // event has been deleted
-                        default:
-                            break;
-                    }
-                    updateCalAndDisplay = true;
-                    continue;
-                }
-                if (!alarmToExecuteValid)
-                {
-                    qCDebug(KALARM_LOG) << "Alarm" << alarm.type() << ": execute";
-                    alarmToExecute = alarm;             // note the alarm to be displayed
-                    alarmToExecuteValid = true;         // only trigger one alarm for the event
-                }
-                else
-                    qCDebug(KALARM_LOG) << "Alarm" << alarm.type() << ": skip";
-            }
+            if (!findDueAlarm(*event, now, alarmToExecute, updateCalAndDisplay))
+                return true;   // event has been deleted
 
             // If there is an alarm to execute, do this last after rescheduling/cancelling
             // any others. This ensures that the updated event is only saved once to the calendar.
-            if (alarmToExecute.isValid())
+            if (alarmToExecute.isValid()
+            &&  AlarmCalendar::resources()->snapshotAlarmExecuted(id, alarmToExecute.dateTime(true).effectiveKDateTime()))
+            {
+                // The alarm was already executed at start-up, before Akonadi
+                // provided the event, so just reschedule it.
+                qCDebug(KALARM_LOG) << eventID << ": already executed from snapshot";
+                rescheduleAlarm(*event, alarmToExecute, true);
+            }
+            else if (alarmToExecute.isValid())
+            {
+                // Record how late the alarm is, and how long it takes to execute.
+                AlarmMetrics* metrics = AlarmMetrics::instance();
+                const KAAlarm::Action action = alarmToExecute.action();
+                if (!alarmToExecute.repeatAtLogin())
+                {
+                    const KDateTime due = alarmToExecute.dateTime(true).effectiveKDateTime().toUtc();
+                    metrics->recordLatency(action, due.dateTime().msecsTo(now.dateTime()));
+                }
+                QElapsedTimer timer;
+                timer.start();
                 execAlarm(*event, alarmToExecute, true, !alarmToExecute.repeatAtLogin());
+                metrics->recordExecution(action, timer.elapsed());
+            }
             else
             {
                 if (function == EVENT_TRIGGER)
@@ -1676,6 +1619,51 @@ bool KAlarmApp::handleEvent(const EventId& id, EventFunc function, bool checkDup
     return true;
 }
 
+/******************************************************************************
+* Handle an alarm which is due, and which has been loaded from the snapshot of
+* active alarms because Akonadi has not yet provided its calendar.
+* The alarm is executed, but not rescheduled: that is done once Akonadi
+* provides the event. Alarms whose processing depends on the calendar being
+* up to date are left until then.
+* Reply = false if the event was not found in the snapshot.
+*/
+bool KAlarmApp::handleSnapshotEvent(const EventId& id)
+{
+    AlarmCalendar* cal = AlarmCalendar::resources();
+    const KAEvent* snapshotEvent = cal->snapshotEvent(id);
+    if (!snapshotEvent)
+        return false;
+    KAEvent event(*snapshotEvent);   // the snapshot instance is deleted below
+    const KDateTime now = KDateTime::currentUtcDateTime();
+    KAAlarm alarm;
+    for (alarm = event.firstAlarm();  alarm.isValid();  alarm = event.nextAlarm(alarm))
+    {
+        if (!alarm.repeatAtLogin()  &&  alarm.dateTime(true).effectiveKDateTime() <= now)
+            break;
+    }
+    if (!alarm.isValid())
+    {
+        // No alarm can be executed (e.g. only an at-login alarm is due).
+        // Don't keep trying to process the event.
+        cal->setSnapshotEventHandled(id);
+        return true;
+    }
+    const KDateTime due = alarm.dateTime(true).effectiveKDateTime();
+    if (event.workTimeOnly()  ||  event.holidaysExcluded()
+    ||  (event.lateCancel()  &&  (alarm.dateTime().isDateOnly() || due.secsTo(now) > maxLateness(event.lateCancel()))))
+    {
+        // Leave the alarm to be handled when Akonadi provides the event
+        qCDebug(KALARM_LOG) << id.eventId() << ": deferred until calendar is populated";
+        cal->setSnapshotEventHandled(id);
+        return true;
+    }
+    qCDebug(KALARM_LOG) << id.eventId() << ": executing from snapshot";
+    cal->setSnapshotEventHandled(id, due);
+    AlarmMetrics::instance()->recordLatency(alarm.action(), due.toUtc().dateTime().msecsTo(now.dateTime()));
+    execAlarm(event, alarm, false, false);
+    return true;
+}
+
 /******************************************************************************
 * Called when an alarm action has completed, to perform any post-alarm actions.
 */
@@ -1692,165 +1680,51 @@ void KAlarmApp::alarmCompleted(const KAEvent& event)
 }
 
 /******************************************************************************
-* Reschedule the alarm for its next recurrence after now. If none remain,
-* delete it.  If the alarm is deleted and it is the last alarm for its event,
-* the event is removed from the calendar file and from every main window
-* instance.
-* If 'nextDt' is valid, the event is rescheduled for the next non-working
-* time occurrence after that.
-* Reply = 1 if 'nextDt' is valid and the rescheduled event is already due
-*       = -1 if the event has been deleted
-*       = 0 otherwise.
+* Update an event which has been changed by the alarm scheduler, in the window
+* lists and calendar file.
 */
-int KAlarmApp::rescheduleAlarm(KAEvent& event, const KAAlarm& alarm, bool updateCalAndDisplay, const KDateTime& nextDt)
+void KAlarmApp::updateEvent(KAEvent& event)
 {
-    qCDebug(KALARM_LOG) << "Alarm type:" << alarm.type();
-    int reply = 0;
-    bool update = false;
-    event.startChanges();
-    if (alarm.repeatAtLogin())
-    {
-        // Leave an alarm which repeats at every login until its main alarm triggers
-        if (!event.reminderActive()  &&  event.reminderMinutes() < 0)
-        {
-            // Executing an at-login alarm: first schedule the reminder
-            // which occurs AFTER the main alarm.
-            event.activateReminderAfter(KDateTime::currentUtcDateTime());
-            update = true;
-        }
-    }
-    else if (alarm.isReminder()  ||  alarm.deferred())
-    {
-        // It's a reminder alarm or an extra deferred alarm, so delete it
-        event.removeExpiredAlarm(alarm.type());
-        update = true;
-    }
-    else
-    {
-        // Reschedule the alarm for its next occurrence.
-        bool cancelled = false;
-        DateTime last = event.mainDateTime(false);   // note this trigger time
-        if (last != event.mainDateTime(true))
-            last = DateTime();                       // but ignore sub-repetition triggers
-        bool next = nextDt.isValid();
-        KDateTime next_dt = nextDt;
-        KDateTime now = KDateTime::currentUtcDateTime();
-        do
-        {
-            KAEvent::OccurType type = event.setNextOccurrence(next ? next_dt : now);
-            switch (type)
-            {
-                case KAEvent::NO_OCCURRENCE:
-                    // All repetitions are finished, so cancel the event
-                    qCDebug(KALARM_LOG) << "No occurrence";
-                    if (event.reminderMinutes() < 0  &&  last.isValid()
-                    &&  alarm.type() != KAAlarm::AT_LOGIN_ALARM  &&  !event.mainExpired())
-                    {
-                        // Set the reminder which is now due after the last main alarm trigger.
-                        // Note that at-login reminders are scheduled in execAlarm().
-                        event.activateReminderAfter(last);
-                        updateCalAndDisplay = true;
-                    }
-                    if (cancelAlarm(event, alarm.type(), updateCalAndDisplay))
-                        return -1;
-                    break;
-                default:
-                    if (!(type & KAEvent::OCCURRENCE_REPEAT))
-                        break;
-                    // Next occurrence is a repeat, so fall through to recurrence handling
-                case KAEvent::RECURRENCE_DATE:
-                case KAEvent::RECURRENCE_DATE_TIME:
-                case KAEvent::LAST_RECURRENCE:
-                    // The event is due by now and repetitions still remain, so rewrite the event
-                    if (updateCalAndDisplay)
-                        update = true;
-                    break;
-                case KAEvent::FIRST_OR_ONLY_OCCURRENCE:
-                    // The first occurrence is still due?!?, so don't do anything
-                    break;
-            }
-            if (cancelled)
-                break;
-            if (event.deferred())
-            {
-                // Just in case there's also a deferred alarm, ensure it's removed
-                event.removeExpiredAlarm(KAAlarm::DEFERRED_ALARM);
-                update = true;
-            }
-            if (next)
-            {
-                // The alarm is restricted to working hours and/or non-holidays.
-                // Check if the calculated next time is valid.
-                next_dt = event.mainDateTime(true).effectiveKDateTime();
-                if (event.mainDateTime(false).isDateOnly())
-                {
-                    KDateTime dt(next_dt);
-                    dt.setDateOnly(true);
-                    next = !event.isWorkingTime(dt);
-                }
-                else
-                    next = !event.isWorkingTime(next_dt);
-            }
-        } while (next && next_dt <= now);
-        reply = (!cancelled && next_dt.isValid() && (next_dt <= now)) ? 1 : 0;
+    KAlarm::updateEvent(event);
+}
 
-        if (event.reminderMinutes() < 0  &&  last.isValid()
-        &&  alarm.type() != KAAlarm::AT_LOGIN_ALARM)
-        {
-            // Set the reminder which is now due after the last main alarm trigger.
-            // Note that at-login reminders are scheduled in execAlarm().
-            event.activateReminderAfter(last);
-        }
-    }
-    event.endChanges();
-    if (update)
-        KAlarm::updateEvent(event);     // update the window lists and calendar file
-    return reply;
+/******************************************************************************
+* Delete an event which has no more alarms, from the calendar file and from
+* every main window instance.
+*/
+void KAlarmApp::deleteEvent(KAEvent& event)
+{
+    // If it's a command alarm being executed, mark it as deleted
+    ProcData* pd = findCommandProcess(event.id());
+    if (pd)
+        pd->eventDeleted = true;
+
+    KAlarm::deleteEvent(event, false);
 }
 
 /******************************************************************************
-* Delete the alarm. If it is the last alarm for its event, the event is removed
-* from the calendar file and from every main window instance.
-* Reply = true if event has been deleted.
+* Save an event which is about to be deleted in the archived resources.
 */
-bool KAlarmApp::cancelAlarm(KAEvent& event, KAAlarm::Type alarmType, bool updateCalAndDisplay)
+void KAlarmApp::archiveEvent(const KAEvent& event)
 {
-    qCDebug(KALARM_LOG);
-    if (alarmType == KAAlarm::MAIN_ALARM  &&  !event.displaying()  &&  event.toBeArchived())
-    {
-        // The event is being deleted. Save it in the archived resources first.
-        KAEvent ev(event);
-        KAlarm::addArchivedEvent(ev);
-    }
-    event.removeExpiredAlarm(alarmType);
-    if (!event.alarmCount())
-    {
-        // If it's a command alarm being executed, mark it as deleted
-        ProcData* pd = findCommandProcess(event.id());
-        if (pd)
-            pd->eventDeleted = true;
+    KAEvent ev(event);
+    KAlarm::addArchivedEvent(ev);
+}
 
-        // Delete it
-        KAlarm::deleteEvent(event, false);
-        return true;
-    }
-    if (updateCalAndDisplay)
-        KAlarm::updateEvent(event);    // update the window lists and calendar file
-    return false;
+/******************************************************************************
+* Called when an alarm has been cancelled because it is too late.
+*/
+void KAlarmApp::alarmCancelledLate(const KAEvent&)
+{
+    AlarmMetrics::instance()->countLateCancel();
 }
 
 /******************************************************************************
-* Cancel any reminder or deferred alarms in an repeat-at-login event.
-* This should be called when the event is first loaded.
-* If there are no more alarms left in the event, the event is removed from the
-* calendar file and from every main window instance.
-* Reply = true if event has been deleted.
+* Called when an alarm has been rescheduled without being executed.
 */
-bool KAlarmApp::cancelReminderAndDeferral(KAEvent& event)
+void KAlarmApp::alarmRescheduled(const KAEvent&)
 {
-    return cancelAlarm(event, KAAlarm::REMINDER_ALARM, false)
-       ||  cancelAlarm(event, KAAlarm::DEFERRED_REMINDER_ALARM, false)
-       ||  cancelAlarm(event, KAAlarm::DEFERRED_ALARM, true);
+    AlarmMetrics::instance()->countRescheduled();
 }
 
 /******************************************************************************
@@ -2246,6 +2120,17 @@ QString KAlarmApp::createTempScriptFile(const QString& command, bool insertShell
     return QString();
 }
 
+/******************************************************************************
+* Called when a deferred write of the display calendar has failed. The user has
+* already been shown the error. The changes remain pending, and the write will
+* be retried the next time the execution queue becomes idle.
+*/
+void KAlarmApp::slotDeferredSaveFailed(AlarmCalendar* cal)
+{
+    qCWarning(KALARM_LOG) << "Deferred calendar save failed:" << cal->path();
+    AlarmMetrics::instance()->countSaveFailure();
+}
+
 /******************************************************************************
 * Called when a command alarm's execution completes.
 */
@@ -2403,6 +2288,9 @@ bool KAlarmApp::initCheck(bool calendarOnly, bool waitForCollection, Akonadi::Co
     {
         setArchivePurgeDays();
 
+        // Read the wake-on-suspend config data, and delete it if expired
+        KAlarm::checkRtcWakeConfig();
+
         // Warn the user if there are no writable active alarm calendars
         checkWritableCalendar();
 
@@ -23,6 +23,7 @@
 
 /** @file kalarmapp.h - the KAlarm application object */
 
+#include "alarmscheduler.h"
 #include "eventid.h"
 #include "kamail.h"
 #include "preferences.h"
@@ -30,6 +31,8 @@
 #include <kalarmcal/kaevent.h>
 
 #include <QApplication>
+#include <QElapsedTimer>
+#include <QHash>
 #include <QPointer>
 #include <QQueue>
 #include <QList>
@@ -37,6 +40,10 @@
 class KDateTime;
 namespace KCal { class Event; }
 namespace Akonadi { class Collection; }
+class QLockFile;
+class QTimer;
+class AlarmCalendar;
+class ClockTimer;
 class DBusHandler;
 class MainWindow;
 class TrayWindow;
@@ -45,7 +52,7 @@ class ShellProcess;
 using namespace KAlarmCal;
 
 
-class KAlarmApp : public QApplication
+class KAlarmApp : public QApplication, private AlarmScheduler
 {
         Q_OBJECT
     public:
@@ -117,6 +124,7 @@ class KAlarmApp : public QApplication
     private Q_SLOTS:
         void               quitFatal();
         void               checkNextDueAlarm();
+        void               acquireExecutionLock();
         void               checkKtimezoned();
         void               slotShowInSystemTrayChanged();
         void               changeStartOfDay();
@@ -129,6 +137,7 @@ class KAlarmApp : public QApplication
         void               slotPurge()                     { purge(mArchivedPurgeDays); }
         void               purgeAfterDelay();
         void               slotCommandExited(ShellProcess*);
+        void               slotDeferredSaveFailed(AlarmCalendar*);
 
     private:
         enum EventFunc
@@ -163,9 +172,10 @@ class KAlarmApp : public QApplication
             ActionQEntry(EventFunc f, const EventId& id) : function(f), eventId(id) { }
             ActionQEntry(const KAEvent& e, EventFunc f = EVENT_HANDLE) : function(f), event(e) { }
             ActionQEntry() { }
-            EventFunc  function;
-            EventId    eventId;
-            KAEvent    event;
+            EventFunc      function;
+            EventId        eventId;
+            KAEvent        event;     // new alarm, if eventId is empty
+            QElapsedTimer  queued;    // time since the entry was queued
         };
 
         KAlarmApp(int& argc, char** argv);
@@ -173,15 +183,21 @@ class KAlarmApp : public QApplication
         int                activateInstance(const QStringList& args, const QString& workingDirectory, QString* outputText);
         bool               initCheck(bool calendarOnly = false, bool waitForCollection = false, Akonadi::Collection::Id = -1);
         bool               quitIf(int exitCode, bool force = false);
+        bool               haveExecutionLock() const;
         bool               checkSystemTray();
         void               startProcessQueue();
-        void               queueAlarmId(const KAEvent&);
+        bool               queueAlarmId(const KAEvent&);
+        void               enqueueAction(const ActionQEntry&);
+        void               dequeueAction();
         bool               dbusHandleEvent(const EventId&, EventFunc);
         bool               handleEvent(const EventId&, EventFunc, bool checkDuplicates = false);
-        int                rescheduleAlarm(KAEvent&, const KAAlarm&, bool updateCalAndDisplay,
-                                           const KDateTime& nextDt = KDateTime());
-        bool               cancelAlarm(KAEvent&, KAAlarm::Type, bool updateCalAndDisplay);
-        bool               cancelReminderAndDeferral(KAEvent&);
+        bool               handleSnapshotEvent(const EventId&);
+        using AlarmScheduler::rescheduleAlarm;
+        void               updateEvent(KAEvent&) Q_DECL_OVERRIDE;
+        void               deleteEvent(KAEvent&) Q_DECL_OVERRIDE;
+        void               archiveEvent(const KAEvent&) Q_DECL_OVERRIDE;
+        void               alarmCancelledLate(const KAEvent&) Q_DECL_OVERRIDE;
+        void               alarmRescheduled(const KAEvent&) Q_DECL_OVERRIDE;
         ShellProcess*      doShellCommand(const QString& command, const KAEvent&, const KAAlarm*,
                                           int flags = 0, const QObject* receiver = nullptr, const char* slot = nullptr);
         QString            composeXTermCommand(const QString& command, const KAEvent&, const KAAlarm*,
@@ -206,12 +222,15 @@ class KAlarmApp : public QApplication
         QString            mActivateArg0;        // activate()'s first arg the first time it was called
         DBusHandler*       mDBusHandler;         // the parent of the main DCOP receiver object
         TrayWindow*        mTrayWindow;          // active system tray icon
-        QTimer*            mAlarmTimer;          // activates KAlarm when next alarm is due
+        ClockTimer*        mAlarmTimer;          // activates KAlarm when next alarm is due
+        QLockFile*         mExecutionLock;       // prevents the alarm daemon executing alarms
+        QTimer*            mExecutionLockTimer;  // retries acquiring the execution lock
         QColor             mPrefsArchivedColour; // archived alarms text colour
         int                mArchivedPurgeDays;   // how long to keep archived alarms, 0 = don't keep, -1 = keep indefinitely
         int                mPurgeDaysQueued;     // >= 0 to purge the archive calendar from KAlarmApp::processLoop()
         QList<ProcData*>   mCommandProcesses;    // currently active command alarm processes
         QQueue<ActionQEntry> mActionQueue;       // queued commands and actions
+        QHash<EventId, int>  mActionQueueIds;    // number of EVENT_HANDLE entries in mActionQueue for each event ID
         int                mPendingQuitCode;     // exit code for a pending quit
         bool               mPendingQuit;         // quit once the DCOP command and shell command queues have been processed
         bool               mCancelRtcWake;       // cancel RTC wake on quitting
@@ -0,0 +1,132 @@
+/*
+ *  kalarmd.cpp  -  alarm daemon without a user interface
+ *  Program:  kalarm
+ *  Copyright © 2017 by David Jarvie <djarvie@kde.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include "kalarm.h"
+
+#include "alarmengine.h"
+#include "alarmnotifier.h"
+#include "kalocale.h"
+
+#include <KAboutData>
+#include <KConfigGroup>
+#include <KEMailSettings>
+#include <KLocalizedString>
+#include <KSharedConfig>
+#include <KHolidays/HolidayRegion>
+
+#include <KDateTime>
+#include <ksystemtimezone.h>
+
+#include <QBitArray>
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QScopedPointer>
+
+#define PROGRAM_NAME "kalarmd"
+
+namespace
+{
+
+/******************************************************************************
+* Return an email address from the KAlarm configuration, translating the
+* special values used to refer to other settings.
+* KMail identities are not available without a user interface, so the System
+* Settings address is used instead of the default identity.
+*/
+QString configEmailAddress(const KConfigGroup& config, const char* key)
+{
+    const QString address = config.readEntry(key, QStringLiteral("@SystemSettings"));
+    if (address == QLatin1String("@SystemSettings")  ||  address == QLatin1String("@KMail"))
+        return KEMailSettings().getSetting(KEMailSettings::EmailAddress);
+    return address;
+}
+
+/******************************************************************************
+* Apply the KAlarm application's calendar, time zone, working time, holiday,
+* start of day, archiving and email settings, so that alarms are triggered in
+* the same way as by KAlarm.
+* Reply = holiday region, which must exist while the engine runs. Ownership is
+*         passed to the caller.
+*/
+KHolidays::HolidayRegion* readConfig(AlarmEngine& engine)
+{
+    const KSharedConfig::Ptr kalarmrc = KSharedConfig::openConfig(QStringLiteral("kalarmrc"));
+    engine.setCollections(KConfigGroup(kalarmrc, "Collections").readEntry("FavoriteCollectionIds", QList<Akonadi::Collection::Id>()));
+    const KConfigGroup config(kalarmrc, "General");
+    const QString timeZone = config.readEntry("TimeZone", QString());
+    engine.setTimeZone(timeZone.isEmpty() ? KTimeZone() : KSystemTimeZones::zone(timeZone));
+    engine.setArchivedKeepDays(config.readEntry("ExpiredKeepDays", 7));
+    const unsigned days = config.readEntry("WorkDays", KAlarm::defaultWorkDays());
+    QBitArray dayBits(7);
+    for (int i = 0;  i < 7;  ++i)
+        dayBits.setBit(i, days & (1 << i));
+    const QDate base(1900,1,1);
+    KAEvent::setWorkTime(dayBits,
+                         config.readEntry("WorkDayStart", QDateTime(base, QTime(8,0))).time(),
+                         config.readEntry("WorkDayEnd", QDateTime(base, QTime(17,0))).time());
+    KAEvent::setStartOfDay(config.readEntry("StartOfDay", QDateTime(base, QTime(0,0))).time());
+    KHolidays::HolidayRegion* holidays = new KHolidays::HolidayRegion(config.readEntry("HolidayRegion", QString()));
+    KAEvent::setHolidays(*holidays);
+    engine.setEmailAddresses(configEmailAddress(config, "EmailFrom"),
+                             configEmailAddress(config, "EmailBccAddress"));
+    return holidays;
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    KLocalizedString::setApplicationDomain("kalarm");
+    KAboutData aboutData(QStringLiteral(PROGRAM_NAME), i18n("KAlarm Daemon"),
+                         QStringLiteral(KALARM_VERSION),
+                         i18n("Command and email alarm scheduler without a user interface"),
+                         KAboutLicense::GPL,
+                         ki18n("Copyright 2001-%1, David Jarvie").subs(2017).toString(), QString(),
+                         QStringLiteral("http://www.astrojar.org.uk/kalarm"));
+    aboutData.addAuthor(i18n("David Jarvie"), i18n("Author"), QStringLiteral("djarvie@kde.org"));
+    aboutData.setOrganizationDomain("kde.org");
+    KAboutData::setApplicationData(aboutData);
+
+    QCommandLineParser parser;
+    aboutData.setupCommandLine(&parser);
+    parser.setApplicationDescription(aboutData.shortDescription());
+    QCommandLineOption notifyOption(QStringLiteral("notify"),
+                                    i18n("Command to execute for display and audio alarms. Details of the alarm are passed in the environment variables KALARM_UID, KALARM_ACTION and KALARM_TEXT. If omitted, these alarms are written to standard output."),
+                                    QStringLiteral("command"));
+    parser.addOption(notifyOption);
+    parser.process(app);
+    aboutData.processCommandLine(&parser);
+
+    QScopedPointer<AlarmNotifier> notifier;
+    if (parser.isSet(notifyOption))
+        notifier.reset(new CommandNotifier(parser.value(notifyOption)));
+    else
+        notifier.reset(new LogNotifier);
+
+    AlarmEngine engine(notifier.data());
+    QScopedPointer<KHolidays::HolidayRegion> holidays(readConfig(engine));
+    engine.start();
+    return app.exec();
+}
+
+// vim: et sw=4:
@@ -0,0 +1,195 @@
+/*
+ *  clocktimer.cpp  -  timer which expires at a wall clock time
+ *  Program:  kalarm
+ *  Copyright © 2017 by David Jarvie <djarvie@kde.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include "kalarm.h"
+#include "clocktimer.h"
+
+#include "config-kalarm.h"
+
+#include <QTimer>
+#include <QSocketNotifier>
+#include <QtDBus/QDBusConnection>
+#include "kalarm_debug.h"
+
+#if HAVE_SYS_TIMERFD_H
+#include <sys/timerfd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#ifndef TFD_TIMER_CANCEL_ON_SET
+#define TFD_TIMER_CANCEL_ON_SET (1 << 1)
+#endif
+#endif
+
+
+ClockTimer::ClockTimer(QObject* parent)
+    : QObject(parent),
+      mNotifier(nullptr),
+      mTimerFd(-1),
+      mActive(false)
+{
+    mPollTimer = new QTimer(this);
+    mPollTimer->setSingleShot(true);
+    connect(mPollTimer, &QTimer::timeout, this, &ClockTimer::slotPollTimer);
+
+#if HAVE_SYS_TIMERFD_H
+    mTimerFd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (mTimerFd < 0)
+        qCWarning(KALARM_LOG) << "timerfd_create() failed: polling the system clock instead";
+    else
+    {
+        mNotifier = new QSocketNotifier(mTimerFd, QSocketNotifier::Read, this);
+        connect(mNotifier, &QSocketNotifier::activated, this, &ClockTimer::slotTimerFd);
+    }
+#endif
+
+    // Find out when the system resumes from suspend, in case the clock
+    // change is not otherwise notified.
+    QDBusConnection::systemBus().connect(QStringLiteral("org.freedesktop.login1"),
+                                         QStringLiteral("/org/freedesktop/login1"),
+                                         QStringLiteral("org.freedesktop.login1.Manager"),
+                                         QStringLiteral("PrepareForSleep"),
+                                         this, SLOT(slotPrepareForSleep(bool)));
+}
+
+ClockTimer::~ClockTimer()
+{
+    delete mNotifier;
+#if HAVE_SYS_TIMERFD_H
+    if (mTimerFd >= 0)
+        ::close(mTimerFd);
+#endif
+}
+
+/******************************************************************************
+* Start the timer to expire at the specified UTC time.
+*/
+void ClockTimer::start(const QDateTime& utc)
+{
+    mExpiry = utc;
+    mActive = true;
+#if HAVE_SYS_TIMERFD_H
+    if (mTimerFd >= 0)
+    {
+        // Set an absolute expiry time on the real time clock, so that the
+        // time spent in suspend is taken into account, and ask to be
+        // notified if the clock is set.
+        const qint64 msecs = utc.toMSecsSinceEpoch();
+        struct itimerspec spec;
+        memset(&spec, 0, sizeof(spec));
+        spec.it_value.tv_sec  = msecs / 1000;
+        spec.it_value.tv_nsec = (msecs % 1000) * 1000000;
+        if (spec.it_value.tv_sec <= 0)
+        {
+            // A zero expiry time would disarm the timer
+            spec.it_value.tv_sec  = 0;
+            spec.it_value.tv_nsec = 1;
+        }
+        if (timerfd_settime(mTimerFd, TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET, &spec, nullptr) == 0)
+            return;
+        qCWarning(KALARM_LOG) << "timerfd_settime() failed:" << strerror(errno);
+    }
+#endif
+    startPollTimer();
+}
+
+/******************************************************************************
+* Stop the timer.
+*/
+void ClockTimer::stop()
+{
+    mActive = false;
+    mPollTimer->stop();
+#if HAVE_SYS_TIMERFD_H
+    if (mTimerFd >= 0)
+    {
+        struct itimerspec spec;
+        memset(&spec, 0, sizeof(spec));
+        timerfd_settime(mTimerFd, 0, &spec, nullptr);
+    }
+#endif
+}
+
+/******************************************************************************
+* Start the fallback timer. Its interval is limited so that if the system clock
+* jumps, for example when the system wakes from hibernation, the owner gets a
+* chance to re-evaluate the expiry time without too much delay.
+*/
+void ClockTimer::startPollTimer()
+{
+    qint64 interval = QDateTime::currentDateTimeUtc().msecsTo(mExpiry);
+    if (interval < 0)
+        interval = 0;
+    else if (interval > POLL_INTERVAL * 1000)
+        interval = POLL_INTERVAL * 1000;
+    mPollTimer->start(static_cast<int>(interval));
+}
+
+/******************************************************************************
+* Called when the timerfd becomes readable, either because the timer has
+* expired or because the system clock has been set.
+*/
+void ClockTimer::slotTimerFd()
+{
+#if HAVE_SYS_TIMERFD_H
+    uint64_t expirations;
+    if (::read(mTimerFd, &expirations, sizeof(expirations)) < 0)
+    {
+        if (errno == EAGAIN)
+            return;
+        if (errno == ECANCELED)
+            qCDebug(KALARM_LOG) << "System clock has changed";
+    }
+#endif
+    if (mActive)
+        expire();
+}
+
+/******************************************************************************
+* Called when the fallback timer expires.
+* Notify the owner so that it can check the time again, whether or not the
+* expiry time has been reached.
+*/
+void ClockTimer::slotPollTimer()
+{
+    if (mActive)
+        expire();
+}
+
+/******************************************************************************
+* Called when the system is about to suspend, or has just resumed.
+*/
+void ClockTimer::slotPrepareForSleep(bool sleeping)
+{
+    if (!sleeping  &&  mActive)
+    {
+        qCDebug(KALARM_LOG) << "System has resumed";
+        expire();
+    }
+}
+
+void ClockTimer::expire()
+{
+    stop();
+    Q_EMIT timeout();
+}
+
+// vim: et sw=4:
@@ -0,0 +1,90 @@
+/*
+ *  clocktimer.h  -  timer which expires at a wall clock time
+ *  Program:  kalarm
+ *  Copyright © 2017 by David Jarvie <djarvie@kde.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#ifndef CLOCKTIMER_H
+#define CLOCKTIMER_H
+
+/* @file clocktimer.h - timer which expires at a wall clock time */
+
+#include <QObject>
+#include <QDateTime>
+class QTimer;
+class QSocketNotifier;
+
+/** ClockTimer is a single shot timer which expires at a specified wall clock
+ *  time.
+ *
+ *  Where the system supports it (Linux timerfd), the timer sleeps until the
+ *  expiry time, and also times out immediately if the system clock is set or
+ *  the system resumes from suspend, so that the owner can re-evaluate what is
+ *  due. Otherwise, a QTimer is used which is restarted at most every
+ *  @ref POLL_INTERVAL seconds, so that clock changes are noticed within that
+ *  interval.
+ *
+ *  @author David Jarvie <djarvie@kde.org>
+ */
+class ClockTimer : public QObject
+{
+        Q_OBJECT
+    public:
+        explicit ClockTimer(QObject* parent = nullptr);
+        virtual ~ClockTimer();
+
+        /** Start the timer to expire at a given time.
+         *  If the timer is already active, it is restarted.
+         *  @param utc Expiry time, in UTC.
+         */
+        void start(const QDateTime& utc);
+        /** Stop the timer. */
+        void stop();
+        /** Return whether the timer is running. */
+        bool isActive() const   { return mActive; }
+        /** Return whether clock changes and system resumes are notified
+         *  immediately, so that polling is not needed. */
+        bool isClockAware() const  { return mTimerFd >= 0; }
+
+        /** Maximum interval in seconds between checks of the clock, when the
+         *  system does not notify clock changes. */
+        static const int POLL_INTERVAL = 60;
+
+    Q_SIGNALS:
+        /** Emitted when the expiry time is reached, or when the system clock
+         *  has changed or the system has resumed from suspend. */
+        void timeout();
+
+    private Q_SLOTS:
+        void slotTimerFd();
+        void slotPollTimer();
+        void slotPrepareForSleep(bool sleeping);
+
+    private:
+        void startPollTimer();
+        void expire();
+
+        QTimer*          mPollTimer;       // fallback timer when timerfd is unavailable
+        QSocketNotifier* mNotifier;        // notifies timerfd expiry
+        QDateTime        mExpiry;          // expiry time, in UTC
+        int              mTimerFd;         // timerfd file descriptor, or -1 if none
+        bool             mActive;          // the timer is running
+};
+
+#endif // CLOCKTIMER_H
+
+// vim: et sw=4:
@@ -0,0 +1,177 @@
+/*
+ *  startuptrace.cpp  -  record the timing of start-up phases
+ *  Program:  kalarm
+ *  Copyright © 2017 by David Jarvie <djarvie@kde.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include "kalarm.h"
+#include "startuptrace.h"
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSaveFile>
+#include <QVector>
+#include "kalarm_debug.h"
+
+namespace
+{
+struct TraceSpan
+{
+    QString name;
+    qint64  start;     // microseconds since recording started
+    qint64  duration;  // microseconds, or -1 if the span has not ended
+    int     lane;      // thread ID to show the span under
+};
+
+QElapsedTimer       traceTimer;      // started when recording starts
+QVector<TraceSpan>  traceSpans;      // spans recorded, in order of starting
+QHash<QString, int> traceOpenSpans;  // index in traceSpans of each open span
+QVector<bool>       traceLanes;      // whether each lane is used by an open span
+QString             traceFile;       // file to write the trace to
+bool                traceRecording = false;
+bool                traceFinished  = false;
+
+qint64 traceTime()
+{
+    return traceTimer.nsecsElapsed() / 1000;
+}
+}
+
+
+/******************************************************************************
+* Start recording spans. The trace file may be set by an environment variable.
+*/
+void StartupTrace::start()
+{
+    if (traceRecording  ||  traceFinished)
+        return;
+    traceTimer.start();
+    traceRecording = true;
+    const QByteArray path = qgetenv("KALARM_TRACE");
+    if (!path.isEmpty())
+        traceFile = QString::fromLocal8Bit(path);
+}
+
+void StartupTrace::setFile(const QString& path)
+{
+    traceFile = path;
+    if (traceFinished)
+        writeFile();
+}
+
+void StartupTrace::begin(const QString& name)
+{
+    if (!traceRecording  ||  traceOpenSpans.contains(name))
+        return;
+    if (traceFinished)
+        return;    // don't start new spans once start-up has finished
+    TraceSpan span;
+    span.name     = name;
+    span.start    = traceTime();
+    span.duration = -1;
+    // Show each span in the first lane which is not in use, so that spans
+    // which overlap without nesting are displayed correctly.
+    span.lane = traceLanes.indexOf(false);
+    if (span.lane < 0)
+    {
+        span.lane = traceLanes.count();
+        traceLanes += true;
+    }
+    else
+        traceLanes[span.lane] = true;
+    traceOpenSpans[name] = traceSpans.count();
+    traceSpans += span;
+}
+
+void StartupTrace::end(const QString& name)
+{
+    if (!traceRecording)
+        return;
+    QHash<QString, int>::Iterator it = traceOpenSpans.find(name);
+    if (it == traceOpenSpans.end())
+        return;
+    TraceSpan& span = traceSpans[it.value()];
+    span.duration = traceTime() - span.start;
+    traceLanes[span.lane] = false;
+    traceOpenSpans.erase(it);
+    if (traceFinished)
+    {
+        // A span which was open when start-up finished has now ended.
+        writeFile();
+        if (traceOpenSpans.isEmpty())
+            traceRecording = false;
+    }
+}
+
+/******************************************************************************
+* Called when start-up has finished. Recording stops once all open spans have
+* ended.
+*/
+void StartupTrace::finish()
+{
+    if (!traceRecording  ||  traceFinished)
+        return;
+    traceFinished = true;
+    writeFile();
+    if (traceOpenSpans.isEmpty())
+        traceRecording = false;
+}
+
+/******************************************************************************
+* Write the spans recorded so far to the trace file, if one is set.
+* Spans which have not yet ended are written as begin events.
+*/
+void StartupTrace::writeFile()
+{
+    if (traceFile.isEmpty())
+        return;
+    const qint64 pid = QCoreApplication::applicationPid();
+    QJsonArray events;
+    for (int i = 0, end = traceSpans.count();  i < end;  ++i)
+    {
+        const TraceSpan& span = traceSpans[i];
+        QJsonObject event;
+        event[QStringLiteral("name")] = span.name;
+        event[QStringLiteral("cat")]  = QStringLiteral("startup");
+        event[QStringLiteral("ph")]   = (span.duration >= 0) ? QStringLiteral("X") : QStringLiteral("B");
+        event[QStringLiteral("ts")]   = span.start;
+        if (span.duration >= 0)
+            event[QStringLiteral("dur")] = span.duration;
+        event[QStringLiteral("pid")]  = pid;
+        event[QStringLiteral("tid")]  = span.lane + 1;
+        events.append(event);
+    }
+    QJsonObject trace;
+    trace[QStringLiteral("traceEvents")]     = events;
+    trace[QStringLiteral("displayTimeUnit")] = QStringLiteral("ms");
+
+    QSaveFile file(traceFile);
+    if (!file.open(QIODevice::WriteOnly))
+    {
+        qCWarning(KALARM_LOG) << "Cannot open trace file" << traceFile;
+        return;
+    }
+    file.write(QJsonDocument(trace).toJson(QJsonDocument::Compact));
+    if (!file.commit())
+        qCWarning(KALARM_LOG) << "Error writing trace file" << traceFile;
+}
+
+// vim: et sw=4:
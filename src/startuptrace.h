@@ -0,0 +1,68 @@
+/*
+ *  startuptrace.h  -  record the timing of start-up phases
+ *  Program:  kalarm
+ *  Copyright © 2017 by David Jarvie <djarvie@kde.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#ifndef STARTUPTRACE_H
+#define STARTUPTRACE_H
+
+/* @file startuptrace.h - record the timing of start-up phases */
+
+#include <QString>
+
+/** StartupTrace records the start and end times of the phases of program
+ *  start-up, and writes them to a file in the Chrome trace event format, for
+ *  viewing in chrome://tracing or similar tools.
+ *
+ *  Spans are recorded from program start until start-up has finished and all
+ *  spans which were open at that time have ended. The trace is only written
+ *  if a trace file has been set, either by the environment variable
+ *  KALARM_TRACE or by the --trace command line option.
+ */
+class StartupTrace
+{
+    public:
+        /** Start recording. Must be called as early as possible. */
+        static void start();
+        /** Set the file to write the trace to. */
+        static void setFile(const QString& path);
+        /** Record the start of a span. */
+        static void begin(const QString& name);
+        /** Record the end of a span. */
+        static void end(const QString& name);
+        /** Note that start-up has finished, and write the trace file. */
+        static void finish();
+
+        /** Records a span for the lifetime of the instance. */
+        class Span
+        {
+            public:
+                explicit Span(const QString& name) : mName(name)  { StartupTrace::begin(mName); }
+                ~Span()   { StartupTrace::end(mName); }
+            private:
+                Q_DISABLE_COPY(Span)
+                QString mName;
+        };
+
+    private:
+        static void writeFile();
+};
+
+#endif // STARTUPTRACE_H
+
+// vim: et sw=4:
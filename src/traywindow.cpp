@@ -71,7 +71,6 @@ struct TipItem
 TrayWindow::TrayWindow(MainWindow* parent)
     : KStatusNotifierItem(parent),
       mAssocMainWindow(parent),
-      mAlarmsModel(nullptr),
       mStatusUpdateTimer(new QTimer(this)),
       mHaveDisabledAlarms(false)
 {
@@ -289,7 +288,7 @@ void TrayWindow::updateStatus()
             active = static_cast<bool>(event);
             if (event  &&  period > 0)
             {
-                KDateTime dt = event->nextTrigger(KAEvent::ALL_TRIGGER).effectiveKDateTime();
+                KDateTime dt = AlarmCalendar::resources()->nextTrigger(*event, KAEvent::ALL_TRIGGER).effectiveKDateTime();
                 qint64 delay = KDateTime::currentLocalDateTime().secsTo(dt);
                 delay -= static_cast<qint64>(period) * 60;   // delay until icon to be shown
                 active = (delay <= 0);
@@ -358,17 +357,15 @@ QString TrayWindow::tooltipAlarmText() const
     // Get today's and tomorrow's alarms, sorted in time order
     int i, iend;
     QList<TipItem> items;
-    QVector<KAEvent> events = KAlarm::getSortedActiveEvents(const_cast<TrayWindow*>(this), &mAlarmsModel);
+    // Ignore alarms after tomorrow at the current clock time
+    const KAEvent::List events = AlarmCalendar::resources()->upcomingAlarms(KDateTime(), tomorrow);
     for (i = 0, iend = events.count();  i < iend;  ++i)
     {
-        KAEvent* event = &events[i];
+        const KAEvent* event = events[i];
         if (event->actionSubType() == KAEvent::MESSAGE)
         {
             TipItem item;
-            QDateTime dateTime = event->nextTrigger(KAEvent::DISPLAY_TRIGGER).effectiveKDateTime().toLocalZone().dateTime();
-            if (dateTime > tomorrow.dateTime())
-                break;   // ignore alarms after tomorrow at the current clock time
-            item.dateTime = dateTime;
+            item.dateTime = AlarmCalendar::resources()->nextTrigger(*event, KAEvent::DISPLAY_TRIGGER).effectiveKDateTime().toLocalZone().dateTime();
 
             // The alarm is due today, or early tomorrow
             if (Preferences::showTooltipAlarmTime())
@@ -32,7 +32,6 @@ class QTimer;
 class KToggleAction;
 class MainWindow;
 class NewAlarmAction;
-class AlarmListModel;
 
 using namespace KAlarmCal;
 
@@ -70,7 +69,6 @@ class TrayWindow : public KStatusNotifierItem
         MainWindow*     mAssocMainWindow;     // main window associated with this, or null
         KToggleAction*  mActionEnabled;
         NewAlarmAction* mActionNew;
-        mutable AlarmListModel* mAlarmsModel; // active alarms sorted in time order
         QTimer*         mStatusUpdateTimer;
         QTimer*         mToolTipUpdateTimer;
         bool            mHaveDisabledAlarms;  // some individually disabled alarms exist
@@ -0,0 +1,202 @@
+/*
+ *  triggerheap.cpp  -  priority index of alarm trigger times
+ *  Program:  kalarm
+ *  Copyright © 2017 by David Jarvie <djarvie@kde.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include "triggerheap.h"
+
+#include <KDateTime>
+
+
+/******************************************************************************
+* Convert a trigger time to the key used to order the heap.
+*/
+qint64 TriggerHeap::triggerKey(const KDateTime& dt)
+{
+    return dt.toUtc().dateTime().toMSecsSinceEpoch();
+}
+
+/******************************************************************************
+* Insert an event into the heap, or reposition it if its trigger time has
+* changed. An invalid trigger time removes the event.
+* Reply = true if the earliest event or its trigger time has changed.
+*/
+bool TriggerHeap::update(KAEvent* event, const KDateTime& trigger)
+{
+    const EventId id(*event);
+    if (!trigger.isValid())
+        return remove(id);
+
+    const KAEvent* oldTop = top();
+    const qint64 oldTime = topTime();
+    const Entry entry(triggerKey(trigger), event, id);
+    QHash<EventId, int>::ConstIterator it = mIndex.constFind(id);
+    if (it == mIndex.constEnd())
+    {
+        mHeap.append(entry);
+        mIndex[id] = mHeap.count() - 1;
+        siftUp(mHeap.count() - 1);
+    }
+    else
+    {
+        const int index = it.value();
+        const qint64 oldKey = mHeap[index].time;
+        place(index, entry);
+        if (entry.time < oldKey)
+            siftUp(index);
+        else
+            siftDown(index);
+    }
+    return top() != oldTop  ||  topTime() != oldTime;
+}
+
+/******************************************************************************
+* Remove an event from the heap.
+* Reply = true if the earliest event or its trigger time has changed.
+*/
+bool TriggerHeap::remove(const EventId& id)
+{
+    QHash<EventId, int>::Iterator it = mIndex.find(id);
+    if (it == mIndex.end())
+        return false;
+    const int index = it.value();
+    mIndex.erase(it);
+    removeAt(index);
+    return !index;
+}
+
+/******************************************************************************
+* Remove all events belonging to a collection.
+* Reply = true if the earliest event or its trigger time has changed.
+*/
+bool TriggerHeap::removeCollection(Akonadi::Collection::Id collectionId)
+{
+    const KAEvent* oldTop = top();
+    const qint64 oldTime = topTime();
+    int count = 0;
+    for (int i = 0, end = mHeap.count();  i < end;  ++i)
+    {
+        if (mHeap[i].id.collectionId() == collectionId)
+            mIndex.remove(mHeap[i].id);
+        else
+            mHeap[count++] = mHeap[i];
+    }
+    if (count == mHeap.count())
+        return false;
+    mHeap.resize(count);
+
+    // Rebuild the heap order from the remaining entries
+    for (int i = 0;  i < count;  ++i)
+        mIndex[mHeap[i].id] = i;
+    for (int i = count / 2;  --i >= 0;  )
+        siftDown(i);
+    return top() != oldTop  ||  topTime() != oldTime;
+}
+
+/******************************************************************************
+* Return all events whose trigger time is at or before the specified time.
+* Only the subtrees of the heap whose roots are due need to be examined.
+*/
+QVector<KAEvent*> TriggerHeap::due(const KDateTime& dt) const
+{
+    QVector<KAEvent*> events;
+    if (mHeap.isEmpty())
+        return events;
+    const qint64 key = triggerKey(dt);
+    const int count = mHeap.count();
+    QVector<int> pending;
+    pending.append(0);
+    while (!pending.isEmpty())
+    {
+        const int index = pending.takeLast();
+        if (mHeap[index].time > key)
+            continue;
+        events.append(mHeap[index].event);
+        const int child = 2 * index + 1;
+        if (child < count)
+            pending.append(child);
+        if (child + 1 < count)
+            pending.append(child + 1);
+    }
+    return events;
+}
+
+/******************************************************************************
+* Remove the entry at the given position, whose index entry has already been
+* removed, and restore the heap order.
+*/
+void TriggerHeap::removeAt(int index)
+{
+    const int last = mHeap.count() - 1;
+    if (index != last)
+    {
+        const qint64 oldKey = mHeap[index].time;
+        place(index, mHeap[last]);
+        mHeap.removeLast();
+        if (mHeap[index].time < oldKey)
+            siftUp(index);
+        else
+            siftDown(index);
+    }
+    else
+        mHeap.removeLast();
+}
+
+void TriggerHeap::siftUp(int index)
+{
+    const Entry entry = mHeap[index];
+    while (index > 0)
+    {
+        const int parent = (index - 1) / 2;
+        if (mHeap[parent].time <= entry.time)
+            break;
+        place(index, mHeap[parent]);
+        index = parent;
+    }
+    place(index, entry);
+}
+
+void TriggerHeap::siftDown(int index)
+{
+    const Entry entry = mHeap[index];
+    const int count = mHeap.count();
+    for (;;)
+    {
+        int child = 2 * index + 1;
+        if (child >= count)
+            break;
+        if (child + 1 < count  &&  mHeap[child + 1].time < mHeap[child].time)
+            ++child;
+        if (entry.time <= mHeap[child].time)
+            break;
+        place(index, mHeap[child]);
+        index = child;
+    }
+    place(index, entry);
+}
+
+/******************************************************************************
+* Store an entry at a heap position, and record its position in the index.
+*/
+void TriggerHeap::place(int index, const Entry& entry)
+{
+    mHeap[index] = entry;
+    mIndex[entry.id] = index;
+}
+
+// vim: et sw=4:
@@ -0,0 +1,94 @@
+/*
+ *  triggerheap.h  -  priority index of alarm trigger times
+ *  Program:  kalarm
+ *  Copyright © 2017 by David Jarvie <djarvie@kde.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#ifndef TRIGGERHEAP_H
+#define TRIGGERHEAP_H
+
+#include "eventid.h"
+
+#include <kalarmcal/kaevent.h>
+
+#include <QHash>
+#include <QVector>
+
+class KDateTime;
+
+using namespace KAlarmCal;
+
+
+/** Indexed binary min-heap of events ordered by their next trigger time.
+ *  The earliest event is available in constant time, and insertion, update
+ *  and removal of any event take logarithmic time.
+ *  The heap does not own the KAEvent instances which it references.
+ */
+class TriggerHeap
+{
+    public:
+        TriggerHeap() {}
+        bool      isEmpty() const        { return mHeap.isEmpty(); }
+        int       count() const          { return mHeap.count(); }
+        bool      contains(const EventId& id) const  { return mIndex.contains(id); }
+        /** Return the event with the earliest trigger time, or null if none. */
+        KAEvent*  top() const            { return mHeap.isEmpty() ? nullptr : mHeap[0].event; }
+        /** Return the trigger time (UTC milliseconds since the epoch) of the earliest event. */
+        qint64    topTime() const        { return mHeap.isEmpty() ? 0 : mHeap[0].time; }
+
+        /** Insert an event, or update its position if it is already held.
+         *  If @p trigger is invalid, the event is removed.
+         *  @return true if the earliest event or its trigger time has changed.
+         */
+        bool      update(KAEvent* event, const KDateTime& trigger);
+        /** Remove an event.
+         *  @return true if the earliest event or its trigger time has changed.
+         */
+        bool      remove(const EventId&);
+        /** Remove all events belonging to a collection.
+         *  @return true if the earliest event or its trigger time has changed.
+         */
+        bool      removeCollection(Akonadi::Collection::Id);
+        void      clear()                { mHeap.clear();  mIndex.clear(); }
+        /** Return all events whose trigger time is at or before @p dt, in no
+         *  particular order.
+         */
+        QVector<KAEvent*> due(const KDateTime& dt) const;
+
+        static qint64 triggerKey(const KDateTime&);
+
+    private:
+        struct Entry
+        {
+            Entry() : time(0), event(nullptr) {}
+            Entry(qint64 t, KAEvent* e, const EventId& i) : time(t), event(e), id(i) {}
+            qint64    time;    // trigger time, UTC milliseconds since the epoch
+            KAEvent*  event;
+            EventId   id;
+        };
+        void      removeAt(int index);
+        void      siftUp(int index);
+        void      siftDown(int index);
+        void      place(int index, const Entry&);
+
+        QVector<Entry>       mHeap;    // binary heap, earliest trigger time first
+        QHash<EventId, int>  mIndex;   // position of each event in mHeap
+};
+
+#endif // TRIGGERHEAP_H
+
+// vim: et sw=4:
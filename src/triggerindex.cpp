@@ -0,0 +1,103 @@
+/*
+ *  triggerindex.cpp  -  ordered index of alarm trigger times
+ *  Program:  kalarm
+ *  Copyright © 2017 by David Jarvie <djarvie@kde.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include "triggerindex.h"
+#include "triggerheap.h"
+
+#include <KDateTime>
+
+#include <limits>
+
+
+/******************************************************************************
+* Insert an event into the index, or reposition it if its trigger time has
+* changed. An invalid trigger time removes the event.
+*/
+void TriggerIndex::update(KAEvent* event, const KDateTime& trigger)
+{
+    const EventId id(*event);
+    if (!trigger.isValid())
+    {
+        remove(id);
+        return;
+    }
+    const qint64 time = TriggerHeap::triggerKey(trigger);
+    QHash<EventId, qint64>::Iterator it = mTimes.find(id);
+    if (it != mTimes.end())
+    {
+        if (it.value() != time)
+            mEvents.remove(Key(it.value(), id));
+        it.value() = time;
+    }
+    else
+        mTimes.insert(id, time);
+    mEvents.insert(Key(time, id), event);
+}
+
+/******************************************************************************
+* Remove an event from the index.
+*/
+void TriggerIndex::remove(const EventId& id)
+{
+    QHash<EventId, qint64>::Iterator it = mTimes.find(id);
+    if (it == mTimes.end())
+        return;
+    mEvents.remove(Key(it.value(), id));
+    mTimes.erase(it);
+}
+
+/******************************************************************************
+* Remove all events belonging to a collection from the index.
+*/
+void TriggerIndex::removeCollection(Akonadi::Collection::Id id)
+{
+    for (QHash<EventId, qint64>::Iterator it = mTimes.begin();  it != mTimes.end();  )
+    {
+        if (it.key().collectionId() == id)
+        {
+            mEvents.remove(Key(it.value(), it.key()));
+            it = mTimes.erase(it);
+        }
+        else
+            ++it;
+    }
+}
+
+/******************************************************************************
+* Return the events whose trigger times are in a range, in trigger time order.
+* Both ends of the range are inclusive.
+*/
+KAEvent::List TriggerIndex::events(const KDateTime& start, const KDateTime& end, int maxCount) const
+{
+    KAEvent::List result;
+    QMap<Key, KAEvent*>::ConstIterator it = start.isValid()
+                                          ? mEvents.lowerBound(Key(TriggerHeap::triggerKey(start), EventId(std::numeric_limits<Akonadi::Collection::Id>::min(), QString())))
+                                          : mEvents.constBegin();
+    const qint64 endTime = end.isValid() ? TriggerHeap::triggerKey(end) : 0;
+    for ( ;  it != mEvents.constEnd()  &&  (maxCount < 0  ||  result.count() < maxCount);  ++it)
+    {
+        if (end.isValid()  &&  it.key().first > endTime)
+            break;
+        result += it.value();
+    }
+    return result;
+}
+
+// vim: et sw=4:
@@ -0,0 +1,78 @@
+/*
+ *  triggerindex.h  -  ordered index of alarm trigger times
+ *  Program:  kalarm
+ *  Copyright © 2017 by David Jarvie <djarvie@kde.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#ifndef TRIGGERINDEX_H
+#define TRIGGERINDEX_H
+
+/* @file triggerindex.h - ordered index of alarm trigger times */
+
+#include "eventid.h"
+
+#include <kalarmcal/kaevent.h>
+
+#include <QHash>
+#include <QMap>
+#include <QPair>
+
+class KDateTime;
+
+using namespace KAlarmCal;
+
+
+/** Index of events held in trigger time order, allowing the events which
+ *  trigger in any time range to be found without scanning all events.
+ *  Insertion, update and removal of an event take logarithmic time.
+ *  The index does not own the KAEvent instances which it references.
+ */
+class TriggerIndex
+{
+    public:
+        TriggerIndex() {}
+        bool      isEmpty() const        { return mTimes.isEmpty(); }
+        int       count() const          { return mTimes.count(); }
+        bool      contains(const EventId& id) const  { return mTimes.contains(id); }
+
+        /** Insert an event, or update its position if it is already held.
+         *  If @p trigger is invalid, the event is removed.
+         */
+        void      update(KAEvent* event, const KDateTime& trigger);
+        /** Remove an event. */
+        void      remove(const EventId&);
+        /** Remove all events belonging to a collection. */
+        void      removeCollection(Akonadi::Collection::Id);
+        void      clear()                { mEvents.clear();  mTimes.clear(); }
+
+        /** Return events in trigger time order.
+         *  @param start     earliest trigger time to include, or invalid for no limit
+         *  @param end       latest trigger time to include, or invalid for no limit
+         *  @param maxCount  maximum number of events to return, or -1 for no limit
+         */
+        KAEvent::List events(const KDateTime& start, const KDateTime& end, int maxCount = -1) const;
+
+    private:
+        typedef QPair<qint64, EventId> Key;   // trigger time (UTC milliseconds since the epoch), event ID
+
+        QMap<Key, KAEvent*>    mEvents;   // events ordered by trigger time
+        QHash<EventId, qint64> mTimes;    // trigger time of each event in mEvents
+};
+
+#endif // TRIGGERINDEX_H
+
+// vim: et sw=4:
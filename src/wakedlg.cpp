@@ -32,8 +32,6 @@
 #include <kalarmcal/kaevent.h>
 
 #include <KLocalizedString>
-#include <KSharedConfig>
-#include <kconfiggroup.h>
 
 #include <QTimer>
 #include "kalarm_debug.h"
@@ -175,11 +173,7 @@ void WakeFromSuspendDlg::useWakeClicked()
     unsigned triggerTime = dt.addSecs(-advance * 60).toTime_t();
     if (KAlarm::setRtcWakeTime(triggerTime, this))
     {
-        QStringList param;
-        param << QString::number(event.collectionId()) << event.id() << QString::number(triggerTime);
-        KConfigGroup config(KSharedConfig::openConfig(), "General");
-        config.writeEntry("RtcWake", param);
-        config.sync();
+        KAlarm::setRtcWakeConfig(event.collectionId(), event.id(), triggerTime);
         Preferences::setWakeFromSuspendAdvance(advance);
         close();
     }